@@ -5,6 +5,9 @@
 #include <string.h>
 #include <pthread.h>
 #include <assert.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/resource.h>
 
 #include "trie.h"
 
@@ -12,6 +15,7 @@
 #define THREAD_NUM 32 // Threads adding
 #define REPS 1000 // Number of strings each thread adds
 #define SUFFIX_REPS 200 // Number of suffix test strings
+#define BATCH_NUM 64 // Keys looked up by trie_longest_prefix_batch
 
 pthread_mutex_t lock;
 pthread_t tid[THREAD_NUM]; // Starts eight threads
@@ -177,6 +181,22 @@ static inline void get_rand_added_string(DATA_t * data, int * datalen) {
     pthread_mutex_unlock(&data_added_len_mutex[i]);
 }
 
+#define SYMBOLS_LEN (12*2*MAX_LEN + 1) // Enough for two keys of 32 bit symbols
+
+// Formats a key: plain chars for byte symbols, numbers for wider ones
+static char * sprint_symbols(char * out, const DATA_t * data, int len) {
+    int i, n = 0;
+
+    out[0] = '\0';
+    if (sizeof(DATA_t) == 1)
+        for (i = 0; i < len; i++)
+            n += sprintf(out + n, "%c", (char)data[i]);
+    else
+        for (i = 0; i < len; i++)
+            n += sprintf(out + n, i ? " %u" : "%u", (unsigned)data[i]);
+    return out;
+}
+
 static void print_trie(trie_ptr_t ptr);
 static inline void dump(trie_ptr_t ptr, int my_tid, const char * msg) {
     flockfile(stdout);
@@ -189,20 +209,21 @@ static inline void dump(trie_ptr_t ptr, int my_tid, const char * msg) {
 
 static inline void print_trie(trie_ptr_t ptr) {
     int res;
+    char key[SYMBOLS_LEN];
     trie_iterator_t iter;
     trie_iterator_init(&iter);
 
     while (trie_iterator_next(ptr, &iter)) {
-        printf("%.*s", trie_iterator_data_len(&iter), (char*)trie_iterator_data(&iter));
+        printf("%s", sprint_symbols(key, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
         printf(" (%d)\n", trie_iterator_data_len(&iter));
 
         // Now searches the data inside the trie (for debug)
         res = trie_find(ptr, trie_iterator_data(&iter),
                              trie_iterator_data_len(&iter));
         if (res == 0) {
-            char msg[32 + MAX_LEN];
-            sprintf(msg, "Cannot find this added string: %.*s\n",
-                trie_iterator_data_len(&iter), (char*)trie_iterator_data(&iter));
+            char msg[32 + SYMBOLS_LEN];
+            sprintf(msg, "Cannot find this added string: %s\n",
+                sprint_symbols(key, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
             dump(ptr, -1, msg); // This function should be called by main thread
             assert(0);
         }
@@ -215,7 +236,8 @@ static inline void print_trie_starting_with(trie_ptr_t ptr) {
     int nfound, res, datalen = (int)ceil(log(MAX_LEN));
     trie_iterator_t iter, iterck; // Iterator and iterator check
     trie_arr_t arr;
-    DATA_t str_to_search[MAX_LEN];
+    DATA_t str_to_search[2*MAX_LEN];
+    char key[SYMBOLS_LEN];
     // Now extracts a random smaller string and lists all the data starting with that
     
     if ( (datalen != 0) &&
@@ -237,20 +259,20 @@ static inline void print_trie_starting_with(trie_ptr_t ptr) {
     nfound = 0; // Number of elements found
     while (trie_suffix_iterator_next(ptr, arr, &iter)) {
         if (nfound++ == 0) // Executes only the first time
-            printf("   === All data starting with %.*s\n", datalen, str_to_search); 
-        printf("%.*s%.*s", datalen, str_to_search,
-                           trie_iterator_data_len(&iter), (char*)trie_iterator_data(&iter));
-        printf(" (%d)\n", datalen + trie_iterator_data_len(&iter));
+            printf("   === All data starting with %s\n", sprint_symbols(key, str_to_search, datalen));
 
-        // Now searches the data inside the trie (for debug)
         // NOTE: the iterator contains only the suffix, so copies the whole data
         memcpy(str_to_search + datalen, trie_iterator_data(&iter),
                trie_iterator_data_len(&iter)*sizeof*str_to_search);
+        printf("%s", sprint_symbols(key, str_to_search, datalen + trie_iterator_data_len(&iter)));
+        printf(" (%d)\n", datalen + trie_iterator_data_len(&iter));
+
+        // Now searches the data inside the trie (for debug)
         res = trie_find(ptr, str_to_search, datalen + trie_iterator_data_len(&iter));
         if (res == 0) {
-            char msg[32 + MAX_LEN];
-            sprintf(msg, "Cannot find this added string: %.*s%.*s\n", datalen, str_to_search,
-                trie_iterator_data_len(&iter), (char*)trie_iterator_data(&iter));
+            char msg[32 + SYMBOLS_LEN];
+            sprintf(msg, "Cannot find this added string: %s\n",
+                sprint_symbols(key, str_to_search, datalen + trie_iterator_data_len(&iter)));
             dump(ptr, -1, msg); // This function should be called by main thread
             assert(0);
         }
@@ -261,7 +283,8 @@ static inline void print_trie_starting_with(trie_ptr_t ptr) {
         if (memcmp(trie_iterator_data(&iterck) + datalen, trie_iterator_data(&iter),
                    trie_iterator_data_len(&iter)*sizeof*trie_iterator_data(&iter)) != 0) {
             printf("   === ERROR Skipping data ===\n");
-            printf(" Looking for %.*s (%d)\n", trie_iterator_data_len(&iterck), trie_iterator_data(&iterck),
+            printf(" Looking for %s (%d)\n",
+                   sprint_symbols(key, trie_iterator_data(&iterck), trie_iterator_data_len(&iterck)),
                                                trie_iterator_data_len(&iterck) );
             assert(0);
         }
@@ -272,7 +295,7 @@ static inline void print_trie_starting_with(trie_ptr_t ptr) {
     if (nfound != 0)
         printf("found: %d\n", nfound);
 //    if (nfound >= 2) // Do not print nothing if nothing was found
-//        printf("   === End of all strings starting with %.*s\n", datalen, str_to_search);
+//        printf("   === End of all strings starting with %s\n", sprint_symbols(key, str_to_search, datalen));
 }
 
 int my_get_tid(void) {
@@ -291,6 +314,7 @@ void * add_data(void * ptr_void) {
 
     int rand_len;
     DATA_t rand_data[MAX_LEN];
+    char key[SYMBOLS_LEN];
     int i, res;
 
     flockfile(stdout);
@@ -307,7 +331,7 @@ void * add_data(void * ptr_void) {
 
         flockfile(stdout); // Debug functionality
         printf("Thread #%d says: adding string: ", my_tid + 2);
-        printf("%.*s\n", rand_len, (char*)rand_data);
+        printf("%s\n", sprint_symbols(key, rand_data, rand_len));
         fflush(stdout);
         funlockfile(stdout);
 
@@ -316,17 +340,20 @@ void * add_data(void * ptr_void) {
 
         res = trie_find(ptr, rand_data, rand_len);
         if (res == 0) {
-            char msg[32 + MAX_LEN];
-            sprintf(msg, "Cannot find just added string: %.*s\n", rand_len, (char*)rand_data);
+            char msg[32 + SYMBOLS_LEN];
+            sprintf(msg, "Cannot find just added string: %s\n", sprint_symbols(key, rand_data, rand_len));
             dump(ptr, my_tid, msg);
             assert(0);
         }
 
+        res = trie_longest_prefix(ptr, rand_data, rand_len);
+        assert(res == rand_len); // The string itself is the longest prefix
+
         get_rand_added_string(rand_data, &rand_len);
         res = trie_find(ptr, rand_data, rand_len);
         if (res == 0) {
-            char msg[32 + MAX_LEN];
-            sprintf(msg, "Cannot find this added string: %.*s\n", rand_len, (char*)rand_data);
+            char msg[32 + SYMBOLS_LEN];
+            sprintf(msg, "Cannot find this added string: %s\n", sprint_symbols(key, rand_data, rand_len));
             dump(ptr, my_tid, msg);
             assert(0);
         }
@@ -340,6 +367,8 @@ void * add_data(void * ptr_void) {
 
         res = trie_find(ptr, rand_data, rand_len);
         assert(!res);
+        res = trie_longest_prefix(ptr, rand_data, rand_len);
+        assert(res < rand_len); // Odd strings are never stored
     }
 
     pthread_exit(0);
@@ -352,6 +381,7 @@ void * check_added_data(void * ptr_void) {
 
     int string_lenght = 0;
     DATA_t string[MAX_LEN];
+    char key[SYMBOLS_LEN];
     int i, res;
 
     for (i = 0; i < REPS; i++) { // For each added string
@@ -364,9 +394,9 @@ void * check_added_data(void * ptr_void) {
         // Now searches the string, and asserts the string was found
         res = trie_find(ptr, string, string_lenght);
         if (res == 0) {
-            char msg[32 + MAX_LEN];
-            sprintf(msg, "Cannot find this added string: %.*s\n",
-                            string_lenght, (char*)string);
+            char msg[32 + SYMBOLS_LEN];
+            sprintf(msg, "Cannot find this added string: %s\n",
+                            sprint_symbols(key, string, string_lenght));
             dump(ptr, my_tid, msg);
             assert(0);
         }
@@ -376,6 +406,788 @@ void * check_added_data(void * ptr_void) {
     __builtin_unreachable();
 }
 
+static int count_keys(const DATA_t * key, int len, void * ctx) {
+    (void)key;
+    (void)len;
+    (void)ctx;
+    return 0; // Never stops, trie_scan and trie_foreach count them
+}
+
+static int count_keys_parallel(const DATA_t * key, int len, int worker, void * ctx) {
+    (void)worker;
+    return count_keys(key, len, ctx);
+}
+
+static int levenshtein(const DATA_t * a, int alen, const DATA_t * b, int blen) {
+    int row[2*MAX_LEN + 1], i, j, diag, up;
+
+    assert(blen <= 2*MAX_LEN);
+    for (j = 0; j <= blen; j++)
+        row[j] = j;
+    for (i = 1; i <= alen; i++) {
+        diag = row[0];
+        row[0] = i;
+        for (j = 1; j <= blen; j++) {
+            up = row[j];
+            row[j] = diag + (a[i - 1] != b[j - 1]);
+            if (up + 1 < row[j])
+                row[j] = up + 1;
+            if (row[j - 1] + 1 < row[j])
+                row[j] = row[j - 1] + 1;
+            diag = up;
+        }
+    }
+    return row[blen];
+}
+
+static int longest_match(long long end, int len, int key, void * ctx) {
+    (void)key;
+    if ((len == *(int *)ctx) && (end == len)) // The whole text
+        *(int *)ctx = 0;
+    return 0;
+}
+
+// Keys and patterns of the checks below, as DATA_t arrays so they also hold with wide symbols
+static const DATA_t key_abc[] = {'a', 'b', 'c'}, key_abd[] = {'a', 'b', 'd'}, key_b[] = {'b'};
+static const DATA_t key_wal[] = {'w', 'a', 'l'}, key_ckpt[] = {'c', 'k', 'p', 't'};
+static const DATA_t pattern_all[] = {'*'}, pattern_lower[] = {'[', 'a', '-', 'z', ']', '*'};
+
+// Walks all the keys in order, count, rank and select must agree with the iterator
+void check_ranks(trie_ptr_t t) {
+    trie_iterator_t iter;
+    trie_arr_t key;
+    int k, res;
+
+    trie_iterator_init(&iter);
+    trie_arr_init(&key);
+    k = 0;
+    while (trie_iterator_next(t, &iter)) {
+        assert(trie_rank(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == k);
+        res = trie_select(t, k, &key);
+        assert(res == 1);
+        assert(trie_arr_len(&key) == trie_iterator_data_len(&iter));
+        assert(memcmp(trie_arr_data(&key), trie_iterator_data(&iter),
+                      trie_arr_len(&key)*sizeof(DATA_t)) == 0);
+        k++;
+    }
+    assert(trie_count(t) == k);
+    res = trie_select(t, k, &key);
+    assert(res == 0);
+    trie_arr_clear(&key);
+    trie_iterator_clear(&iter);
+}
+
+// Keys spread over t: stored ones, longer and shorter ones, in order
+static void batch_keys(trie_ptr_t t, DATA_t data[BATCH_NUM][MAX_LEN + 1], const DATA_t ** arrs, int * lens) {
+    trie_arr_t key;
+    int n, res;
+
+    trie_arr_init(&key);
+    for (n = 0; n < BATCH_NUM; n++) {
+        res = trie_select(t, (int)((long long)n*trie_count(t)/BATCH_NUM), &key);
+        lens[n] = (res == 1)?trie_arr_len(&key):0;
+        memcpy(data[n], trie_arr_data(&key), lens[n]*sizeof(DATA_t));
+        if (n%3 == 1)
+            data[n][lens[n]++] = 'z'; // Stored key plus one symbol
+        else if ((n%3 == 2) && (lens[n] > 0))
+            lens[n]--;
+        arrs[n] = data[n];
+    }
+    trie_arr_clear(&key);
+}
+
+// Batched longest prefix agrees with one lookup at a time
+void check_longest_prefix(trie_ptr_t t) {
+    DATA_t data[BATCH_NUM][MAX_LEN + 1];
+    const DATA_t * arrs[BATCH_NUM];
+    int lens[BATCH_NUM], res[BATCH_NUM];
+    int n;
+
+    batch_keys(t, data, arrs, lens);
+    trie_longest_prefix_batch(t, arrs, lens, res, BATCH_NUM);
+    for (n = 0; n < BATCH_NUM; n++)
+        assert(res[n] == trie_longest_prefix(t, arrs[n], lens[n]));
+}
+
+// Finger search agrees with one lookup at a time, keys come in order
+void check_finger_search(trie_ptr_t t) {
+    DATA_t data[BATCH_NUM][MAX_LEN + 1];
+    const DATA_t * arrs[BATCH_NUM];
+    int lens[BATCH_NUM], found[BATCH_NUM];
+    int n, res;
+
+    batch_keys(t, data, arrs, lens);
+    res = trie_find_sorted(t, arrs, lens, BATCH_NUM, found);
+    for (n = 0; n < BATCH_NUM; n++) {
+        assert(found[n] == (trie_find(t, arrs[n], lens[n]) != 0));
+        res -= found[n];
+    }
+    assert(res == 0);
+}
+
+// Backwards, with seek: each key is found, its neighbours have the next ranks
+void check_seek(trie_ptr_t t) {
+    trie_iterator_t iter;
+    trie_arr_t key;
+    int k, n, res;
+
+    trie_iterator_init(&iter);
+    trie_arr_init(&key);
+    k = n = trie_count(t);
+    while (trie_iterator_prev(t, &iter)) {
+        n--;
+        assert(trie_rank(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == n);
+        res = trie_select(t, n, &key);
+        assert(res == 1);
+        res = trie_iterator_seek_ge(t, &iter, trie_arr_data(&key), trie_arr_len(&key));
+        assert(res == 1);
+        assert(trie_rank(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == n);
+        res = trie_iterator_seek_gt(t, &iter, trie_arr_data(&key), trie_arr_len(&key));
+        assert(res == (n + 1 < k));
+        if (n + 1 < k)
+            assert(trie_rank(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == n + 1);
+        res = trie_iterator_seek_lt(t, &iter, trie_arr_data(&key), trie_arr_len(&key));
+        assert(res == (n > 0));
+        if (n > 0)
+            assert(trie_rank(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == n - 1);
+        res = trie_iterator_seek_le(t, &iter, trie_arr_data(&key), trie_arr_len(&key)); // Back on key
+        assert(res == 1);
+    }
+    assert(n == 0);
+    trie_arr_clear(&key);
+    trie_iterator_clear(&iter);
+}
+
+// Range scan between two keys must agree with their ranks
+void check_scan(trie_ptr_t t) {
+    trie_arr_t lo, hi;
+    int k;
+
+    trie_arr_init(&lo);
+    trie_arr_init(&hi);
+    k = trie_count(t);
+    trie_select(t, k/4, &lo);
+    trie_select(t, 3*k/4, &hi);
+    assert(trie_scan(t, trie_arr_data(&lo), trie_arr_len(&lo), trie_arr_data(&hi), trie_arr_len(&hi),
+                     count_keys, NULL) == 3*k/4 - k/4);
+    assert(trie_scan(t, NULL, 0, NULL, 0, count_keys, NULL) == k);
+    trie_arr_clear(&hi);
+    trie_arr_clear(&lo);
+}
+
+// Prefix cursor: keys starting with the first symbols of a stored key, ranked one after the other
+void check_cursor(trie_ptr_t t) {
+    trie_cursor_t cursor;
+    trie_arr_t lo;
+    int n, len, res;
+
+    trie_arr_init(&lo);
+    trie_select(t, trie_count(t)/4, &lo);
+    len = (trie_arr_len(&lo) < 2)?trie_arr_len(&lo):2;
+    res = trie_cursor_init(&cursor, t, trie_arr_data(&lo), len);
+    assert(res == SUCCESS);
+    n = 0;
+    while (trie_cursor_next(&cursor)) {
+        assert(trie_cursor_key_len(&cursor) >= len && trie_cursor_suffix_len(&cursor) >= 0);
+        assert(memcmp(trie_cursor_key(&cursor), trie_arr_data(&lo), len*sizeof(DATA_t)) == 0);
+        assert(trie_rank(t, trie_cursor_key(&cursor), trie_cursor_key_len(&cursor)) ==
+               trie_rank(t, trie_arr_data(&lo), len) + n);
+        if (n == 0) { // No lock is kept, the same thread can write meanwhile
+            trie_remove(t, trie_cursor_key(&cursor), trie_cursor_key_len(&cursor));
+            res = trie_add(t, trie_cursor_key(&cursor), trie_cursor_key_len(&cursor));
+            assert(res == SUCCESS);
+        }
+        n++;
+    }
+    trie_cursor_clear(&cursor);
+    assert(n == trie_count_prefix(t, trie_arr_data(&lo), len));
+    trie_arr_clear(&lo);
+}
+
+void check_foreach(trie_ptr_t t) {
+    assert(trie_foreach(t, count_keys, NULL) == trie_count(t));
+}
+
+void check_pattern(trie_ptr_t t) {
+    assert(trie_match_pattern(t, pattern_all, 1, count_keys, NULL) == trie_count(t));
+    assert(trie_match_pattern(t, pattern_lower, 6, count_keys, NULL) ==
+           trie_count(t) - trie_find(t, NULL, 0)); // Keys are lower case letters, but the empty one
+}
+
+#define RUN_THREADS 4
+
+static void * parallel_runner(void * ptr) {
+    trie_keys_t keys;
+    int i, k;
+
+    k = trie_count(ptr);
+    trie_keys_init(&keys);
+    for (i = 0; i < 16; i++) {
+        assert(trie_foreach_parallel(ptr, 4, count_keys_parallel, NULL) == k);
+        assert(trie_collect_parallel(ptr, 3, &keys) == k);
+    }
+    trie_keys_clear(&keys);
+    return NULL;
+}
+
+// Collected keys are sorted. Traversals from several threads at once share the pool, which is then stopped
+void check_parallel(trie_ptr_t t) {
+    pthread_t runners[RUN_THREADS];
+    trie_keys_t keys;
+    int i, res;
+
+    assert(trie_foreach_parallel(t, 4, count_keys_parallel, NULL) == trie_count(t));
+    trie_keys_init(&keys);
+    res = trie_collect_parallel(t, 4, &keys);
+    assert(res == trie_count(t));
+    assert(trie_rank(t, trie_arr_data(&(keys.data)), keys.lens[0]) == 0);
+    for (i = 1, res = 0; i < keys.num; res += keys.lens[i - 1], i++)
+        assert(trie_rank(t, trie_arr_data(&(keys.data)) + res + keys.lens[i - 1], keys.lens[i]) == i);
+    trie_keys_clear(&keys);
+
+    for (i = 0; i < RUN_THREADS; i++) {
+        res = pthread_create(runners + i, NULL, parallel_runner, t);
+        assert(res == 0);
+#ifdef NO_PTHREAD
+        pthread_join(runners[i], NULL);
+#endif
+    }
+#ifndef NO_PTHREAD
+    for (i = 0; i < RUN_THREADS; i++)
+        pthread_join(runners[i], NULL);
+#endif
+    trie_parallel_shutdown();
+    assert(trie_foreach_parallel(t, 4, count_keys_parallel, NULL) == trie_count(t)); // Restarts it
+    trie_parallel_shutdown();
+}
+
+// A stored key is the only one at distance 0. Within a larger distance, same as sorting every key
+// by distance and key, then taking the first 8
+void check_fuzzy(trie_ptr_t t) {
+    trie_iterator_t iter;
+    trie_arr_t lo;
+    trie_keys_t keys;
+    int i, n, res, dists[8], within[3];
+
+    if (trie_count(t) == 0)
+        return;
+    trie_iterator_init(&iter);
+    trie_arr_init(&lo);
+    trie_keys_init(&keys);
+    trie_select(t, trie_count(t)/4, &lo);
+    res = trie_fuzzy_find(t, trie_arr_data(&lo), trie_arr_len(&lo), 0, &keys, NULL, 8);
+    assert(res == 1);
+    res = trie_fuzzy_find(t, trie_arr_data(&lo), trie_arr_len(&lo), 2, &keys, dists, 8);
+    assert(res >= 1);
+    assert(keys.lens[0] == trie_arr_len(&lo)); // Closest first
+
+    memset(within, 0, sizeof(within));
+    while (trie_iterator_next(t, &iter)) {
+        n = levenshtein(trie_iterator_data(&iter), trie_iterator_data_len(&iter),
+                        trie_arr_data(&lo), trie_arr_len(&lo));
+        if (n <= 2)
+            within[n]++;
+    }
+    n = 0;
+    for (i = 0; i < res; n += keys.lens[i++]) {
+        assert(dists[i] == levenshtein(trie_arr_data(&(keys.data)) + n, keys.lens[i],
+                                       trie_arr_data(&lo), trie_arr_len(&lo)));
+        within[dists[i]]--; // Taken
+        if (i > 0)
+            assert((dists[i - 1] < dists[i]) || ((dists[i - 1] == dists[i]) &&
+                   (trie_rank(t, trie_arr_data(&(keys.data)) + n - keys.lens[i - 1], keys.lens[i - 1]) <
+                    trie_rank(t, trie_arr_data(&(keys.data)) + n, keys.lens[i]))));
+    }
+    for (i = 0; i < dists[res - 1]; i++) // Every closer key was taken
+        assert(within[i] == 0);
+    assert((res == 8) || (within[0] + within[1] + within[2] == 0));
+    trie_keys_clear(&keys);
+    trie_arr_clear(&lo);
+    trie_iterator_clear(&iter);
+}
+
+// A stored key must be found scanning itself
+void check_aho(trie_ptr_t t) {
+    trie_aho_t aho;
+    trie_aho_scanner_t scanner;
+    trie_arr_t lo;
+    int res;
+
+    trie_arr_init(&lo);
+    trie_select(t, trie_count(t)/4, &lo);
+    res = trie_aho_build(t, &aho);
+    assert(res == SUCCESS);
+    trie_aho_scanner_init(&scanner, &aho);
+    res = trie_arr_len(&lo);
+    trie_aho_scan(&scanner, trie_arr_data(&lo), trie_arr_len(&lo), longest_match, &res);
+    assert(res == 0 || trie_count(t) == 0);
+    trie_aho_clear(&aho);
+    trie_arr_clear(&lo);
+}
+
+// The frozen copy has every key
+void check_louds(trie_ptr_t t) {
+    trie_louds_t frozen;
+    trie_iterator_t iter;
+    int res;
+
+    res = trie_freeze(t, &frozen);
+    assert(res == SUCCESS);
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter))
+        assert(trie_louds_find(&frozen, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
+    trie_iterator_clear(&iter);
+    assert(trie_louds_foreach_prefix(&frozen, NULL, 0, count_keys, NULL) == trie_count(t));
+    trie_louds_clear(&frozen);
+}
+
+// Same for the double array, which codes up to 16 bit symbols
+void check_double_array(trie_ptr_t t) {
+    trie_da_t da;
+    trie_iterator_t iter;
+    int res;
+
+    res = trie_da_build(t, &da);
+    assert(res == ((sizeof(DATA_t) <= 2)?SUCCESS:FAIL));
+    if (res != SUCCESS)
+        return;
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter))
+        assert(trie_da_find(&da, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
+    trie_iterator_clear(&iter);
+    assert(trie_da_foreach_prefix(&da, NULL, 0, count_keys, NULL) == trie_count(t));
+    trie_da_clear(&da);
+}
+
+// Writes reach every replica
+void check_replicas(trie_ptr_t t) {
+    trie_replicated_t replicated;
+    trie_arr_t lo;
+    int res;
+
+    trie_arr_init(&lo);
+    trie_select(t, trie_count(t)/4, &lo);
+    trie_replicated_init(&replicated, 2);
+    res = trie_replicated_add(&replicated, trie_arr_data(&lo), trie_arr_len(&lo));
+    assert(res == SUCCESS);
+    assert(trie_replicated_find(&replicated, trie_arr_data(&lo), trie_arr_len(&lo)));
+    assert(trie_find(replicated.replicas[1], trie_arr_data(&lo), trie_arr_len(&lo)));
+    trie_replicated_remove(&replicated, trie_arr_data(&lo), trie_arr_len(&lo));
+    assert(trie_count(replicated.replicas[0]) == 0);
+    trie_replicated_clear(&replicated);
+    trie_arr_clear(&lo);
+}
+
+// Chunk counters, all zero without TRIE_NUMA or TRIE_HUGE_PAGES
+void check_huge_pages(void) {
+    trie_mem_stats_t stats;
+
+    trie_mem_stats(&stats);
+    assert(stats.hugetlb_chunks + stats.thp_chunks <= stats.chunks);
+    assert(stats.large_blocks <= stats.chunks);
+}
+
+// Removing a prefix drops its whole subtree
+void check_remove_prefix(void) {
+    trie_t small;
+    int res;
+
+    trie_init(&small);
+    trie_add(&small, key_abc, 3);
+    trie_add(&small, key_abd, 3);
+    trie_add(&small, key_b, 1);
+    res = trie_remove_prefix(&small, key_abc, 2);
+    assert(res == 2);
+    assert(trie_count(&small) == 1 && trie_find(&small, key_b, 1));
+    res = trie_remove_prefix(&small, NULL, 0);
+    assert(res == 1);
+    assert(trie_count(&small) == 0);
+    trie_clear(&small);
+    trie_reaper_flush();
+}
+
+// Logged copy of t, recovered from checkpoint and log. Files left by an aborted run go first
+void check_wal(trie_ptr_t t) {
+    trie_wal_t wal;
+    trie_wal_stats_t wal_stats;
+    struct rlimit fsize, no_fsize;
+    trie_iterator_t iter;
+    trie_t small;
+    int n, res;
+
+    trie_ckpt_remove("trie_wal_test.ckpt");
+    remove("trie_wal_test.log");
+    remove("trie_wal_test.log.old");
+    trie_init(&small);
+    res = trie_wal_open(&wal, &small, "trie_wal_test", NULL);
+    assert(res == SUCCESS);
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter)) {
+        n = trie_wal_add(&wal, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+        assert(n == SUCCESS);
+    }
+    trie_iterator_clear(&iter);
+    res = trie_wal_checkpoint(&wal); // Log is empty after it
+    assert(res == SUCCESS);
+    res = trie_find(&small, key_wal, 3); // Random keys may have it, then it goes away
+    // The log cannot grow: the record stays buffered, operations are refused until it is written
+    signal(SIGXFSZ, SIG_IGN);
+    getrlimit(RLIMIT_FSIZE, &fsize);
+    no_fsize = fsize;
+    no_fsize.rlim_cur = 0;
+    setrlimit(RLIMIT_FSIZE, &no_fsize);
+    n = trie_wal_add(&wal, key_wal, 3);
+    assert(n == SUCCESS);
+    n = trie_wal_sync(&wal);
+    assert(n == FAIL);
+    n = trie_wal_remove(&wal, key_wal, 3);
+    assert(n == FAIL && trie_find(&small, key_wal, 3));
+    setrlimit(RLIMIT_FSIZE, &fsize);
+    n = trie_wal_sync(&wal);
+    assert(n == SUCCESS);
+    n = trie_wal_remove(&wal, key_wal, 3);
+    assert(n == SUCCESS);
+    n = trie_wal_sync(&wal);
+    assert(n == SUCCESS);
+    n = trie_wal_close(&wal);
+    assert(n == SUCCESS);
+    trie_clear(&small);
+    trie_init(&small);
+    n = trie_wal_open(&wal, &small, "trie_wal_test", NULL);
+    assert(n == SUCCESS);
+    trie_wal_stats(&wal, &wal_stats);
+    assert(trie_count(&small) == trie_count(t) - res && wal_stats.replayed == 2);
+    n = trie_wal_close(&wal);
+    assert(n == SUCCESS);
+    trie_ckpt_remove("trie_wal_test.ckpt");
+    remove("trie_wal_test.log");
+    trie_clear(&small);
+}
+
+#define CKPT_KEYS 6000
+
+static void ckpt_key(DATA_t * key, int i) {
+    key[0] = 'a' + i%26;
+    key[1] = 'a' + (i/26)%26;
+    key[2] = 'a' + (i/676)%26;
+}
+
+static void * ckpt_writer(void * ptr) {
+    DATA_t key[3];
+    int i;
+
+    for (i = 0; i < CKPT_KEYS; i++) {
+        ckpt_key(key, i);
+        trie_add(ptr, key, 3);
+    }
+    return NULL;
+}
+
+// Incremental checkpoint of a copy of t after one more key, then loads the chain. Then checkpoints
+// taken while a writer adds keys, and a final one: the chain has every key
+void check_ckpt(trie_ptr_t t) {
+    DATA_t key[3];
+    trie_iterator_t iter;
+    trie_t small, loaded;
+    trie_ckpt_t ckpt;
+    pthread_t writer;
+    int i, n, res;
+
+    trie_init(&small);
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter))
+        trie_add(&small, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+    trie_iterator_clear(&iter);
+    trie_ckpt_remove("trie_ckpt_test"); // Starts from no chain
+    n = trie_ckpt_open(&ckpt, &small, "trie_ckpt_test", 4);
+    assert(n == SUCCESS);
+    n = trie_ckpt_write(&ckpt); // Full
+    assert(n == SUCCESS);
+    res = trie_count(&small) + !trie_find(&small, key_ckpt, 4); // Keys after adding it
+    trie_add(&small, key_ckpt, 4);
+    n = trie_ckpt_write(&ckpt); // Only the path of the new key
+    assert(n == SUCCESS);
+    trie_ckpt_close(&ckpt);
+    trie_clear(&small);
+    trie_init(&small);
+    n = trie_ckpt_open(&ckpt, &small, "trie_ckpt_test", 4);
+    assert(n == SUCCESS);
+    assert(trie_count(&small) == res && trie_find(&small, key_ckpt, 4));
+    trie_ckpt_close(&ckpt);
+    trie_ckpt_remove("trie_ckpt_test");
+    trie_clear(&small);
+
+    trie_init(&small);
+    trie_ckpt_remove("trie_ckpt_test.writers");
+    res = trie_ckpt_open(&ckpt, &small, "trie_ckpt_test.writers", 4);
+    assert(res == SUCCESS);
+    res = pthread_create(&writer, NULL, ckpt_writer, &small);
+    assert(res == 0);
+#ifdef NO_PTHREAD // Library is not thread safe, the writer runs first
+    pthread_join(writer, NULL);
+#endif
+    for (n = 0; (n < 64) && (trie_count(&small) < CKPT_KEYS); n++) {
+        res = trie_ckpt_write(&ckpt);
+        assert(res == SUCCESS);
+    }
+#ifndef NO_PTHREAD
+    pthread_join(writer, NULL);
+#endif
+    res = trie_ckpt_write(&ckpt);
+    assert(res == SUCCESS);
+    trie_ckpt_close(&ckpt);
+
+    trie_init(&loaded);
+    res = trie_ckpt_open(&ckpt, &loaded, "trie_ckpt_test.writers", 4);
+    assert(res == SUCCESS);
+    assert(trie_count(&loaded) == CKPT_KEYS);
+    for (i = 0; i < CKPT_KEYS; i++) {
+        ckpt_key(key, i);
+        res = trie_find(&loaded, key, 3);
+        assert(res);
+    }
+    trie_ckpt_close(&ckpt);
+    trie_ckpt_remove("trie_ckpt_test.writers");
+    trie_clear(&loaded);
+    trie_clear(&small);
+}
+
+// Copy with a memory limit: keys are added until it is reached, then refused. Merging stops at
+// the limit too, indexes of cleared tries are used again
+void check_allocator(trie_ptr_t t) {
+    trie_allocator_t allocator;
+    trie_iterator_t iter;
+    trie_t small;
+    FILE * fp;
+    int i, res;
+
+    trie_allocator_init(&allocator);
+    allocator.limit = 64*1024;
+    res = trie_init_with_allocator(&small, &allocator);
+    assert(res == SUCCESS);
+    res = 0;
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter))
+        res += (trie_add(&small, trie_iterator_data(&iter), trie_iterator_data_len(&iter)) == SUCCESS);
+    trie_iterator_clear(&iter);
+    assert(trie_count(&small) == res && trie_mem_used(&small) <= allocator.limit);
+    trie_clear(&small);
+    assert(allocator.live == 0 && trie_mem_used(&small) == -1); // Back to malloc
+
+    fp = tmpfile();
+    assert(fp);
+    res = trie_fwrite(fp, t);
+    assert(res == SUCCESS);
+    for (i = 0; i < 300; i++) { // More than the indexes
+        rewind(fp);
+        trie_allocator_init(&allocator);
+        allocator.limit = 8*1024;
+        res = trie_init_with_allocator(&small, &allocator);
+        assert(res == SUCCESS);
+        res = trie_fread_merge(fp, &small);
+        assert(res == FAIL && trie_mem_used(&small) <= allocator.limit);
+        trie_clear(&small);
+    }
+    fclose(fp);
+}
+
+#define HOT_THREADS 8
+#define HOT_KEYS 16000 // For each thread, less than 26^3
+
+struct hot_writer {
+    trie_ptr_t t;
+    trie_combiner_t * combiner; // NULL adds directly
+    int id;
+};
+
+static void hot_key(DATA_t * key, int id, int i) { // Every key below the same hot node
+    key[0] = 'h';
+    key[1] = 'o';
+    key[2] = 't';
+    key[3] = 'a' + i%26;
+    key[4] = 'a' + (i/26)%26;
+    key[5] = 'a' + (i/676)%26;
+    key[6] = 'a' + id;
+}
+
+static void * hot_writer(void * ptr) {
+    struct hot_writer * w = ptr;
+    DATA_t key[7];
+    int i, res;
+
+    for (i = 0; i < HOT_KEYS; i++) {
+        hot_key(key, w->id, i);
+        if (w->combiner != NULL)
+            res = trie_combiner_add(w->combiner, key, 7);
+        else
+            res = trie_add(w->t, key, 7);
+        assert(res == SUCCESS);
+    }
+    return NULL;
+}
+
+// Adds of many threads under one hot node, directly and through the combiner, timed
+static double hot_writers(trie_ptr_t t, trie_combiner_t * combiner) {
+    struct hot_writer w[HOT_THREADS];
+    pthread_t tids[HOT_THREADS];
+    struct timespec begin, end;
+    int i, res;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (i = 0; i < HOT_THREADS; i++) {
+        w[i].t = t;
+        w[i].combiner = combiner;
+        w[i].id = i;
+        res = pthread_create(tids + i, NULL, hot_writer, w + i);
+        assert(res == 0);
+#ifdef NO_PTHREAD
+        pthread_join(tids[i], NULL);
+#endif
+    }
+#ifndef NO_PTHREAD
+    for (i = 0; i < HOT_THREADS; i++)
+        pthread_join(tids[i], NULL);
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec)*1e-9;
+}
+
+// Copy of t through the combiner, then removed again. Then many threads on a hot node, directly
+// and through the combiner: same keys, and the times
+void check_combiner(trie_ptr_t t) {
+    DATA_t key[7];
+    trie_iterator_t iter;
+    trie_t small, direct, combined;
+    trie_combiner_t combiner;
+    double direct_time, combined_time;
+    int i, j, res;
+
+    trie_init(&small);
+    trie_combiner_init(&combiner, &small);
+    trie_iterator_init(&iter);
+    while (trie_iterator_next(t, &iter)) {
+        res = trie_combiner_add(&combiner, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+        assert(res == SUCCESS);
+    }
+    assert(trie_count(&small) == trie_count(t));
+    while (trie_iterator_next(t, &iter))
+        trie_combiner_remove(&combiner, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+    assert(trie_count(&small) == 0);
+    trie_iterator_clear(&iter);
+    trie_combiner_clear(&combiner);
+    trie_clear(&small);
+
+    trie_init(&direct);
+    direct_time = hot_writers(&direct, NULL);
+    trie_init(&combined);
+    trie_combiner_init(&combiner, &combined);
+    combined_time = hot_writers(&combined, &combiner);
+
+    assert(trie_count(&direct) == HOT_THREADS*HOT_KEYS && trie_count(&combined) == HOT_THREADS*HOT_KEYS);
+    for (i = 0; i < HOT_THREADS; i++)
+        for (j = 0; j < HOT_KEYS; j += 97) {
+            hot_key(key, i, j);
+            res = trie_find(&combined, key, 7);
+            assert(res);
+            assert(trie_rank(&combined, key, 7) == trie_rank(&direct, key, 7));
+        }
+    printf("   === %d threads on a hot node: %.3fs direct, %.3fs combined (%lld batches, %.1f adds each) ===\n",
+           HOT_THREADS, direct_time, combined_time, combiner.batches,
+           combiner.batches?(double)combiner.combined/combiner.batches:0.0);
+    trie_combiner_clear(&combiner);
+    trie_clear(&combined);
+    trie_clear(&direct);
+}
+
+// Copy of t through small memtables merged in the base, half of it already there
+void check_lsm(trie_ptr_t t) {
+    trie_lsm_t lsm;
+    trie_lsm_config_t lsm_config;
+    trie_iterator_t iter;
+    trie_t small;
+    int k, res;
+
+    trie_init(&small);
+    trie_iterator_init(&iter);
+    k = 0;
+    while (trie_iterator_next(t, &iter))
+        if (k++%2 == 0)
+            trie_add(&small, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+    trie_lsm_config_init(&lsm_config);
+    lsm_config.memtable_keys = 1000;
+    res = trie_lsm_open(&lsm, &small, &lsm_config);
+    assert(res == SUCCESS);
+    while (trie_iterator_next(t, &iter)) {
+        res = trie_lsm_add(&lsm, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+        assert(res == SUCCESS);
+        assert(trie_lsm_find(&lsm, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
+    }
+    trie_iterator_clear(&iter);
+    assert(trie_lsm_foreach(&lsm, count_keys, NULL) == trie_count(t)); // Each key once
+    res = trie_lsm_close(&lsm);
+    assert(res == SUCCESS);
+    assert(trie_count(&small) == trie_count(t) && trie_foreach(&small, count_keys, NULL) == trie_count(t));
+    trie_clear(&small);
+}
+
+// Symbols sort as unsigned numbers, and survive fwrite/fread (varint coded when wider than a byte)
+void check_wide_symbols(void) {
+    DATA_t symbols[8], key[2];
+    int n, i, j, res;
+    trie_t t;
+    trie_iterator_t iter;
+    FILE * fp;
+
+    n = 0;
+    symbols[n++] = 1;
+    symbols[n++] = 0x7F; // Largest varint of one byte
+    symbols[n++] = 0x80; // Top bit of a byte
+    if (sizeof(DATA_t) > 1) {
+        symbols[n++] = (DATA_t)0x100;
+        symbols[n++] = (DATA_t)0x3FFF; // Largest varint of two bytes
+        symbols[n++] = (DATA_t)0x4000;
+        symbols[n++] = (DATA_t)((uintmax_t)1 << (8*sizeof(DATA_t) - 1)); // Top bit
+    }
+    symbols[n++] = (DATA_t)~(DATA_t)0; // Largest symbol
+
+    trie_init(&t);
+    for (i = n - 1; i >= 0; i--) { // Keys s_i and s_i s_j, added backwards
+        key[0] = symbols[i];
+        trie_add(&t, key, 1);
+        for (j = n - 1; j >= 0; j--) {
+            key[1] = symbols[j];
+            trie_add(&t, key, 2);
+        }
+    }
+
+    fp = tmpfile();
+    assert(fp);
+    res = trie_fwrite(fp, &t);
+    assert(res == SUCCESS);
+    trie_clear(&t);
+    rewind(fp);
+    trie_init(&t);
+    res = trie_fread(fp, &t);
+    assert(res == SUCCESS);
+    fclose(fp);
+
+    trie_iterator_init(&iter);
+    for (i = 0; i < n; i++) { // Comes back in numeric order
+        res = trie_iterator_next(&t, &iter);
+        assert(res && trie_iterator_data_len(&iter) == 1 && trie_iterator_data(&iter)[0] == symbols[i]);
+        for (j = 0; j < n; j++) {
+            res = trie_iterator_next(&t, &iter);
+            assert(res && trie_iterator_data_len(&iter) == 2);
+            assert(trie_iterator_data(&iter)[0] == symbols[i] && trie_iterator_data(&iter)[1] == symbols[j]);
+        }
+    }
+    res = trie_iterator_next(&t, &iter);
+    assert(!res && trie_count(&t) == n*(n + 1));
+    trie_iterator_clear(&iter);
+    trie_clear(&t);
+    printf("   === %d symbols up to %ju ordered and read back ===\n", n, (uintmax_t)symbols[n - 1]);
+}
+
 int main(int argc, char * argv[]) {
     int i, res;
     trie_t my_trie;
@@ -406,9 +1218,14 @@ int main(int argc, char * argv[]) {
     for (i = 0; i < THREAD_NUM; i++) {
         res = pthread_create(tid + i, NULL, add_data, &my_trie);
         assert(res == 0); // Returns 0 on success
+#ifdef NO_PTHREAD // Library is not thread safe, runs one thread at a time
+        pthread_join(tid[i], NULL);
+#endif
     }
+#ifndef NO_PTHREAD
     for (i = 0; i < THREAD_NUM; i++)
         pthread_join(tid[i], NULL);
+#endif
     // Join all threads
     printf("   === All data added ===\n");
     fflush(stdout);
@@ -426,13 +1243,41 @@ int main(int argc, char * argv[]) {
     fclose(out);
     assert(res == SUCCESS);
 
+    check_wide_symbols();
+    check_ranks(&my_trie);
+    check_longest_prefix(&my_trie);
+    check_scan(&my_trie);
+    check_foreach(&my_trie);
+    check_parallel(&my_trie);
+    check_fuzzy(&my_trie);
+    check_pattern(&my_trie);
+    check_aho(&my_trie);
+    check_louds(&my_trie);
+    check_double_array(&my_trie);
+    check_replicas(&my_trie);
+    check_huge_pages();
+    check_finger_search(&my_trie);
+    check_remove_prefix();
+    check_wal(&my_trie);
+    check_ckpt(&my_trie);
+    check_allocator(&my_trie);
+    check_combiner(&my_trie);
+    check_lsm(&my_trie);
+    check_cursor(&my_trie);
+    check_seek(&my_trie);
+
     // Now re-creates thread to check data added
     for (i = 0; i < THREAD_NUM; i++) {
         res = pthread_create(tid + i, NULL, check_added_data, &my_trie);
         assert(res == 0); // Returns 0 on success
+#ifdef NO_PTHREAD
+        pthread_join(tid[i], NULL);
+#endif
     }
+#ifndef NO_PTHREAD
     for (i = 0; i < THREAD_NUM; i++)
         pthread_join(tid[i], NULL);
+#endif
 
     asm volatile ("":::"memory"); // Memory barrier
     for (i = 0; i < THREAD_NUM; i++)
@@ -0,0 +1,173 @@
+// Test of the C++ binding, compile with:
+//    g++ -std=c++17 -O2 testmain.cpp -o testmain_cpp -lpthread
+
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <cstdint>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "trie.hpp"
+
+#define KEY_NUM 20000
+#define THREAD_NUM 4
+
+static std::string random_key(unsigned * seed) {
+    std::string key(rand_r(seed)%8, 'a');
+    for (auto & c : key)
+        c = 'a' + rand_r(seed)%6; // Small alphabet, many shared prefixes
+    return key;
+}
+
+// Same operations on a trie and a std::set, then compares them
+template <class Lock>
+static void check_against_set(void) {
+    trielib::trie<char, std::allocator<char>, Lock> dict;
+    std::set<std::string> model;
+    unsigned seed = 1;
+    bool res;
+
+    for (int i = 0; i < KEY_NUM; i++) {
+        std::string key = random_key(&seed);
+        if (i%3 == 2) {
+            res = dict.erase(std::string_view(key));
+            assert(res == (model.erase(key) == 1));
+        } else if (i%3 == 1) { // Storage of the vector may become the new node
+            res = dict.insert(std::vector<char>(key.begin(), key.end()));
+            assert(res == model.insert(key).second);
+        } else {
+            res = dict.insert(std::string_view(key));
+            assert(res == model.insert(key).second);
+        }
+    }
+    assert(dict.size() == model.size());
+
+    // Iteration is sorted
+    auto it = model.begin();
+    for (const auto & key : dict) {
+        assert(it != model.end() && std::string(key.begin(), key.end()) == *it);
+        ++it;
+    }
+    assert(it == model.end());
+
+    for (int i = 0; i < KEY_NUM; i++) {
+        std::string key = random_key(&seed);
+        res = dict.contains(std::string_view(key));
+        assert(res == (model.count(key) == 1));
+    }
+
+    // Prefix range, also when the prefix ends inside a node
+    for (const char * prefix : {"", "a", "ab", "abc", "fff", "zz"}) {
+        std::string_view p(prefix);
+        std::size_t n = 0;
+        for (const auto & key : dict.prefix_range(p)) {
+            assert(std::string_view(key.data(), key.size()).substr(0, p.size()) == p);
+            assert(model.count(std::string(key.begin(), key.end())) == 1);
+            n++;
+        }
+        std::size_t expected = 0;
+        for (auto m = model.lower_bound(std::string(p)); m != model.end() && m->compare(0, p.size(), p) == 0; ++m)
+            expected++;
+        assert(n == expected);
+    }
+
+    // Copies are deep, moved from tries are empty
+    auto copy = dict;
+    dict.clear();
+    assert(dict.empty() && copy.size() == model.size());
+    auto moved = std::move(copy);
+    assert(moved.size() == model.size());
+    for (const auto & key : model) {
+        res = moved.contains(std::string_view(key));
+        assert(res);
+    }
+    assert(copy.empty() && copy.begin() == copy.end());
+    res = copy.contains(std::string_view(model.begin()->data(), 0));
+    assert(!res);
+    res = copy.erase(std::string_view(*model.begin()));
+    assert(!res);
+    res = copy.insert(std::string_view(*model.begin())); // Moved from trie is still usable
+    assert(res && copy.size() == 1 && *copy.begin() == std::vector<char>(model.begin()->begin(), model.begin()->end()));
+    copy.clear();
+    assert(copy.empty());
+    (void)res; // Only asserts read it
+}
+
+// Threads add and remove their own keys while the others look for theirs
+static void check_shared_lock(void) {
+    trielib::trie<char, std::allocator<char>, trielib::shared_lock> dict;
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < THREAD_NUM; t++)
+        threads.emplace_back([&dict, t] {
+            bool res;
+            for (int i = 0; i < KEY_NUM/THREAD_NUM; i++) {
+                std::string key = std::to_string(t) + "-" + std::to_string(i);
+                res = dict.insert(std::string_view(key));
+                assert(res);
+                res = dict.contains(std::string_view(key));
+                assert(res);
+                if (i%2 == 1) {
+                    res = dict.erase(std::string_view(key));
+                    assert(res);
+                }
+            }
+            (void)res;
+        });
+    for (int i = 0; i < 8; i++) { // Copies hold the shared lock, so are consistent
+        auto copy = dict;
+        std::size_t n = 0;
+        for (const auto & key : copy) {
+            (void)key;
+            n++;
+        }
+        assert(n == copy.size());
+    }
+    for (auto & t : threads)
+        t.join();
+    assert(dict.size() == THREAD_NUM*(KEY_NUM/THREAD_NUM/2));
+
+    auto guard = dict.read_lock(); // Iterators do not lock
+    std::size_t n = 0;
+    for (const auto & key : dict) {
+        (void)key;
+        n++;
+    }
+    assert(n == dict.size());
+}
+
+// Elements are compared as numbers, not bytes
+static void check_wide_symbols(void) {
+    trielib::trie<uint32_t> dict;
+    std::vector<uint32_t> a = {70000, 2}, b = {256, 1}, c = {256};
+    bool res;
+
+    dict.insert(trielib::key_view<uint32_t>(a));
+    dict.insert(trielib::key_view<uint32_t>(b));
+    dict.insert(trielib::key_view<uint32_t>(c));
+    res = dict.contains(trielib::key_view<uint32_t>(c));
+    assert(res);
+    auto it = dict.begin();
+    assert(*it == c);
+    ++it;
+    assert(*it == b);
+    ++it;
+    assert(*it == a);
+    ++it;
+    assert(it == dict.end());
+    (void)res;
+}
+
+int main() {
+    printf(" === C++ binding ===\n");
+    check_against_set<trielib::no_lock>();
+    check_against_set<trielib::shared_lock>();
+    check_shared_lock();
+    check_wide_symbols();
+    printf(" === All tests passed ===\n");
+    return 0;
+}
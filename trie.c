@@ -23,6 +23,8 @@
 
 // All the utils functions are defined here
 #include "trie_mutex.c" // It is not a good practice to include *.c files
+#include "trie_alloc.c" // Node memory
+#include "trie_refs.c" // Child and data references
 #include "trie_childs.c" // Each files includes all the necessary
 #include "trie_utils.c" // Include this at last
 
@@ -42,10 +44,14 @@ void trie_init(trie_ptr_t t) {
     t->childs.childs = NULL; // This is gonna be changed when adding some data
     t->childs.firsts = NULL;
 
-    t->data.data = NULL; // This does not makes sense for a non-empty node
+    trie_set_data(t, NULL); // This does not makes sense for a non-empty node
     t->data.len = 0; // This marks an empty trie
     t->data.end = 0;
     t->data.dealloc = 0;
+    t->data.allocator = 0; // malloc
+    t->count = 0; // No keys
+    t->gen = 0;
+    trie_touch(t);
 }
 
 //  ====================
@@ -59,21 +65,35 @@ void trie_clear_noroot(trie_ptr_t t) {
     trie_writelock(&(t->lock));
     // Now have to destroy each child
     for (i = 0; i < trie_get_child_num(t); i++)
-        trie_clear(trie_get_child(t, i));
+        trie_clear_noroot(trie_get_child(t, i));
     trie_destroy_node_without_child(t);
 }
 
-// Root node
-void trie_clear(trie_ptr_t t) {
-    int i;
-    if (t == NULL)
-        return; // Invalid ptr
+// Root node, keeps its allocator to be filled again
+static
+void trie_clear_keys(trie_ptr_t t) {
+    int i, allocator;
+    trie_allocator_t * prev;
+    prev = trie_mem_enter(t);
+    allocator = t->data.allocator;
     trie_writelock(&(t->lock));
     // Now have to destroy each child
     for (i = 0; i < trie_get_child_num(t); i++)
         trie_clear_noroot(trie_get_child(t, i));
     trie_destroy_node_without_child(t);
     trie_init(t); // Reinits data
+    t->data.allocator = allocator; // Keeps its allocator
+    trie_mem_leave(prev);
+}
+
+void trie_clear(trie_ptr_t t) {
+    int allocator;
+    if (t == NULL)
+        return; // Invalid ptr
+    allocator = t->data.allocator;
+    trie_clear_keys(t);
+    t->data.allocator = 0; // As after trie_init
+    trie_mem_unref(allocator);
 }
 
 #ifndef NDEBUG // Debugging
@@ -93,7 +113,7 @@ void __print_trie_helper(struct _trie * parent, int n_child, const int depth) {
         printf(" +-");
     printf("%c", trie_get_first(parent, n_child));
     for (i = 0; i < t->data.len; i++)
-        printf("%c", t->data.data[i]);
+        printf("%c", trie_data(t)[i]);
     if (trie_data_end(t))
         printf("*");
     printf("\n");
@@ -117,7 +137,7 @@ void print_trie(trie_ptr_t t) {
     trie_readlock(&(t->lock));
 
     for (j = 0; j < t->data.len; j++)
-        printf("%c", t->data.data[j]);
+        printf("%c", trie_data(t)[j]);
     if (trie_data_end(t))
         printf("*");
     printf("\n");
@@ -136,6 +156,97 @@ void print_trie(trie_ptr_t t) {
 // input/output utilities
 #include "trie_io.c"
 
+// =====================
+// ==== TRIE COUNTS ====
+// =====================
+
+/*
+   Writers keep their path readlocked and writelock only the node they change. Once the outcome is
+   known the count delta goes to each node of the path, which is also touched, before any lock is
+   released: counts never hold a key that was not added or removed, and operations that change
+   nothing leave the path as it was. A readlocked parent keeps a child from going away (the root
+   never does), so a readlock becomes a writelock by releasing it, and the node is checked again.
+*/
+
+#define TRIE_PATH_STACK 64 // Nodes of a path kept without malloc
+
+typedef struct {
+    struct _trie ** nodes; // Locked nodes above the current one, from the root
+    int * offsets; // Where the data of each one begins in the key
+    int depth;
+    struct _trie * node_stack[TRIE_PATH_STACK];
+    int offset_stack[TRIE_PATH_STACK];
+} trie_path_t;
+
+static inline // Returns FAIL if a long path cannot be allocated
+int trie_path_init(trie_path_t * path, int len) {
+    path->depth = 0;
+    path->nodes = path->node_stack;
+    path->offsets = path->offset_stack;
+    if (len >= TRIE_PATH_STACK) { // Every node below the root takes at least a symbol
+        path->nodes = malloc((len + 1)*sizeof(*(path->nodes)));
+        path->offsets = malloc((len + 1)*sizeof(*(path->offsets)));
+        if ((path->nodes == NULL) || (path->offsets == NULL)) {
+            free(path->nodes);
+            free(path->offsets);
+            path->nodes = path->node_stack;
+            path->offsets = path->offset_stack;
+            return FAIL;
+        }
+    }
+    return SUCCESS;
+}
+
+// One more key (delta 1) or one less (delta -1) below each node of the path
+static inline
+void trie_path_count(trie_path_t * path, int delta) {
+    int i;
+
+    for (i = 0; i < path->depth; i++) {
+        trie_count_add(path->nodes[i], delta);
+        trie_touch(path->nodes[i]); // Its subtree changed
+    }
+}
+
+// Unlocks the nodes of the path below depth, from the bottom, the current node must be already unlocked
+static inline
+void trie_path_release(trie_path_t * path, int depth) {
+    for (path->depth--; path->depth >= depth; path->depth--)
+        trie_unlock(&(path->nodes[path->depth]->lock));
+    path->depth = depth;
+}
+
+// Unlocks the whole path, see above
+static inline
+void trie_path_unlock(trie_path_t * path) {
+    trie_path_release(path, 0);
+    if (path->nodes != path->node_stack) {
+        free(path->nodes);
+        free(path->offsets);
+    }
+}
+
+// Readlocked cur becomes writelocked, see above. Returns 1 if it must be checked again
+static inline
+int trie_relock_write(struct _trie * cur, int * locked) {
+    (void)cur; // Suppresses warning unused, without pthread
+    if (*locked)
+        return 0; // Already writelocked
+    trie_unlock(&(cur->lock));
+    trie_writelock(&(cur->lock));
+    *locked = 1;
+    return 1;
+}
+
+// Writelocked cur goes back to a readlock, to keep it in the path. cur must be checked again
+static inline
+void trie_relock_read(struct _trie * cur, int * locked) {
+    (void)cur; // Suppresses warning unused, without pthread
+    trie_unlock(&(cur->lock));
+    trie_readlock(&(cur->lock));
+    *locked = 0;
+}
+
 // =====================
 // ====== TRIE ADD =====
 // =====================
@@ -143,19 +254,36 @@ void print_trie(trie_ptr_t t) {
 static inline
 void trie_fill_root_node(trie_ptr_t t, const DATA_t * arr, int len) {
     trie_attach_new_data(t, arr, len); // Copy data
+    t->count = 1; // The only key
+    trie_touch(t);
     trie_init_childs(&(t->childs)); // Inits root node (it should be already initialized)
     trie_alloc_childs(&(t->childs)); // Allocs two children
     trie_unlock(&(t->lock)); // Not needed anymore
 }
 
+// Reserves the node memory an insertion at cur may allocate: two nodes, the key and the child
+// arrays grown once. Returns FAIL if the memory limit would be reached (see trie_mem_reserve)
+static inline
+int trie_add_reserve(struct _trie * cur, int len, long long * reserved) {
+    *reserved = 2*sizeof(struct _trie) + len*sizeof(DATA_t) + 6*TRIE_MEM_HEADER +
+                (2*(long long)cur->childs.child_alloc + 2)*(sizeof(trie_node_ref_t) + sizeof(DATA_t));
+    if (trie_mem_reserve(*reserved) == SUCCESS)
+        return SUCCESS;
+    *reserved = 0;
+    return FAIL;
+}
+
+// Adds arr below cur, where the nodes of path leave it: cur is locked, writelocked if locked is set.
+// The nodes already in path are counted too, but stay locked. Unlocks cur and the ones it adds
 static inline
-void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
+int trie_add_helper(trie_ptr_t t, trie_path_t * path, struct _trie * cur, const DATA_t * arr, int len, int locked){
     int mismatch; // data counter
     int special, a_id, b_id; // identifiers
     struct _childs temp_childs; // Temporany data holder
-    struct _trie * cur, * next; // current root pointer (not reallocable)
+    struct _trie * next;
+    int added = 0, res = SUCCESS, depth = path->depth;
+    long long reserved = 0; // Node memory taken from the limit
 
-    cur = t;
     while (1) {
         assert(trie_correct_child_num(cur)); // Effectively used chidls less than allocated
         // Looks for the first mismatching character. It is right to search again if lock was not acquired
@@ -163,22 +291,30 @@ void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
 
         // Now parse
         if ((mismatch == trie_data_len(cur)) && (mismatch == len)) { // Reached end of data, and end of node
-            if (trie_data_end(cur)) break; // Element already exists
-            if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, do what to do
+            if (trie_data_end(cur)) // Element already exists, nothing changes
+                break;
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
                 continue;
             trie_set_data_end(cur); // simply sets the end flag, finish
+            trie_count_add(cur, 1);
+            added = 1;
             break;
         } else if ( (mismatch == trie_data_len(cur)) && trie_empty_childs(cur) ) { // Reached end of stored data
-            if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, do what to do
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
                 continue;
+            if ((res = trie_add_reserve(cur, len, &reserved)) != SUCCESS)
+                break; // Memory limit reached, nothing is changed
             assert(len > mismatch); // there is always a next character
             assert(trie_data_end(cur)); // Beacuse of empty childs
 
-            if (!trie_is_root(t, cur)) // Not the root node, root node does not need alloc
+            if (trie_get_childs(cur) == NULL) // Root node, and nodes whose childs were removed, already have them
                 trie_alloc_childs(&(cur->childs)); // normal alloc
             trie_insert_init_child(cur, 0); // inserts and inits a child
             trie_attach_new_data(trie_get_child(cur, 0), arr + mismatch + 1, len - (mismatch + 1));
             trie_attach_first_data(cur, 0, arr[mismatch]);
+            trie_get_child(cur, 0)->count = 1;
+            trie_count_add(cur, 1);
+            added = 1;
             assert(trie_correct_child_num(trie_get_child(cur, 0)));
             break; // End
         } else if (mismatch == trie_data_len(cur)) { // Reached end of stored data, has childs
@@ -186,25 +322,36 @@ void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
             assert(mismatch < len); //  there is always a next character, so can access arr[mismatch]
             a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
             if (a_id) { // Element was found, calls to add now became recursive ...
+                if (locked) { // Child added meanwhile, cur stays in the path readlocked
+                    trie_relock_read(cur, &locked);
+                    continue;
+                }
                 next = trie_get_child(cur, b_id); // New data should be added here
-                trie_readlock_upgrd(&(next->lock)); // Readlocks next.
-                trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+                trie_readlock(&(next->lock)); // Readlocks next.
+                path->nodes[path->depth++] = cur; // Keeps current locked. N.B. Keep order
                 arr += (mismatch + 1); // Moves forward the array data
                 len -= (mismatch + 1);
                 cur = next;
                 continue; // Continues while loop
             } else { // Element was not found, inserts a new one, b_id contains new position
-                if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, do what to do
+                if (trie_relock_write(cur, &locked)) // Lock gained, checks again
                     continue;
+                if ((res = trie_add_reserve(cur, len, &reserved)) != SUCCESS)
+                    break;
                 trie_insert_init_child(cur, b_id);  // adds a child, remember b_id is its position
                 trie_attach_new_data(trie_get_child(cur, b_id), arr + mismatch + 1, len - (mismatch + 1));
                 trie_attach_first_data(cur, b_id, arr[mismatch]);
+                trie_get_child(cur, b_id)->count = 1;
+                trie_count_add(cur, 1);
+                added = 1;
                 assert(trie_correct_child_num(trie_get_child(cur, b_id)));
                 break;
             }
         } else if (mismatch == len) {
-            if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, do what to do
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
                 continue;
+            if ((res = trie_add_reserve(cur, len, &reserved)) != SUCCESS)
+                break;
             assert(mismatch < trie_data_len(cur));
 
             special = trie_is_root(t, cur) && trie_empty_childs(cur);
@@ -232,12 +379,17 @@ void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
                 memcpy(&(trie_get_child(cur, 0)->childs), &temp_childs, sizeof(temp_childs));
             else
                 trie_init_childs(&(trie_get_child(cur, 0)->childs)); // Inits to null
+            trie_get_child(cur, 0)->count = cur->count; // Innherits every key
+            trie_count_add(cur, 1); // Plus the new one
+            added = 1;
 
             assert(trie_correct_child_num(trie_get_child(cur, 0)));
             break;
         } else { // Normal case
-            if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, do what to do
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
                 continue;
+            if ((res = trie_add_reserve(cur, len, &reserved)) != SUCCESS)
+                break;
             assert(mismatch < trie_data_len(cur));
             assert(mismatch < len);
 
@@ -274,14 +426,18 @@ void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
             else
                 trie_init_childs(&(trie_get_child(cur, a_id)->childs)); // Inits to null
             trie_data_end(trie_get_child(cur, a_id)) = trie_data_end(cur);
+            trie_get_child(cur, a_id)->count = cur->count; // Innherits every key
             trie_data_len(cur) = mismatch; // shrinks current data lenght
 
            // Now new data
            trie_attach_new_data(trie_get_child(cur, b_id), arr + mismatch + 1, len - (mismatch + 1));
            trie_attach_first_data(cur, b_id, arr[mismatch]);
            trie_init_childs(&(trie_get_child(cur, b_id)->childs)); // Inits to null
+           trie_get_child(cur, b_id)->count = 1;
 
            trie_clear_data_end(cur); // Now current node surely does not contain a data end
+           trie_count_add(cur, 1);
+           added = 1;
 
            assert(trie_correct_child_num(trie_get_child(cur, a_id)));
            assert(trie_correct_child_num(trie_get_child(cur, b_id)));
@@ -292,31 +448,54 @@ void trie_add_helper(trie_ptr_t t, const DATA_t * arr, int len){
     } // end while
 
     assert(trie_correct_child_num(cur)); // Effectively used chidls less than allocated
+    if (added) { // Counts the key above, while the path is locked
+        trie_touch(cur);
+        trie_path_count(path, 1);
+    }
     trie_unlock(&(cur->lock));
+    trie_path_release(path, depth);
+    trie_mem_unreserve(reserved); // Allocated by now
+    return res;
 }
 
-void trie_add(trie_ptr_t t, const DATA_t * arr, int len) {
-    int upgrade_res;
+int trie_add(trie_ptr_t t, const DATA_t * arr, int len) {
+    int locked, pool, res;
+    trie_allocator_t * allocator;
+    long long reserved;
+    trie_path_t path; // Readlocked nodes above the one changed, counted once the key is added
 
     if ((t == NULL) || (arr == NULL))
-        return; // Invalid ptr
+        return FAIL; // Invalid ptr
 
-    trie_readlock_upgrd(&(t->lock)); // locks root trie read mutex, upgadable
+    allocator = trie_mem_enter(t);
+    pool = trie_mem_prefer(trie_mem_subtree(arr, len)); // New nodes go where the subtree is
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    locked = 0;
     while (1) {
         if (trie_is_empty(t)) {
-            upgrade_res = trie_upgrade_lock(&(t->lock)); // tries lock upgrading
-            if (upgrade_res == 0) { // lock gained, none has written
+            if (trie_relock_write(t, &locked)) // Lock gained, checks again
+                continue;
+            res = trie_add_reserve(t, len, &reserved);
+            if (res == SUCCESS)
                 trie_fill_root_node(t, arr, len); // Fills root and releases mutex
-                break; // Finish
-            } else { // Lock not gained, someone got it
-                continue; // So go back and checks again the condition
-            }
+            else
+                trie_unlock(&(t->lock)); // Memory limit reached
+            trie_mem_unreserve(reserved);
+            break; // Finish
+        } else if (trie_path_init(&path, len) != SUCCESS) {
+            trie_unlock(&(t->lock));
+            res = FAIL; // Nothing is added
+            break;
         } else { // Trie not empty (general case)
-            trie_add_helper(t, arr, len);
+            res = trie_add_helper(t, &path, t, arr, len, locked);
+            trie_path_unlock(&path);
             break; // Finish
         }
     }
+    trie_mem_prefer(pool);
+    trie_mem_leave(allocator);
     // print_trie(t); // debug purpose
+    return res;
 }
 
 // =====================
@@ -327,27 +506,36 @@ void trie_remove(trie_ptr_t t, const DATA_t * arr, int len) {
     int mismatch; // data counter
     int found, pos; // Data search index
     struct _trie * cur, * next; // current root pointer (not reallocable)
-    struct _trie * prev; // Previous used node
-    
-    int newlen; // Temporany new data lenght
-    DATA_t * newdata; // Temporany data holder
+    struct _trie * prev; // Parent of cur, the last node of the path
+    const DATA_t * start_arr = arr; // Restarts from a node of the path
+    int start_len = len, locked, write_from;
+    trie_path_t path; // Locked nodes above cur, counted once the key is removed
+    trie_allocator_t * allocator;
 
     // Basic checking
     if (t == NULL || arr == NULL)
         return; // No data to delete!
 
-    trie_readlock_upgrd(&(t->lock)); // locks root trie read mutex, upgadable
+    trie_readlock(&(t->lock)); // locks root trie read mutex
     if (trie_is_empty(t)) { // No data to delete
         trie_unlock(&(t->lock));
         return;
     }
+    allocator = trie_mem_enter(t);
+    if (trie_path_init(&path, len) != SUCCESS) { // Nothing is removed
+        trie_unlock(&(t->lock));
+        trie_mem_leave(allocator);
+        return;
+    }
 
-    found = 1; // Assumes 'last' element was found
+    // Unlinking a node changes its parent too. Both are writelocked from the parent down, then
+    // the descent goes on with writelocks: nodes of the path from write_from on are writelocked
+    locked = 0;
+    write_from = INT_MAX;
     pos = INT_MAX; // Leads to error if used uninitialized
-    cur = prev = t;
+    cur = t;
     while (1) {
         assert(trie_correct_child_num(cur)); // Effectively used chidls less than allocated
-        assert(found); // Go on only while is found
         // Looks for the first mismatching character
         mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
 
@@ -357,64 +545,50 @@ void trie_remove(trie_ptr_t t, const DATA_t * arr, int len) {
                 assert(!trie_empty_childs(cur)); // Should be at least one child
                 break; // Data does not exist, do not remove nothing
             }
-            
-            if (trie_upgrade_lock(&(cur->lock)) != 0) // Lock gained, now cur is readlocked
-                continue; // Needs to read again the data
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
+                continue;
+            if (trie_empty_childs(cur) && !trie_is_root(t, cur) && (write_from >= path.depth)) {
+                trie_unlock(&(cur->lock)); // Starts again from the parent, writelocked
+                path.depth--;
+                cur = path.nodes[path.depth];
+                trie_unlock(&(cur->lock));
+                trie_writelock(&(cur->lock)); // Its parent (or being the root) keeps it
+                arr = start_arr + path.offsets[path.depth];
+                len = start_len - path.offsets[path.depth];
+                continue;
+            }
 
+            trie_path_count(&path, -1); // Before the path changes
+            trie_touch(cur);
             if (trie_get_child_num(cur) >= 2) { // More than two childs, cannot remove node
                 trie_clear_data_end(cur); // simply clears the end flag, finish
-                trie_unlock(&(cur->lock)); // Unlocks current node
+                trie_count_add(cur, -1);
             } else if (trie_get_child_num(cur) == 1) { // Must merge the only child
-                next = trie_get_child(cur, 0); // Sets next to the only child
-                // need a readlock on the child
-                trie_readlock(&(next->lock)); // Gains readlock
-                newlen = trie_data_len(cur) + trie_data_len(next) + 1; // +1 is for the first character
-                
-                if (!(cur->data.dealloc) && !(next->data.dealloc) &&
-                        trie_data(cur) + trie_data_len(cur) + 1 == trie_data(next) ) {
-                    // Do nothing!, data is already where it should be
-                    assert(trie_data(cur)[trie_data_len(cur)] == trie_get_first(cur, 0));
-                } else { // Data was allocated, copies inside this buffer
-                    if (cur->data.dealloc) { // Reallocs current data
-                        trie_data(cur) = realloc((DATA_t*)trie_data(cur), newlen*sizeof*trie_data(cur));
-                    } else { // Data for current node is not allocated, must malloc all the data
-                        newdata = malloc(newlen*sizeof*trie_data(cur)); // Allocs a new chunk of data
-                        assert(newdata); // This is a bit like attach data, but this adds some extra bytes at the end
-                        cur->data.dealloc = 1; // needs freeing
-                        memcpy(newdata, trie_data(cur), trie_data_len(cur)*sizeof*trie_data(cur)); // Copies old data
-                        trie_data(cur) = newdata; // Links new data
-                    }
-                    memcpy((DATA_t*)trie_data(cur) + trie_data_len(cur), &trie_get_first(cur, 0),
-                            sizeof*trie_data(cur)); // Copies the first byte
-                    memcpy((DATA_t*)trie_data(cur) + trie_data_len(cur) + 1, trie_data(next), // Copies the rest
-                            trie_data_len(next)*sizeof*trie_data(cur));
-                }
-                trie_data_len(next) = newlen;
-                trie_data(next) = trie_data(cur); // attaches current data to child
-                next->data.dealloc = cur->data.dealloc; // innherits dealloc property
-                // now links the child node to the parent
-                trie_get_child(prev, pos) = next;
-
-                // Now destroys current node (and frees the readlock)
-                trie_destroy_node_without_child(cur); // Destroys all allocs for the current node
-                if (!trie_is_root(t, cur)) 
-                    free(cur);
-
-                trie_unlock(&(next->lock)); // Lock no more needed
-            } else { // No childs
+                trie_merge_only_child(cur); // Current node takes data and childs of the child
+            } else if (!trie_is_root(t, cur)) { // No childs
+                prev = path.nodes[path.depth - 1]; // Writelocked
                 // Now destroys the current node. no child is allocated.
-                trie_destroy_node_without_child(cur); // Destroys all allocs for the current node
-                if (!trie_is_root(t, cur)) { // Root node, uses a special algorithm 
-                    // If not the root can unlink from the prior
-                    free(cur); // cur was allocated with malloc
-                    trie_remove_child(&(prev->childs), pos);
-                } else { // cur is the root node, needs to reset back to void root
-                    trie_get_childs(cur) = NULL;
-                    trie_get_child_num(cur) = 0;
-                    cur->childs.child_alloc = 0;
-                }
+                trie_destroy_node_without_child(cur); // Destroys all allocs for the current node, unlocks it
+                // If not the root can unlink from the prior
+                trie_node_free(cur); // cur was allocated with trie_node_alloc
+                trie_remove_child(&(prev->childs), pos);
+                cur = prev; // Current node does not exist anymore, prev is unlocked with the path
+
+                if (!trie_data_end(prev) && (trie_get_child_num(prev) == 1)) // Prior is not needed anymore
+                    trie_merge_only_child(prev);
+            } else { // Root node with no childs, the only key
+                trie_clear_data_end(cur);
             }
 
+            if (!trie_data_end(cur) && trie_empty_childs(cur)) { // cur is the root node, and it is empty
+                assert(trie_is_root(t, cur));
+                trie_destroy_childs(&(cur->childs)); // needs to reset back to void root
+                trie_destroy_data(cur);
+                trie_set_data(cur, NULL);
+                trie_data_len(cur) = 0;
+                cur->data.dealloc = 0;
+                cur->count = 0;
+            }
             break;
         } else if ( (mismatch == trie_data_len(cur)) && trie_empty_childs(cur) ) { // Reached end of stored data
             assert(len > mismatch); // there is always a next character
@@ -426,13 +600,17 @@ void trie_remove(trie_ptr_t t, const DATA_t * arr, int len) {
             found = trie_search_in_childs(&pos, &(cur->childs), arr[mismatch]); // Binary search in child nodes
             if (found) { // Element was found, calls to add now became recursive ...
                 next = trie_get_child(cur, pos); // Moves to the next node
-                if (!trie_is_root(t, cur)) // True every time except the first here
-                    trie_unlock(&(prev->lock)); // Unlocks previous. N.B. Keep order
-                else {} // If trie root node do not unlocks anything!
-                trie_readlock_upgrd(&(next->lock)); // Readlocks next, with an upgradable lock
+                if (locked) { // Writelocked below, since the path was writelocked
+                    trie_writelock(&(next->lock));
+                    if (write_from > path.depth)
+                        write_from = path.depth;
+                } else {
+                    trie_readlock(&(next->lock)); // Readlocks next.
+                }
+                path.offsets[path.depth] = arr - start_arr;
+                path.nodes[path.depth++] = cur; // Keeps current locked. N.B. Keep order
                 arr += (mismatch + 1); // Moves forward the array data
                 len -= (mismatch + 1);
-                prev = cur; // Stores the current node
                 cur = next; // and moves to the nexe
                 continue; // Continues while loop
             } else { // Element was not found, inserts a new one
@@ -450,8 +628,223 @@ void trie_remove(trie_ptr_t t, const DATA_t * arr, int len) {
         __builtin_unreachable();
     } // end while
 
-    assert(trie_correct_child_num(prev)); // Effectively used chidls less than allocated
-    trie_unlock(&(prev->lock));
+    assert(trie_correct_child_num(cur)); // Effectively used chidls less than allocated
+    if ((path.depth == 0) || (cur != path.nodes[path.depth - 1])) // Unless it was unlinked
+        trie_unlock(&(cur->lock));
+    trie_path_unlock(&path);
+    trie_mem_leave(allocator);
+}
+
+// ============================
+// ==== TRIE REMOVE PREFIX ====
+// ============================
+
+// Detached subtrees are freed by a background thread (the reaper), so removing a large
+// subtree costs the caller only the descent. Readers still inside a detached subtree are
+// safe: the reaper writelocks each node before freeing it, from the top, as writers do
+struct _trie_reaper {
+    struct _trie ** nodes; // Subtrees waiting to be freed
+    int num, alloc;
+    int busy; // A subtree is being freed
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signaled when a subtree is queued
+    pthread_cond_t done; // Signaled when the queue gets empty
+    int started;
+#endif
+};
+
+#ifndef NO_PTHREAD
+static struct _trie_reaper trie_reaper = {NULL, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER,
+                                          PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+#endif
+
+static
+void trie_reap(struct _trie * node) {
+    trie_allocator_t * prev = trie_mem_enter(node); // Allocator of its trie, see trie_remove_prefix
+    int allocator = node->data.allocator;
+    trie_clear_noroot(node); // Childs first, then node data and arrays
+    trie_node_free(node);
+    trie_mem_leave(prev);
+    trie_mem_unref(allocator); // Taken by trie_reaper_add
+}
+
+#ifndef NO_PTHREAD
+static
+void * trie_reaper_thread(void * arg) {
+    struct _trie * node;
+    (void)arg;
+
+    pthread_mutex_lock(&(trie_reaper.lock));
+    while (1) {
+        while (trie_reaper.num == 0)
+            pthread_cond_wait(&(trie_reaper.work), &(trie_reaper.lock));
+        node = trie_reaper.nodes[--(trie_reaper.num)];
+        trie_reaper.busy = 1;
+        pthread_mutex_unlock(&(trie_reaper.lock));
+
+        trie_reap(node);
+
+        pthread_mutex_lock(&(trie_reaper.lock));
+        trie_reaper.busy = 0;
+        if (trie_reaper.num == 0)
+            pthread_cond_broadcast(&(trie_reaper.done));
+    }
+    return NULL;
+}
+#endif
+
+static
+void trie_reaper_add(struct _trie * node) {
+#ifndef NO_PTHREAD
+    pthread_t tid;
+    int res;
+#endif
+
+    trie_mem_ref(node->data.allocator); // Its trie may be cleared meanwhile
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(trie_reaper.lock));
+    if (!trie_reaper.started) { // First time here
+        res = pthread_create(&tid, NULL, trie_reaper_thread, NULL);
+        if (res != 0) { // No thread, frees here
+            pthread_mutex_unlock(&(trie_reaper.lock));
+            trie_reap(node);
+            return;
+        }
+        pthread_detach(tid);
+        trie_reaper.started = 1;
+    }
+    if (trie_reaper.num == trie_reaper.alloc) { // Doubles
+        trie_reaper.alloc = (trie_reaper.alloc == 0)?16:(2*trie_reaper.alloc);
+        trie_reaper.nodes = realloc(trie_reaper.nodes, (trie_reaper.alloc)*sizeof*(trie_reaper.nodes));
+        assert(trie_reaper.nodes);
+    }
+    trie_reaper.nodes[trie_reaper.num++] = node;
+    pthread_cond_signal(&(trie_reaper.work));
+    pthread_mutex_unlock(&(trie_reaper.lock));
+#else
+    trie_reap(node); // Single thread, frees now
+#endif
+}
+
+void trie_reaper_flush(void) {
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(trie_reaper.lock));
+    while ((trie_reaper.num > 0) || trie_reaper.busy)
+        pthread_cond_wait(&(trie_reaper.done), &(trie_reaper.lock));
+    pthread_mutex_unlock(&(trie_reaper.lock));
+#endif
+}
+
+// Resets a root without keys, as trie_remove does
+static inline
+void trie_reset_root(trie_ptr_t t) {
+    trie_destroy_childs(&(t->childs));
+    trie_destroy_data(t);
+    trie_set_data(t, NULL);
+    trie_data_len(t) = 0;
+    t->data.dealloc = 0;
+    t->data.end = 0;
+    t->count = 0;
+}
+
+// The node where the prefix ends is unlinked from its parent, both writelocked. Counts are
+// exact once cur is writelocked: writers below have already counted their keys and left
+int trie_remove_prefix(trie_ptr_t t, const DATA_t * prefix, int len) {
+    int mismatch, offset, pos, removed, locked, write_from;
+    struct _trie * cur, * next, * prev, * dead;
+    trie_path_t path; // Locked nodes above cur
+    trie_allocator_t * allocator;
+
+    if ((t == NULL) || ((prefix == NULL) && (len > 0)))
+        return 0; // Invalid ptr
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    if (trie_is_empty(t)) { // No data to delete
+        trie_unlock(&(t->lock));
+        return 0;
+    }
+    allocator = trie_mem_enter(t);
+    if (trie_path_init(&path, len) != SUCCESS) { // Nothing is removed
+        trie_unlock(&(t->lock));
+        trie_mem_leave(allocator);
+        return FAIL;
+    }
+
+    cur = t;
+    offset = locked = 0;
+    write_from = INT_MAX; // Nodes of the path from write_from on are writelocked
+    pos = INT_MAX; // Leads to error if used uninitialized
+    while (1) {
+        mismatch = find_first_mismatch(prefix + offset, len - offset, trie_data(cur), trie_data_len(cur));
+        if (offset + mismatch == len) { // Every key below cur starts with prefix
+            if (trie_relock_write(cur, &locked)) // Lock gained, checks again
+                continue;
+            if (!trie_is_root(t, cur) && (write_from >= path.depth)) {
+                trie_unlock(&(cur->lock)); // Starts again from the parent, writelocked
+                path.depth--;
+                cur = path.nodes[path.depth];
+                trie_unlock(&(cur->lock));
+                trie_writelock(&(cur->lock)); // Its parent (or being the root) keeps it
+                offset = path.offsets[path.depth];
+                continue;
+            }
+            break;
+        }
+        if ((mismatch < trie_data_len(cur)) || // Mismatch inside data
+            !trie_search_in_childs(&pos, &(cur->childs), prefix[offset + mismatch])) {
+            trie_unlock(&(cur->lock));
+            trie_path_unlock(&path);
+            trie_mem_leave(allocator);
+            return 0; // No key starts with prefix
+        }
+        next = trie_get_child(cur, pos);
+        if (locked) { // Writelocked below, since the path was writelocked
+            trie_writelock(&(next->lock));
+            if (write_from > path.depth)
+                write_from = path.depth;
+        } else {
+            trie_readlock(&(next->lock)); // Readlocks next.
+        }
+        path.offsets[path.depth] = offset;
+        path.nodes[path.depth++] = cur; // Keeps it locked
+        offset += mismatch + 1;
+        cur = next;
+    }
+
+    removed = trie_get_count(cur);
+    trie_path_count(&path, -removed); // Touches the path too, its subtree changes
+    if (trie_is_root(t, cur)) { // The whole trie, moves it to a new node
+        dead = trie_node_alloc();
+        assert(dead);
+        memcpy(&(dead->data), &(t->data), sizeof(dead->data));
+        memcpy(&(dead->childs), &(t->childs), sizeof(dead->childs));
+        dead->count = removed;
+        trie_init_mutex(&(dead->lock));
+        trie_init_childs(&(t->childs)); // Arrays and data now belong to dead
+        t->data.dealloc = 0;
+        trie_reset_root(t);
+        trie_touch(t);
+        trie_unlock(&(t->lock));
+        trie_path_unlock(&path);
+        trie_reaper_add(dead); // Its data keeps the allocator of t
+        trie_mem_leave(allocator);
+        return removed;
+    }
+
+    prev = path.nodes[path.depth - 1]; // Writelocked
+    trie_own_data(cur, trie_data(prev), trie_data_len(prev)); // prev data may be freed by a merge
+    trie_remove_child(&(prev->childs), pos);
+    cur->data.allocator = t->data.allocator; // For the reaper
+    trie_unlock(&(cur->lock)); // Unreachable now, only readers already inside may be there
+    if (!trie_data_end(prev) && (trie_get_child_num(prev) == 1)) // Prior is not needed anymore
+        trie_merge_only_child(prev);
+    else if (!trie_data_end(prev) && trie_empty_childs(prev)) // prev is the root node, and it is empty
+        trie_reset_root(prev);
+    trie_path_unlock(&path);
+    trie_reaper_add(cur);
+    trie_mem_leave(allocator);
+    return removed;
 }
 
 // ===================
@@ -524,123 +917,341 @@ int trie_find(trie_ptr_t t, const DATA_t * arr, int len) {
 }
 
 // ============================
-// ===    TRIE GET SUFFIX   ===
+// === TRIE LONGEST PREFIX  ===
 // ============================
 
-int trie_get_suffix(trie_ptr_t t, const DATA_t * arr, int len, trie_arr_t * suffix) {
+// t must be readlocked, and it is left readlocked. Other nodes are locked hand over hand
+static inline
+int trie_longest_prefix_helper(trie_ptr_t t, const DATA_t * arr, int len) {
     int mismatch; // data counter
-    int retval;
+    int matched, best; // lenght of arr consumed, and of the longest key found
     int a_id, b_id; // identifiers
     struct _trie * cur, * next; // current root pointer (not reallocable)
 
+    if (trie_is_empty(t))
+        return -1; // Empty trie
+
     cur = t;
-    if (cur == NULL)
-        return TRIE_NO_SUFFIX_FOUND; // Invalid ptr
+    matched = 0;
+    best = -1; // No key found (yet)
+    while (1) {
+        // Looks for the first mismatching character
+        mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
+        if (mismatch < trie_data_len(cur)) // Mismatch in the middle of the node, no more keys
+            break;
 
-    trie_readlock(&(cur->lock)); // locks root trie read mutex
-    if (trie_is_empty(cur)) {
-        retval = TRIE_NO_SUFFIX_FOUND; // Empty trie
-    } else { // Trie not empty (general case)
-        while (1) {
-            // Looks for the first mismatching character
-            mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
+        if (trie_data_end(cur)) // A key ends here, and it is a prefix of arr
+            best = matched + mismatch;
+        if ((mismatch == len) || trie_empty_childs(cur)) // No more data, or no more nodes
+            break;
 
-            // Now parse
-            if ((mismatch == trie_data_len(cur)) && (mismatch == len)) { // Reached end of data, and end of node
-                if (trie_data_end(cur)) { // Data ends here
-                    // Asserts there are no childs
-                    if (trie_empty_childs(cur)) { // Suffix has no lenght
-                        if (suffix != NULL)
-                                trie_arr_len(suffix) = 0;
-                        retval = TRIE_SUFFIX_FOUND; 
-                    } else { // Not univocal way of interpretation
-                        retval = TRIE_NO_SUFFIX_FOUND;
-                    }
-                } else { // Date does not ends here.
-                    assert(!trie_empty_childs(cur)); // Because of non ending data
-                    assert(trie_get_child_num(cur) != 1); // A non-ending node may not have one child
-                    retval = TRIE_MULTIPLE_SUFFIX;
-                }
-                break;
-            } else if ( (mismatch == trie_data_len(cur)) // Reached end of stored data
-                        && trie_empty_childs(cur) ) { // And has no childs
-                assert(len > mismatch); // there is always a next character
-                assert(trie_data_end(cur)); // Because of empty childs
-                retval = TRIE_NO_SUFFIX_FOUND; // Not found
-                break; // End
-            } else if (mismatch == trie_data_len(cur)) { // Reached end of stored data, has childs
-                // Let's start by binary searching the next character inside the childs
-                assert(mismatch < len); //  there is always a next character, so can access arr[mismatch]
-                a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
-                if (a_id) { // Element was found, calls to add now became recursive ...
-                    next = trie_get_child(cur, b_id); // New data should be added here
-                    trie_readlock(&(next->lock)); // Readlocks next.
-                    trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
-                    arr += (mismatch + 1); // Moves forward the array data
-                    len -= (mismatch + 1);
-                    cur = next;
-                    continue; // Continues while loop
-                } else { // Element was not found, inserts a new one
-                    retval = TRIE_NO_SUFFIX_FOUND;
-                    break;
-                }
-            } else if (mismatch == len) { // Middle of the data, data is longer than search
-                assert(mismatch < trie_data_len(cur)); // Less, not less or equal
-                if (trie_data_end(cur)) { // Data ends here!
-                    if (suffix != NULL) { // if suffix == NULL, do not copy data, only returns the value
-                        trie_arr_len(suffix) = trie_data_len(cur) - mismatch; // stores the remaining part of the data
-                        trie_arr_data(suffix) = realloc(trie_arr_data(suffix), trie_arr_len(suffix)*sizeof*trie_arr_data(suffix));
-                        memcpy(trie_arr_data(suffix), trie_data(cur) + mismatch, trie_arr_len(suffix)*sizeof*trie_data(cur)); // Copies the rest of the data
-                    }
-                    retval = TRIE_SUFFIX_FOUND;
-                } else { // Data does not end with this node
-                    assert(!trie_empty_childs(cur)); // Because of non end data
-                    assert(trie_get_child_num(cur) != 1); // A non-ending node may not have one child
-                    retval = TRIE_MULTIPLE_SUFFIX;
-                }
-                break;
-            } else { // Both mismatches in middle, it is not possible to have a suffix
-                assert(mismatch < trie_data_len(cur));
-                assert(mismatch < len);
-                retval = TRIE_NO_SUFFIX_FOUND;
-                break;
-            }
-            assert(0);
-            __builtin_unreachable();
-        } // end while
-    }
+        a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
+        if (!a_id) // Nothing stored after
+            break;
+        next = trie_get_child(cur, b_id);
+        trie_readlock(&(next->lock)); // Readlocks next.
+        if (!trie_is_root(t, cur))
+            trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        arr += (mismatch + 1); // Moves forward the array data
+        len -= (mismatch + 1);
+        matched += (mismatch + 1);
+        cur = next;
+    } // end while
 
-    trie_unlock(&(cur->lock));
-    return retval;
+    if (!trie_is_root(t, cur))
+        trie_unlock(&(cur->lock));
+    return best;
 }
 
+int trie_longest_prefix(trie_ptr_t t, const DATA_t * arr, int len) {
+    int retval;
 
-// ==========================
-// ===   TRIE ITERATORS   ===
-// ==========================
+    if (t == NULL)
+        return -1; // Invalid ptr
 
-static inline // Gets first useful iterator. This function always succedes
-void trie_get_first_iterator(trie_ptr_t t, trie_iterator_t * iterator, int offset) {
-    struct _trie * cur, *next;
-    assert(offset <= trie_iterator_data_len(iterator));
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    retval = trie_longest_prefix_helper(t, arr, len);
+    trie_unlock(&(t->lock));
+    return retval;
+}
 
-    cur = t; // Asserts t was already readlocked
-    while (1) {
-        trie_iterator_substitute_end(iterator, offset, trie_data(cur), trie_data_len(cur)); // Substitutes last data
-        if (trie_data_end(cur) || trie_empty_childs(cur)) { // Actually, the second implies the first
-            trie_unlock(&(cur->lock));
-            break;
-        }
-        offset += trie_data_len(cur); // Writes next data after the first
-        trie_iterator_substitute_end(iterator, offset, &(trie_get_first(cur, 0)), 1); // adds the first character
-        offset++; // First data inside child. If a child exists must exists also first data
-        next = trie_get_child(cur, 0); // Goes in the first child
-        trie_readlock(&(next->lock)); // Readlocks next.
-        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
-        cur = next;
+void trie_longest_prefix_batch(trie_ptr_t t, const DATA_t * const * arrs, const int * lens, int * res, int n) {
+    int i;
+
+    if (t == NULL) { // Invalid ptr
+        for (i = 0; i < n; i++)
+            res[i] = -1;
+        return;
     }
 
-    assert(trie_iterator_data_len(iterator) <= iterator->alloc); // Debug only, asserts not writing after allocated memory
+    trie_readlock(&(t->lock)); // Root is locked once for the whole batch
+    for (i = 0; i < n; i++)
+        res[i] = trie_longest_prefix_helper(t, arrs[i], lens[i]);
+    trie_unlock(&(t->lock));
+}
+
+// ================================
+// === TRIE COUNT, RANK, SELECT ===
+// ================================
+
+int trie_count(trie_ptr_t t) {
+    int retval;
+
+    if (t == NULL)
+        return 0; // Invalid ptr
+
+    trie_readlock(&(t->lock));
+    retval = trie_get_count(t);
+    trie_unlock(&(t->lock));
+    return retval;
+}
+
+int trie_count_prefix(trie_ptr_t t, const DATA_t * arr, int len) {
+    int mismatch; // data counter
+    int retval;
+    int a_id, b_id; // identifiers
+    struct _trie * cur, * next; // current root pointer (not reallocable)
+
+    cur = t;
+    if (cur == NULL)
+        return 0; // Invalid ptr
+
+    trie_readlock(&(cur->lock)); // locks root trie read mutex
+    while (1) {
+        // Looks for the first mismatching character
+        mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
+
+        if (mismatch == len) { // arr ends inside this node, each key of the subtree starts with arr
+            retval = trie_get_count(cur);
+            break;
+        } else if ((mismatch < trie_data_len(cur)) || trie_empty_childs(cur)) { // Mismatch, or no more data
+            retval = 0;
+            break;
+        }
+        a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
+        if (!a_id) {
+            retval = 0;
+            break;
+        }
+        next = trie_get_child(cur, b_id);
+        trie_readlock(&(next->lock)); // Readlocks next.
+        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        arr += (mismatch + 1); // Moves forward the array data
+        len -= (mismatch + 1);
+        cur = next;
+    } // end while
+
+    trie_unlock(&(cur->lock));
+    return retval;
+}
+
+int trie_rank(trie_ptr_t t, const DATA_t * arr, int len) {
+    int mismatch; // data counter
+    int retval, i;
+    int a_id, b_id; // identifiers
+    struct _trie * cur, * next; // current root pointer (not reallocable)
+
+    cur = t;
+    if (cur == NULL)
+        return 0; // Invalid ptr
+
+    retval = 0; // Number of keys before arr
+    trie_readlock(&(cur->lock)); // locks root trie read mutex
+    while (1) {
+        // Looks for the first mismatching character
+        mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
+
+        if (mismatch == len) { // Every key left in the subtree is equal or longer
+            break;
+        } else if (mismatch < trie_data_len(cur)) { // Mismatch in the middle, whole subtree is before or after
+            if (trie_data(cur)[mismatch] < arr[mismatch])
+                retval += trie_get_count(cur);
+            break;
+        }
+
+        if (trie_data_end(cur)) // Key ending here is shorter, so it comes before
+            retval++;
+        if (trie_is_empty(cur)) // Leaf node, nothing else below
+            break;
+        a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
+        for (i = 0; i < b_id; i++) // Each child before
+            retval += trie_get_count(trie_get_child(cur, i));
+        if (!a_id)
+            break;
+        next = trie_get_child(cur, b_id);
+        trie_readlock(&(next->lock)); // Readlocks next.
+        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        arr += (mismatch + 1); // Moves forward the array data
+        len -= (mismatch + 1);
+        cur = next;
+    } // end while
+
+    trie_unlock(&(cur->lock));
+    return retval;
+}
+
+int trie_select(trie_ptr_t t, int k, trie_arr_t * key) {
+    int offset, i, retval;
+    struct _trie * cur, * next; // current root pointer (not reallocable)
+
+    cur = t;
+    if ((cur == NULL) || (key == NULL))
+        return 0; // Invalid ptr
+
+    trie_readlock(&(cur->lock)); // locks root trie read mutex
+    if ((k < 0) || (k >= trie_get_count(cur))) { // Out of range
+        trie_unlock(&(cur->lock));
+        return 0;
+    }
+
+    offset = 0;
+    retval = 0; // Not found yet
+    while (1) {
+        trie_iterator_substitute_end(key, offset, trie_data(cur), trie_data_len(cur)); // Appends node data
+        offset += trie_data_len(cur);
+        if (trie_data_end(cur) && (k-- == 0)) { // Key ending here is the one
+            retval = 1;
+            break;
+        }
+
+        next = NULL;
+        for (i = 0; i < trie_get_child_num(cur); i++) { // Skips the subtrees before
+            if (k < trie_get_count(trie_get_child(cur, i))) {
+                next = trie_get_child(cur, i);
+                break;
+            }
+            k -= trie_get_count(trie_get_child(cur, i));
+        }
+        if (next == NULL) // Counts changed meanwhile
+            break;
+
+        trie_iterator_substitute_end(key, offset, &(trie_get_first(cur, i)), 1); // adds the first character
+        offset++;
+        trie_readlock(&(next->lock)); // Readlocks next.
+        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        cur = next;
+    } // end while
+
+    trie_unlock(&(cur->lock));
+    return retval;
+}
+
+// ============================
+// ===    TRIE GET SUFFIX   ===
+// ============================
+
+int trie_get_suffix(trie_ptr_t t, const DATA_t * arr, int len, trie_arr_t * suffix) {
+    int mismatch; // data counter
+    int retval;
+    int a_id, b_id; // identifiers
+    struct _trie * cur, * next; // current root pointer (not reallocable)
+
+    cur = t;
+    if (cur == NULL)
+        return TRIE_NO_SUFFIX_FOUND; // Invalid ptr
+
+    trie_readlock(&(cur->lock)); // locks root trie read mutex
+    if (trie_is_empty(cur)) {
+        retval = TRIE_NO_SUFFIX_FOUND; // Empty trie
+    } else { // Trie not empty (general case)
+        while (1) {
+            // Looks for the first mismatching character
+            mismatch = find_first_mismatch(arr, len, trie_data(cur), trie_data_len(cur));
+
+            // Now parse
+            if ((mismatch == trie_data_len(cur)) && (mismatch == len)) { // Reached end of data, and end of node
+                if (trie_data_end(cur)) { // Data ends here
+                    // Asserts there are no childs
+                    if (trie_empty_childs(cur)) { // Suffix has no lenght
+                        if (suffix != NULL)
+                                trie_arr_len(suffix) = 0;
+                        retval = TRIE_SUFFIX_FOUND; 
+                    } else { // Not univocal way of interpretation
+                        retval = TRIE_NO_SUFFIX_FOUND;
+                    }
+                } else { // Date does not ends here.
+                    assert(!trie_empty_childs(cur)); // Because of non ending data
+                    retval = TRIE_MULTIPLE_SUFFIX;
+                }
+                break;
+            } else if ( (mismatch == trie_data_len(cur)) // Reached end of stored data
+                        && trie_empty_childs(cur) ) { // And has no childs
+                assert(len > mismatch); // there is always a next character
+                assert(trie_data_end(cur)); // Because of empty childs
+                retval = TRIE_NO_SUFFIX_FOUND; // Not found
+                break; // End
+            } else if (mismatch == trie_data_len(cur)) { // Reached end of stored data, has childs
+                // Let's start by binary searching the next character inside the childs
+                assert(mismatch < len); //  there is always a next character, so can access arr[mismatch]
+                a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[mismatch]); // Binary search in child nodes
+                if (a_id) { // Element was found, calls to add now became recursive ...
+                    next = trie_get_child(cur, b_id); // New data should be added here
+                    trie_readlock(&(next->lock)); // Readlocks next.
+                    trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+                    arr += (mismatch + 1); // Moves forward the array data
+                    len -= (mismatch + 1);
+                    cur = next;
+                    continue; // Continues while loop
+                } else { // Element was not found, inserts a new one
+                    retval = TRIE_NO_SUFFIX_FOUND;
+                    break;
+                }
+            } else if (mismatch == len) { // Middle of the data, data is longer than search
+                assert(mismatch < trie_data_len(cur)); // Less, not less or equal
+                if (trie_data_end(cur)) { // Data ends here!
+                    if (suffix != NULL) { // if suffix == NULL, do not copy data, only returns the value
+                        trie_arr_len(suffix) = trie_data_len(cur) - mismatch; // stores the remaining part of the data
+                        trie_arr_data(suffix) = realloc(trie_arr_data(suffix), trie_arr_len(suffix)*sizeof*trie_arr_data(suffix));
+                        memcpy(trie_arr_data(suffix), trie_data(cur) + mismatch, trie_arr_len(suffix)*sizeof*trie_data(cur)); // Copies the rest of the data
+                    }
+                    retval = TRIE_SUFFIX_FOUND;
+                } else { // Data does not end with this node
+                    assert(!trie_empty_childs(cur)); // Because of non end data
+                    retval = TRIE_MULTIPLE_SUFFIX;
+                }
+                break;
+            } else { // Both mismatches in middle, it is not possible to have a suffix
+                assert(mismatch < trie_data_len(cur));
+                assert(mismatch < len);
+                retval = TRIE_NO_SUFFIX_FOUND;
+                break;
+            }
+            assert(0);
+            __builtin_unreachable();
+        } // end while
+    }
+
+    trie_unlock(&(cur->lock));
+    return retval;
+}
+
+
+// ==========================
+// ===   TRIE ITERATORS   ===
+// ==========================
+
+static inline // Gets first useful iterator. This function always succedes
+void trie_get_first_iterator(trie_ptr_t t, trie_iterator_t * iterator, int offset) {
+    struct _trie * cur, *next;
+    assert(offset <= trie_iterator_data_len(iterator));
+
+    cur = t; // Asserts t was already readlocked
+    while (1) {
+        trie_iterator_substitute_end(iterator, offset, trie_data(cur), trie_data_len(cur)); // Substitutes last data
+        if (trie_data_end(cur) || trie_empty_childs(cur)) { // Actually, the second implies the first
+            trie_unlock(&(cur->lock));
+            break;
+        }
+        offset += trie_data_len(cur); // Writes next data after the first
+        trie_iterator_substitute_end(iterator, offset, &(trie_get_first(cur, 0)), 1); // adds the first character
+        offset++; // First data inside child. If a child exists must exists also first data
+        next = trie_get_child(cur, 0); // Goes in the first child
+        trie_readlock(&(next->lock)); // Readlocks next.
+        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        cur = next;
+    }
+
+    assert(trie_iterator_data_len(iterator) <= iterator->alloc); // Debug only, asserts not writing after allocated memory
 }
 
 static inline // This is recursive, inlines only what can
@@ -748,189 +1359,1184 @@ int trie_iterator_next(trie_ptr_t t, trie_iterator_t * iterator) {
     return res;
 }
 
-// ===============================
-// ==== TRIE SUFFFIX ITERATOR ====
-// ===============================
+static inline // Gets the last key below t, which is readlocked and whose data begins at offset. Auto unlocks
+void trie_get_last_iterator(struct _trie * t, trie_iterator_t * iterator, int offset) {
+    struct _trie * cur, * next;
+    int last;
 
-int trie_suffix_iterator_next(trie_ptr_t t, trie_arr_t trie_data, trie_iterator_t * iterator) {
-    int mismatch; // data counter
-    int retval; // Temporany (return value)
-    int tmp_len; // Temporany
-    int a_id, b_id; // identifiers
-    struct _trie * cur, * next; // current root pointer (not reallocable)
-   
-    cur = t; 
-    if (cur == NULL || iterator == NULL) // Invalid pointers
+    cur = t;
+    while (1) {
+        trie_iterator_substitute_end(iterator, offset, trie_data(cur), trie_data_len(cur)); // Substitutes last data
+        if (trie_empty_childs(cur)) { // Leaves always end a key
+            assert(trie_data_end(cur));
+            trie_unlock(&(cur->lock));
+            break;
+        }
+        offset += trie_data_len(cur);
+        last = trie_get_child_num(cur) - 1;
+        trie_iterator_substitute_end(iterator, offset, &(trie_get_first(cur, last)), 1); // adds the last character
+        offset++;
+        next = trie_get_child(cur, last);
+        trie_readlock(&(next->lock)); // Readlocks next.
+        trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
+        cur = next;
+    }
+}
+
+static // arr left the trie at cur: the answer is the candidate of the fork, if any. Unlocks both
+int trie_iterator_seek_fork(struct _trie * cur, struct _trie * fork, int fork_offset, int fork_pos,
+                            trie_iterator_t * iterator, int dir) {
+    struct _trie * next;
+    int offset;
+
+    if (cur != fork)
+        trie_unlock(&(cur->lock));
+    if (fork == NULL) { // Nothing on that side
+        trie_iterator_clear(iterator);
         return 0;
+    }
+    offset = fork_offset + trie_data_len(fork); // The path up to the fork is still in the iterator
+    if (fork_pos < 0) { // The key of the fork itself
+        iterator->len = offset;
+        trie_unlock(&(fork->lock));
+        return 1;
+    }
+    trie_iterator_substitute_end(iterator, offset, &(trie_get_first(fork, fork_pos)), 1);
+    next = trie_get_child(fork, fork_pos);
+    trie_readlock(&(next->lock));
+    trie_unlock(&(fork->lock));
+    if (dir > 0)
+        trie_get_first_iterator(next, iterator, offset + 1); // Auto unlocks
+    else
+        trie_get_last_iterator(next, iterator, offset + 1); // Auto unlocks
+    return 1;
+}
+
+/*
+   Seek descends along arr once. On the way it remembers the fork: the deepest node with a
+   subtree on the right side of the path (dir > 0), or on the left side, or a key ending there
+   (dir < 0). The fork stays readlocked, so when arr leaves the trie the answer is the first
+   (or last) key of that subtree, without starting again from the root. Locks are still taken
+   from the top, the fork is an ancestor of the current node.
+*/
+static
+int trie_iterator_seek(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len, int dir, int equal) {
+    struct _trie * cur, * next, * fork = NULL;
+    int offset, mismatch, found, pos, fork_offset = 0, fork_pos = 0, candidate;
 
-    // First of all reachs the end of the data to search (trie_data arr)
+    if ((t == NULL) || (iterator == NULL) || ((arr == NULL) && (len > 0)))
+        return 0; // Invalid ptr
+    if (trie_iterator_first_iterator(iterator)) { // An empty key found must not look like a new iterator
+        trie_iterator_use_iterator(iterator);
+    }
 
+    cur = t;
+    offset = 0;
     trie_readlock(&(cur->lock)); // locks root trie read mutex
     if (trie_is_empty(cur)) {
-        retval = 0; // Empty trie
-    } else { // Trie not empty (general case)
-        while (1) {
-            // Looks for the first mismatching character
-            mismatch = find_first_mismatch(trie_data.data, trie_data.len, trie_data(cur), trie_data_len(cur));
-
-            // Now parse
-            if ((mismatch == trie_data_len(cur)) && (mismatch == trie_data.len)) { // Reached end of data, and end of node
-                // Starts from the next node
-                if (trie_get_child_num(cur) == 0) { // No childs
-                    assert(trie_data_end(cur)); // Always true when there are no childs
-                    retval = 0; // 0 means this is the last iterator (or an error occurred)
-                    trie_iterator_clear(iterator); // No more iterators
-                    break; // nothing to do
+        trie_unlock(&(cur->lock));
+        trie_iterator_clear(iterator);
+        return 0;
+    }
+    while (1) {
+        trie_iterator_substitute_end(iterator, offset, trie_data(cur), trie_data_len(cur));
+        mismatch = find_first_mismatch(arr + offset, len - offset, trie_data(cur), trie_data_len(cur));
+        if (mismatch < trie_data_len(cur)) { // arr ends or leaves the trie inside data
+            if ((offset + mismatch == len) || (trie_data(cur)[mismatch] > arr[offset + mismatch])) {
+                if (dir > 0) { // Whole subtree after arr
+                    trie_get_first_iterator(cur, iterator, offset); // Auto unlocks
+                    break;
                 }
+            } else if (dir < 0) { // Whole subtree before arr
+                trie_get_last_iterator(cur, iterator, offset); // Auto unlocks
+                break;
+            }
+            return trie_iterator_seek_fork(cur, fork, fork_offset, fork_pos, iterator, dir);
+        }
+        if (offset + mismatch == len) { // arr ends with the node
+            if (trie_data_end(cur) && equal) {
+                trie_unlock(&(cur->lock));
+                break;
+            }
+            if ((dir > 0) && !trie_empty_childs(cur)) { // Every key below is longer, so after
+                trie_iterator_substitute_end(iterator, offset + mismatch, &(trie_get_first(cur, 0)), 1);
+                next = trie_get_child(cur, 0);
+                trie_readlock(&(next->lock));
+                trie_unlock(&(cur->lock));
+                trie_get_first_iterator(next, iterator, offset + mismatch + 1); // Auto unlocks
+                break;
+            }
+            return trie_iterator_seek_fork(cur, fork, fork_offset, fork_pos, iterator, dir);
+        }
 
-                if (trie_iterator_first_iterator(iterator)) { // First time here, gets the first
-                    trie_iterator_use_iterator(iterator); // This way does not execute this code next time
-                    if (!trie_data_end(cur)) { // If data does not ends here first iterator is inside first child
-                        trie_readlock(&(trie_get_child(cur, 0)->lock)); // Readlocks next first child
-                        // Copies the first byte of next node in the iterator
-                        trie_iterator_substitute_end(iterator, 0, &trie_get_first(cur, 0), 1); // only one character
-                        trie_get_first_iterator(trie_get_child(cur, 0), iterator, 1); // Sets 1 offset
-                        // Prior function call auto unlocks mutex
-                    } else {} // First iterator is the void iterator. Iterator is already void, so do nothing
-                    retval = 1; // Found
-                } else { // Normal
-                    // Now searches in childs from wich to start
-                    if (trie_iterator_data_len(iterator) == 0)
-                        a_id = b_id = 0; // Starts from the first child, forces copying the first byte
-                    else // Does a binary search for the first data inside childs
-                        a_id = trie_search_in_childs(&b_id, &(cur->childs), trie_iterator_data(iterator)[0]);
-                    
-                    if (b_id >= trie_get_child_num(cur)) { // Reached the end, sets the iterator to null
-                        retval = 0; // This forces clearing iterator (next)
-                    } else { // Normal case
-                        trie_readlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks next first child
-                        if (!a_id) { // Not found, need to copy the first character, and restart from a first iterator
-                            trie_iterator_substitute_end(iterator, 0, &trie_get_first(cur, b_id), 1); // only one character
-                            trie_get_first_iterator(trie_get_child(cur, b_id), iterator, 1); // Gets next iterator from this root
-                            retval = 1; // Ignores next iterator result. Even the first character added is a good solution!
-                        } else {
-                            retval = trie_next_iterator_helper(trie_get_child(cur, b_id), iterator, 1); // Gets next iterator from this root
-                            trie_unlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks next.
-                        }
-
-                        if ((retval == 0) && (++b_id < trie_get_child_num(cur))) { // If not found and can move to next data
-                            trie_readlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks the child we are going to use
-                            trie_iterator_substitute_end(iterator, 0, &trie_get_first(cur, b_id), 1); // only one character
-                            trie_get_first_iterator(trie_get_child(cur, b_id), iterator, 1); // Gets next iterator from this root
-                            // Mutex is auto unlocked
-                            retval = 1; // Ignores next iterator result. Even the first character added is a good solution!
-                        } // else cannot move to next data, retval = 0 in this case
-                    }
-                }
-                
-                if (retval == 0) // Reached last element
-                    trie_iterator_clear(iterator);
+        found = trie_search_in_childs(&pos, &(cur->childs), arr[offset + mismatch]);
+        if (dir > 0) // First child after the path
+            candidate = found?(pos + 1):pos;
+        else // Last child before it, otherwise the key of cur (shorter than arr)
+            candidate = (pos > 0)?(pos - 1):(trie_data_end(cur)?-1:-2);
+        if ((candidate >= -1) && (candidate < trie_get_child_num(cur))) { // cur is the new fork
+            if (fork != NULL)
+                trie_unlock(&(fork->lock));
+            fork = cur;
+            fork_offset = offset;
+            fork_pos = candidate;
+        }
+        if (!found)
+            return trie_iterator_seek_fork(cur, fork, fork_offset, fork_pos, iterator, dir);
+        trie_iterator_substitute_end(iterator, offset + mismatch, &(trie_get_first(cur, pos)), 1);
+        next = trie_get_child(cur, pos);
+        trie_readlock(&(next->lock)); // Readlocks next.
+        if (cur != fork)
+            trie_unlock(&(cur->lock)); // Unlocks current, the fork stays
+        offset += mismatch + 1;
+        cur = next;
+    }
+
+    if (fork != NULL) // Found on the path
+        trie_unlock(&(fork->lock));
+    return 1;
+}
+
+int trie_iterator_seek_ge(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len) {
+    return trie_iterator_seek(t, iterator, arr, len, 1, 1);
+}
+
+int trie_iterator_seek_gt(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len) {
+    return trie_iterator_seek(t, iterator, arr, len, 1, 0);
+}
+
+int trie_iterator_seek_le(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len) {
+    return trie_iterator_seek(t, iterator, arr, len, -1, 1);
+}
+
+int trie_iterator_seek_lt(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len) {
+    return trie_iterator_seek(t, iterator, arr, len, -1, 0);
+}
+
+int trie_iterator_prev(trie_ptr_t t, trie_iterator_t * iterator) {
+    DATA_t * key;
+    int res;
+
+    if ((t == NULL) || (iterator == NULL))
+        return 0; // Invalid ptr
+    if (trie_iterator_first_iterator(iterator)) { // First call, gets the last key
+        trie_readlock(&(t->lock));
+        if (trie_is_empty(t)) {
+            trie_unlock(&(t->lock));
+            return 0;
+        }
+        trie_iterator_use_iterator(iterator);
+        trie_get_last_iterator(t, iterator, 0); // Auto unlocks
+        return 1;
+    }
+    // Seek writes the iterator while reading arr, so it gets a copy
+    key = malloc((trie_iterator_data_len(iterator) + 1)*sizeof(DATA_t));
+    if (key == NULL)
+        return 0;
+    memcpy(key, trie_iterator_data(iterator), trie_iterator_data_len(iterator)*sizeof(DATA_t));
+    res = trie_iterator_seek(t, iterator, key, trie_iterator_data_len(iterator), -1, 0);
+    free(key);
+    return res;
+}
+
+// ===============================
+// ==== TRIE SUFFFIX ITERATOR ====
+// ===============================
+
+// The iterator holds the suffix, the cursor goes on from the prefix followed by it
+int trie_suffix_iterator_next(trie_ptr_t t, trie_arr_t trie_data, trie_iterator_t * iterator) {
+    trie_cursor_t c;
+    int res;
+
+    if ((t == NULL) || (iterator == NULL)) // Invalid pointers
+        return 0;
+    if (trie_cursor_init(&c, t, trie_data.data, trie_data.len) != SUCCESS)
+        return 0;
+    if (!trie_iterator_first_iterator(iterator)) { // Next suffix after the last one
+        trie_arr_substitute_end(&(c.key), trie_data.len, trie_iterator_data(iterator),
+                                trie_iterator_data_len(iterator));
+        c.started = 1;
+    }
+    res = trie_cursor_next(&c);
+    if (res) {
+        if (trie_iterator_first_iterator(iterator)) {
+            trie_iterator_use_iterator(iterator); // This way the next call goes on from here
+        }
+        trie_iterator_substitute_end(iterator, 0, trie_cursor_suffix(&c), trie_cursor_suffix_len(&c));
+    } else {
+        trie_iterator_clear(iterator); // Reached last element
+    }
+    trie_cursor_clear(&c);
+    return res;
+}
+
+// ===========================
+// ===   TRIE RANGE SCAN   ===
+// ===========================
+
+#define TRIE_SCAN_GO_ON 0 // Next keys may still be in range
+#define TRIE_SCAN_STOP  1 // Upper bound reached, or callback asked to stop
+
+struct _trie_scan {
+    const DATA_t * lo, * hi; // Bounds, NULL when unbounded
+    int lo_len, hi_len;
+    trie_scan_callback_t callback;
+    void * ctx;
+    trie_arr_t key; // Key built while descending
+    int found; // Number of keys passed to callback
+};
+
+// Keys of t subtree start with key[0..offset]. tight_lo (tight_hi) means they are
+// equal to the first offset symbols of lo (hi). t must be readlocked, and it is left locked
+static
+int trie_scan_helper(struct _trie * t, struct _trie_scan * s, int offset, int tight_lo, int tight_hi) {
+    int mismatch, i, start, found, res;
+    struct _trie * next;
+    DATA_t first;
+
+    if (tight_lo) { // Compares with the lower bound
+        mismatch = find_first_mismatch(s->lo + offset, s->lo_len - offset, trie_data(t), trie_data_len(t));
+        if (mismatch == s->lo_len - offset) // lo is a prefix of every key left
+            tight_lo = 0;
+        else if (mismatch < trie_data_len(t)) { // Mismatch in the middle of the data
+            if (trie_data(t)[mismatch] < s->lo[offset + mismatch])
+                return TRIE_SCAN_GO_ON; // Whole subtree is before lo
+            tight_lo = 0; // Whole subtree is after lo
+        } // else still matching, keys ending here are before lo
+    }
+    if (tight_hi) { // Compares with the upper bound (excluded)
+        mismatch = find_first_mismatch(s->hi + offset, s->hi_len - offset, trie_data(t), trie_data_len(t));
+        if (mismatch == s->hi_len - offset) // hi is a prefix of every key left
+            return TRIE_SCAN_STOP;
+        else if (mismatch < trie_data_len(t)) { // Mismatch in the middle of the data
+            if (trie_data(t)[mismatch] > s->hi[offset + mismatch])
+                return TRIE_SCAN_STOP; // Whole subtree is after hi
+            tight_hi = 0; // Whole subtree is before hi
+        }
+    }
+
+    trie_arr_substitute_end(&(s->key), offset, trie_data(t), trie_data_len(t)); // Appends node data
+    offset += trie_data_len(t);
+    if (trie_data_end(t) && !tight_lo) { // Key in range
+        s->found++;
+        if (s->callback(trie_arr_data(&(s->key)), offset, s->ctx))
+            return TRIE_SCAN_STOP;
+    }
+
+    start = 0;
+    found = 0;
+    if (tight_lo && !trie_empty_childs(t)) // Skips childs before lo
+        found = trie_search_in_childs(&start, &(t->childs), s->lo[offset]);
+    for (i = start; i < trie_get_child_num(t); i++) {
+        first = trie_get_first(t, i);
+        if (tight_hi && (first > s->hi[offset])) // Childs after hi
+            return TRIE_SCAN_STOP;
+
+        next = trie_get_child(t, i);
+        trie_arr_substitute_end(&(s->key), offset, &first, 1); // adds the first character
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        res = trie_scan_helper(next, s, offset + 1, tight_lo && found && (i == start), // Only lo child is tight
+                               tight_hi && (first == s->hi[offset]));
+        trie_unlock(&(next->lock));
+        if (res == TRIE_SCAN_STOP)
+            return TRIE_SCAN_STOP;
+    }
+    return TRIE_SCAN_GO_ON;
+}
+
+int trie_scan(trie_ptr_t t, const DATA_t * lo, int lo_len, const DATA_t * hi, int hi_len,
+              trie_scan_callback_t callback, void * ctx) {
+    struct _trie_scan s;
+
+    if ((t == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+
+    s.lo = lo;
+    s.lo_len = lo_len;
+    s.hi = hi;
+    s.hi_len = hi_len;
+    s.callback = callback;
+    s.ctx = ctx;
+    s.found = 0;
+    trie_arr_init(&(s.key));
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    trie_scan_helper(t, &s, 0, lo != NULL, hi != NULL);
+    trie_unlock(&(t->lock));
+
+    trie_arr_clear(&(s.key));
+    return s.found;
+}
+
+struct _trie_scan_buffer {
+    trie_arr_t * keys;
+    int * lens;
+    int max;
+    int num;
+};
+
+static
+int trie_scan_buffer_callback(const DATA_t * key, int len, void * ctx) {
+    struct _trie_scan_buffer * buf = ctx;
+    trie_arr_substitute_end(buf->keys, trie_arr_len(buf->keys), key, len); // Appends the key
+    buf->lens[buf->num++] = len;
+    return (buf->num == buf->max); // Stops when full
+}
+
+int trie_scan_buffer(trie_ptr_t t, const DATA_t * lo, int lo_len, const DATA_t * hi, int hi_len,
+                     trie_arr_t * keys, int * lens, int max) {
+    struct _trie_scan_buffer buf;
+
+    if ((keys == NULL) || (lens == NULL) || (max <= 0))
+        return 0; // Invalid ptr, or nothing to do
 
+    buf.keys = keys;
+    buf.lens = lens;
+    buf.max = max;
+    buf.num = 0;
+    keys->len = 0; // Overwrites old keys, keeps the memory
+    trie_scan(t, lo, lo_len, hi, hi_len, trie_scan_buffer_callback, &buf);
+    return buf.num;
+}
+
+// ============================
+// ===    TRIE FOREACH      ===
+// ============================
+
+// Visits t once, depth first, with an explicit stack. The key is built in a single buffer,
+// appending node data when going down and truncating it when going up. Nodes on the stack are
+// readlocked. Keys of t start with prefix (empty for the root).
+// Returns the number of keys visited (key_callback), or nodes (node_callback)
+static
+int trie_foreach_helper(struct _trie * t, const DATA_t * prefix, int prefix_len, trie_scan_callback_t key_callback,
+                        trie_node_callback_t node_callback, void * ctx) {
+    struct _trie_stack stack;
+    struct _trie_stack_item * top;
+    struct _trie * cur, * next;
+    trie_node_info_t info;
+    trie_arr_t key;
+    int offset, visited;
+
+    trie_stack_init(&stack);
+    trie_arr_init(&key);
+    visited = 0;
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    if (trie_is_empty(t) && !trie_data_end(t)) { // Empty trie
+        trie_unlock(&(t->lock));
+        return 0;
+    }
+    trie_arr_substitute_end(&key, 0, prefix, prefix_len);
+    cur = t;
+    offset = prefix_len;
+    while (1) { // Visits cur, its data starts at offset in key
+        trie_stack_push(&stack, cur, offset);
+        trie_arr_substitute_end(&key, offset, trie_data(cur), trie_data_len(cur)); // Appends node data
+        if (node_callback != NULL) {
+            info.key = trie_arr_data(&key);
+            info.len = trie_arr_len(&key);
+            info.data_len = trie_data_len(cur);
+            info.depth = stack.num - 1;
+            info.child_num = trie_get_child_num(cur);
+            info.count = trie_get_count(cur);
+            info.end = trie_data_end(cur);
+            visited++;
+            if (node_callback(&info, ctx))
                 break;
-            } else if ( (mismatch == trie_data_len(cur)) && trie_empty_childs(cur) ) { // Reached end of stored data
-                assert(trie_data.len > mismatch); // there is always a next character
-                assert(trie_data_end(cur)); // Because of empty childs
-                retval = 0; // Not found
-                break; // End
-            } else if (mismatch == trie_data_len(cur)) { // Reached end of stored data, has childs
-                // Let's start by binary searching the next character inside the childs
-                assert(mismatch < trie_data.len); //  there is always a next character, so can access arr[mismatch]
-                a_id = trie_search_in_childs(&b_id, &(cur->childs), trie_data.data[mismatch]); // Binary search in child nodes
-                if (a_id) { // Element was found, calls to add now became recursive ...
-                    next = trie_get_child(cur, b_id); // New data should be added here
-                    trie_readlock(&(next->lock)); // Readlocks next.
-                    trie_unlock(&(cur->lock)); // Unlocks current. N.B. Keep order
-                    trie_data.data += (mismatch + 1); // Moves forward the array data, skipping first
-                    trie_data.len -= (mismatch + 1); // Lenght of remaining data reduces
-                    cur = next;
-                    continue; // Continues while loop
-                } else { // Element was not found
-                    retval = 0;
+        } else if (trie_data_end(cur)) {
+            visited++;
+            if (key_callback(trie_arr_data(&key), trie_arr_len(&key), ctx))
+                break;
+        }
+
+        // Goes up until a node with a child left to visit is found
+        top = trie_stack_top(&stack);
+        while (top->child == trie_get_child_num(top->node)) {
+            trie_unlock(&(top->node->lock));
+            trie_stack_pop(&stack);
+            if (trie_stack_empty(&stack))
+                break;
+            top = trie_stack_top(&stack);
+        }
+        if (trie_stack_empty(&stack)) // Every node visited
+            break;
+
+        offset = top->offset + trie_data_len(top->node); // Truncates the key after the node data
+        trie_arr_substitute_end(&key, offset, &(trie_get_first(top->node, top->child)), 1); // adds the first character
+        next = trie_get_child(top->node, top->child);
+        top->child++;
+        trie_readlock(&(next->lock)); // Parent stays locked
+        cur = next;
+        offset++;
+    }
+
+    while (!trie_stack_empty(&stack)) { // Stopped by the callback, unlocks the path
+        trie_unlock(&(trie_stack_top(&stack)->node->lock));
+        trie_stack_pop(&stack);
+    }
+    trie_stack_clear(&stack);
+    trie_arr_clear(&key);
+    return visited;
+}
+
+int trie_foreach(trie_ptr_t t, trie_scan_callback_t callback, void * ctx) {
+    if ((t == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+    return trie_foreach_helper(t, NULL, 0, callback, NULL, ctx);
+}
+
+int trie_foreach_node(trie_ptr_t t, trie_node_callback_t callback, void * ctx) {
+    if ((t == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+    return trie_foreach_helper(t, NULL, 0, NULL, callback, ctx);
+}
+
+// ============================
+// ===   TRIE FUZZY FIND    ===
+// ============================
+
+/*
+   Levenshtein distance is computed with the usual dynamic programming rows, one for each
+   symbol of the key being built: row i holds the distances between the first i symbols of
+   the key, and every prefix of arr. Rows are pushed walking down node data and firsts, so
+   each node shares the rows of its ancestors. A subtree is pruned when the minimum of the
+   last row exceeds the distance searched.
+   The trie is walked once, keys within the distance are gathered with their distance, in
+   sorted order. Once max of them are within some distance d, a later key is taken only if
+   closer (at d it would come after them), so the distance searched becomes d - 1. In the end
+   keys are taken by distance, each distance in sorted order, up to max.
+*/
+
+struct _trie_fuzzy {
+    const DATA_t * arr; // Key searched
+    int len;
+    int dist; // Distance of the keys still searched
+    int * rows; // (len + 1) distances for each symbol in key
+    int rows_alloc; // Number of allocated rows
+    trie_arr_t key; // Key built while descending
+    trie_keys_t found; // Keys within dist, in sorted order
+    int * found_dists; // Distance of each one, same allocation as found.lens
+    int * counts; // Keys found at each distance
+    int counts_alloc;
+    int max;
+};
+
+// Computes row depth + 1 adding symbol to the key, returns its minimum
+static inline
+int trie_fuzzy_push(struct _trie_fuzzy * s, int depth, DATA_t symbol) {
+    int j, min, val;
+    int * old, * new;
+
+    if (depth + 2 > s->rows_alloc) { // Doubles
+        s->rows_alloc = 2*(depth + 2);
+        s->rows = realloc(s->rows, (s->rows_alloc)*(s->len + 1)*sizeof*(s->rows));
+        assert(s->rows);
+    }
+    old = s->rows + depth*(s->len + 1);
+    new = old + (s->len + 1);
+
+    min = new[0] = old[0] + 1; // Deletes every symbol
+    for (j = 1; j <= s->len; j++) {
+        val = old[j - 1] + (s->arr[j - 1] != symbol); // Substitution (or match)
+        if (old[j] + 1 < val) // Insertion
+            val = old[j] + 1;
+        if (new[j - 1] + 1 < val) // Deletion
+            val = new[j - 1] + 1;
+        new[j] = val;
+        if (val < min)
+            min = val;
+    }
+    return min;
+}
+
+// Gathers the key built, at distance dist, and lowers the distance searched (see above)
+static
+int trie_fuzzy_found(struct _trie_fuzzy * s, int len, int dist) {
+    int alloc = s->found.alloc, sum;
+
+    trie_keys_add(&(s->found), trie_arr_data(&(s->key)), len);
+    if (s->found.alloc != alloc) { // Follows lens
+        s->found_dists = realloc(s->found_dists, (s->found.alloc)*sizeof*(s->found_dists));
+        assert(s->found_dists);
+    }
+    s->found_dists[s->found.num - 1] = dist;
+    if (dist >= s->counts_alloc) {
+        alloc = s->counts_alloc;
+        s->counts_alloc = 2*(dist + 1);
+        s->counts = realloc(s->counts, (s->counts_alloc)*sizeof*(s->counts));
+        assert(s->counts);
+        memset(s->counts + alloc, 0, (s->counts_alloc - alloc)*sizeof*(s->counts));
+    }
+    s->counts[dist]++;
+
+    sum = 0;
+    for (dist = 0; (dist <= s->dist) && (dist < s->counts_alloc); dist++) {
+        sum += s->counts[dist];
+        if (sum >= s->max) { // Only closer keys may still be taken
+            s->dist = dist - 1;
+            break;
+        }
+    }
+    return (s->dist < 0)?TRIE_SCAN_STOP:TRIE_SCAN_GO_ON;
+}
+
+// t must be readlocked, and it is left locked. Keys of t start with the first depth symbols of key
+static
+int trie_fuzzy_helper(struct _trie * t, struct _trie_fuzzy * s, int depth) {
+    int i, res;
+    struct _trie * next;
+    DATA_t first;
+
+    for (i = 0; i < trie_data_len(t); i++) // Node data
+        if (trie_fuzzy_push(s, depth + i, trie_data(t)[i]) > s->dist)
+            return TRIE_SCAN_GO_ON; // Nothing close enough here
+    trie_arr_substitute_end(&(s->key), depth, trie_data(t), trie_data_len(t)); // Appends node data
+    depth += trie_data_len(t);
+
+    if (trie_data_end(t) && (s->rows[depth*(s->len + 1) + s->len] <= s->dist) && // Found
+        (trie_fuzzy_found(s, depth, s->rows[depth*(s->len + 1) + s->len]) == TRIE_SCAN_STOP))
+        return TRIE_SCAN_STOP;
+
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        first = trie_get_first(t, i);
+        if (trie_fuzzy_push(s, depth, first) > s->dist)
+            continue; // Prunes the whole child
+        next = trie_get_child(t, i);
+        trie_arr_substitute_end(&(s->key), depth, &first, 1); // adds the first character
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        res = trie_fuzzy_helper(next, s, depth + 1);
+        trie_unlock(&(next->lock));
+        if (res == TRIE_SCAN_STOP)
+            return TRIE_SCAN_STOP;
+    }
+    return TRIE_SCAN_GO_ON;
+}
+
+int trie_fuzzy_find(trie_ptr_t t, const DATA_t * arr, int len, int max_dist,
+                    trie_keys_t * keys, int * dists, int max) {
+    struct _trie_fuzzy s;
+    int i, j, dist, offset;
+
+    if ((t == NULL) || (keys == NULL) || (max <= 0) || (max_dist < 0))
+        return 0; // Invalid ptr, or nothing to do
+
+    s.arr = arr;
+    s.len = len;
+    s.rows_alloc = 16;
+    s.rows = malloc((s.rows_alloc)*(len + 1)*sizeof*(s.rows));
+    assert(s.rows);
+    for (j = 0; j <= len; j++) // Empty key, inserts every symbol
+        s.rows[j] = j;
+    trie_arr_init(&(s.key));
+    trie_keys_init(&(s.found));
+    s.found_dists = NULL;
+    s.counts = NULL;
+    s.counts_alloc = 0;
+    s.dist = max_dist;
+    s.max = max;
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    trie_fuzzy_helper(t, &s, 0);
+    trie_unlock(&(t->lock));
+
+    keys->num = 0; // Overwrites old keys, keeps the memory
+    trie_arr_len(&(keys->data)) = 0;
+    for (dist = 0; (dist < s.counts_alloc) && (keys->num < max); dist++) { // Closest first
+        if (s.counts[dist] == 0)
+            continue;
+        for (i = offset = 0; (i < s.found.num) && (keys->num < max); offset += s.found.lens[i++]) {
+            if (s.found_dists[i] != dist)
+                continue;
+            if (dists != NULL)
+                dists[keys->num] = dist;
+            trie_keys_add(keys, trie_arr_data(&(s.found.data)) + offset, s.found.lens[i]);
+        }
+    }
+
+    free(s.rows);
+    free(s.found_dists);
+    free(s.counts);
+    trie_keys_clear(&(s.found));
+    trie_arr_clear(&(s.key));
+    return keys->num;
+}
+
+// ============================
+// ===  TRIE PATTERN MATCH  ===
+// ============================
+
+/*
+   Pattern is compiled in tokens, then matched as a non deterministic automaton: the state
+   is the set of tokens reached, one set for each symbol of the key being built, as in
+   trie_fuzzy_find. A subtree is pruned when the set becomes empty, and when the only token
+   reached is a literal the child is searched in firsts, instead of trying every child.
+   Syntax:  ?  any symbol
+            *  any sequence, also empty
+            [abc] [a-z] [!a-z] [^a-z]  symbol in (not in) the class. ']' first is a literal
+            \  next symbol is a literal, also inside classes
+*/
+
+#define TRIE_TOKEN_LITERAL 0
+#define TRIE_TOKEN_ANY     1
+#define TRIE_TOKEN_STAR    2
+#define TRIE_TOKEN_CLASS   3
+
+struct _trie_token {
+    int type;
+    DATA_t literal;
+    int begin, end; // Class items in the pattern
+    int negated; // Class
+};
+
+struct _trie_pattern {
+    const DATA_t * pattern;
+    struct _trie_token * tokens;
+    int token_num;
+    char * states; // (token_num + 1) flags for each symbol in key
+    int states_alloc; // Number of allocated sets
+    trie_arr_t key; // Key built while descending
+    trie_scan_callback_t callback;
+    void * ctx;
+    int found;
+};
+
+// Returns the number of tokens, or FAIL for malformed patterns
+static
+int trie_pattern_compile(const DATA_t * pattern, int len, struct _trie_token * tokens) {
+    int i, num;
+
+    num = 0;
+    for (i = 0; i < len; i++, num++) {
+        tokens[num].type = TRIE_TOKEN_LITERAL;
+        tokens[num].literal = pattern[i];
+        if (pattern[i] == '?') {
+            tokens[num].type = TRIE_TOKEN_ANY;
+        } else if (pattern[i] == '*') {
+            tokens[num].type = TRIE_TOKEN_STAR;
+        } else if (pattern[i] == '\\') {
+            if (++i == len)
+                return FAIL; // Nothing to escape
+            tokens[num].literal = pattern[i];
+        } else if (pattern[i] == '[') {
+            tokens[num].type = TRIE_TOKEN_CLASS;
+            tokens[num].negated = (i + 1 < len) && ((pattern[i + 1] == '!') || (pattern[i + 1] == '^'));
+            i += 1 + tokens[num].negated;
+            tokens[num].begin = i;
+            if ((i < len) && (pattern[i] == ']')) // Literal
+                i++;
+            for (; (i < len) && (pattern[i] != ']'); i++)
+                if (pattern[i] == '\\')
+                    i++; // Skips the escaped symbol
+            if (i >= len)
+                return FAIL; // Class not closed
+            tokens[num].end = i;
+        }
+    }
+    return num;
+}
+
+static inline
+int trie_token_class_match(const DATA_t * pattern, const struct _trie_token * token, DATA_t symbol) {
+    int i;
+    DATA_t from, to;
+
+    for (i = token->begin; i < token->end; i++) {
+        if ((pattern[i] == '\\') && (i + 1 < token->end))
+            i++;
+        from = to = pattern[i];
+        if ((i + 2 < token->end) && (pattern[i + 1] == '-')) { // Range
+            i += 2;
+            if ((pattern[i] == '\\') && (i + 1 < token->end))
+                i++;
+            to = pattern[i];
+        }
+        if ((from <= symbol) && (symbol <= to))
+            return !(token->negated);
+    }
+    return token->negated;
+}
+
+// Adds tokens reachable without consuming symbols, i.e. skipping stars
+static inline
+void trie_pattern_closure(const struct _trie_pattern * s, char * states) {
+    int i;
+    for (i = 0; i < s->token_num; i++)
+        if (states[i] && (s->tokens[i].type == TRIE_TOKEN_STAR))
+            states[i + 1] = 1;
+}
+
+// Computes the set depth + 1 adding symbol to the key, returns 0 if it is empty
+static inline
+int trie_pattern_push(struct _trie_pattern * s, int depth, DATA_t symbol) {
+    int i, match, any;
+    char * old, * new;
+
+    if (depth + 2 > s->states_alloc) { // Doubles
+        s->states_alloc = 2*(depth + 2);
+        s->states = realloc(s->states, (s->states_alloc)*(s->token_num + 1));
+        assert(s->states);
+    }
+    old = s->states + depth*(s->token_num + 1);
+    new = old + (s->token_num + 1);
+
+    memset(new, 0, s->token_num + 1);
+    for (i = 0; i < s->token_num; i++) {
+        if (!old[i])
+            continue;
+        switch (s->tokens[i].type) {
+            case TRIE_TOKEN_LITERAL: match = (s->tokens[i].literal == symbol); break;
+            case TRIE_TOKEN_STAR: new[i] = 1; match = 0; break; // Consumes it, stays there
+            case TRIE_TOKEN_CLASS: match = trie_token_class_match(s->pattern, s->tokens + i, symbol); break;
+            default: match = 1; break; // Any symbol
+        }
+        if (match)
+            new[i + 1] = 1;
+    }
+    trie_pattern_closure(s, new);
+
+    any = 0;
+    for (i = 0; i <= s->token_num; i++)
+        any |= new[i];
+    return any;
+}
+
+// If the only token reached is a literal returns its position, otherwise -1
+static inline
+int trie_pattern_only_literal(const struct _trie_pattern * s, const char * states) {
+    int i, pos;
+
+    pos = -1;
+    for (i = 0; i <= s->token_num; i++) {
+        if (!states[i])
+            continue;
+        if ((pos >= 0) || (i == s->token_num) || (s->tokens[i].type != TRIE_TOKEN_LITERAL))
+            return -1;
+        pos = i;
+    }
+    return pos;
+}
+
+// t must be readlocked, and it is left locked. Keys of t start with the first depth symbols of key
+static
+int trie_pattern_helper(struct _trie * t, struct _trie_pattern * s, int depth) {
+    int i, res, begin, end, literal;
+    struct _trie * next;
+    DATA_t first;
+
+    for (i = 0; i < trie_data_len(t); i++) // Node data
+        if (!trie_pattern_push(s, depth + i, trie_data(t)[i]))
+            return TRIE_SCAN_GO_ON; // Nothing matches here
+    trie_arr_substitute_end(&(s->key), depth, trie_data(t), trie_data_len(t)); // Appends node data
+    depth += trie_data_len(t);
+
+    if (trie_data_end(t) && s->states[depth*(s->token_num + 1) + s->token_num]) { // Whole pattern matched
+        s->found++;
+        if (s->callback(trie_arr_data(&(s->key)), depth, s->ctx))
+            return TRIE_SCAN_STOP;
+    }
+
+    begin = 0;
+    end = trie_get_child_num(t);
+    literal = trie_pattern_only_literal(s, s->states + depth*(s->token_num + 1));
+    if ((literal >= 0) && (end > 0)) { // Only one child can match
+        if (!trie_search_in_childs(&begin, &(t->childs), s->tokens[literal].literal))
+            return TRIE_SCAN_GO_ON;
+        end = begin + 1;
+    }
+    for (i = begin; i < end; i++) {
+        first = trie_get_first(t, i);
+        if (!trie_pattern_push(s, depth, first))
+            continue; // Prunes the whole child
+        next = trie_get_child(t, i);
+        trie_arr_substitute_end(&(s->key), depth, &first, 1); // adds the first character
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        res = trie_pattern_helper(next, s, depth + 1);
+        trie_unlock(&(next->lock));
+        if (res == TRIE_SCAN_STOP)
+            return TRIE_SCAN_STOP;
+    }
+    return TRIE_SCAN_GO_ON;
+}
+
+int trie_match_pattern(trie_ptr_t t, const DATA_t * pattern, int len,
+                       trie_scan_callback_t callback, void * ctx) {
+    struct _trie_pattern s;
+
+    if ((t == NULL) || (callback == NULL) || (len < 0))
+        return 0; // Invalid ptr
+
+    s.pattern = pattern;
+    s.tokens = malloc((len + 1)*sizeof*(s.tokens)); // At most one for each symbol
+    assert(s.tokens);
+    s.token_num = trie_pattern_compile(pattern, len, s.tokens);
+    if (s.token_num == FAIL) { // Malformed pattern
+        free(s.tokens);
+        return FAIL;
+    }
+    s.states_alloc = 16;
+    s.states = malloc((s.states_alloc)*(s.token_num + 1));
+    assert(s.states);
+    memset(s.states, 0, s.token_num + 1);
+    s.states[0] = 1; // Empty key, at the beginning of the pattern
+    trie_pattern_closure(&s, s.states);
+    trie_arr_init(&(s.key));
+    s.callback = callback;
+    s.ctx = ctx;
+    s.found = 0;
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    trie_pattern_helper(t, &s, 0);
+    trie_unlock(&(t->lock));
+
+    free(s.tokens);
+    free(s.states);
+    trie_arr_clear(&(s.key));
+    return s.found;
+}
+
+//  ============================
+//  ==== TRIE FINGER SEARCH ====
+//  ============================
+
+// Path of the previous key, readlocked only within trie_find_sorted: nodes may change or go
+// away as soon as it returns
+typedef struct {
+    trie_ptr_t trie;
+    struct _trie ** path; // Readlocked nodes, from the root
+    int * offsets; // Where data of each node begins in the key
+    int depth, alloc;
+    trie_arr_t key; // Previous key
+} trie_finger_t;
+
+static
+void trie_finger_init(trie_finger_t * f, trie_ptr_t t) {
+    f->trie = t;
+    f->path = NULL;
+    f->offsets = NULL;
+    f->depth = f->alloc = 0;
+    trie_arr_init(&(f->key));
+}
+
+// Releases the path, deepest node first
+static
+void trie_finger_clear(trie_finger_t * f) {
+    for (; f->depth > 0; f->depth--) // N.B. without pthread trie_unlock does not evaluate its argument
+        trie_unlock(&(f->path[f->depth - 1]->lock));
+    free(f->path);
+    free(f->offsets);
+    trie_arr_clear(&(f->key));
+    trie_finger_init(f, f->trie);
+}
+
+static inline
+void trie_finger_push(trie_finger_t * f, struct _trie * node, int offset) {
+    if (f->depth == f->alloc) { // Doubles
+        f->alloc = (f->alloc == 0)?16:(2*f->alloc);
+        f->path = realloc(f->path, (f->alloc)*sizeof*(f->path));
+        f->offsets = realloc(f->offsets, (f->alloc)*sizeof*(f->offsets));
+        assert(f->path && f->offsets);
+    }
+    f->path[f->depth] = node;
+    f->offsets[f->depth] = offset;
+    f->depth++;
+}
+
+// Nodes of the last path are kept readlocked. Each lookup goes back up only to the node
+// where arr leaves the previous key, and descends from there
+static
+int trie_finger_find(trie_finger_t * f, const DATA_t * arr, int len) {
+    int mismatch, common, offset;
+    int a_id, b_id;
+    struct _trie * cur, * next;
+
+    if (f->depth == 0) { // First lookup
+        trie_readlock(&(f->trie->lock)); // locks root trie read mutex
+        trie_finger_push(f, f->trie, 0);
+    } else { // Child i is still valid if arr has the symbol leading to it, offsets[i] - 1
+        common = find_first_mismatch(arr, len, trie_arr_data(&(f->key)), trie_arr_len(&(f->key)));
+        for (; (f->depth > 1) && (f->offsets[f->depth - 1] > common); f->depth--)
+            trie_unlock(&(f->path[f->depth - 1]->lock));
+    }
+    trie_arr_substitute_end(&(f->key), 0, arr, len); // Next lookup compares with this one
+
+    cur = f->path[f->depth - 1];
+    offset = f->offsets[f->depth - 1];
+    if ((f->depth == 1) && trie_is_empty(cur))
+        return 0; // Empty trie
+    while (1) {
+        mismatch = find_first_mismatch(arr + offset, len - offset, trie_data(cur), trie_data_len(cur));
+        if (mismatch < trie_data_len(cur)) // Mismatch inside data
+            return 0;
+        if (offset + mismatch == len) // Reached end of data, and end of node
+            return trie_data_end(cur);
+        a_id = trie_search_in_childs(&b_id, &(cur->childs), arr[offset + mismatch]); // Binary search in child nodes
+        if (!a_id)
+            return 0;
+        next = trie_get_child(cur, b_id);
+        trie_readlock(&(next->lock)); // Parent stays locked, it is part of the path
+        offset += mismatch + 1;
+        trie_finger_push(f, next, offset);
+        cur = next;
+    }
+}
+
+int trie_find_sorted(trie_ptr_t t, const DATA_t * const * keys, const int * lens, int num, int * found) {
+    trie_finger_t f;
+    int i, res;
+
+    if ((t == NULL) || (keys == NULL) || (lens == NULL))
+        return 0; // Invalid ptr
+    trie_finger_init(&f, t);
+    res = 0;
+    for (i = 0; i < num; i++) {
+        if (trie_finger_find(&f, keys[i], lens[i])) {
+            res++;
+            if (found != NULL)
+                found[i] = 1;
+        } else if (found != NULL) {
+            found[i] = 0;
+        }
+    }
+    trie_finger_clear(&f);
+    return res;
+}
+
+//  ============================
+//  ====  TRIE PREFIX CURSOR ===
+//  ============================
+
+/*
+   The cursor walks the subtree of the prefix node depth first, as trie_foreach, with the path
+   readlocked during a call. Before returning it stamps the path with the generation of each node,
+   taking a new generation if one of them has the current one: changes made afterwards give a
+   different stamp (see trie_touch). The next call locks the path again from the root, each node is
+   still a child of the one above while that one has the same stamp. If a stamp differs the path is
+   dropped, and the cursor seeks the first key after the current one.
+*/
+
+int trie_cursor_init(trie_cursor_t * c, trie_ptr_t t, const DATA_t * prefix, int len) {
+    if ((c == NULL) || (t == NULL) || ((prefix == NULL) && (len > 0)))
+        return FAIL; // Invalid ptr
+    c->trie = t;
+    c->started = 0;
+    c->prefix_len = len;
+    trie_arr_init(&(c->key));
+    if (len > 0)
+        trie_arr_substitute_end(&(c->key), 0, prefix, len);
+    c->path = NULL;
+    c->depth = c->path_alloc = 0;
+    c->base = -1;
+    return SUCCESS;
+}
+
+// node is readlocked, its data begins at offset in the key
+static inline
+void trie_cursor_push(trie_cursor_t * c, struct _trie * node, int offset) {
+    if (c->depth == c->path_alloc) { // Doubles
+        c->path_alloc = (c->path_alloc == 0)?16:(2*c->path_alloc);
+        c->path = realloc(c->path, (c->path_alloc)*sizeof*(c->path));
+        assert(c->path);
+    }
+    c->path[c->depth].node = node;
+    c->path[c->depth].child = 0;
+    c->path[c->depth].offset = offset;
+    c->depth++;
+}
+
+// Unlocks the path, from the bottom, and drops it
+static inline
+void trie_cursor_unlock(trie_cursor_t * c) {
+    for (c->depth--; c->depth >= 0; c->depth--)
+        trie_unlock(&(c->path[c->depth].node->lock));
+    c->depth = 0;
+}
+
+// Stamps the path, then unlocks it but keeps it for the next call (see above)
+static inline
+void trie_cursor_leave(trie_cursor_t * c) {
+    int i, gen;
+
+    gen = 0;
+    for (i = 0; i < c->depth; i++) {
+        c->path[i].gen = trie_get_gen(c->path[i].node);
+        if (c->path[i].gen > gen)
+            gen = c->path[i].gen;
+    }
+    if (gen >= trie_atomic_load_sc(&trie_generation)) // Later changes take a newer one
+        trie_atomic_add_sc(&trie_generation, 1);
+    for (i = c->depth - 1; i >= 0; i--)
+        trie_unlock(&(c->path[i].node->lock));
+}
+
+// Locks the path again. Returns 0, with nothing locked, if a node changed
+static inline
+int trie_cursor_resume(trie_cursor_t * c) {
+    int i;
+
+    for (i = 0; i < c->depth; i++) {
+        trie_readlock(&(c->path[i].node->lock)); // The one above did not change, so it is still there
+        if (trie_get_gen(c->path[i].node) != c->path[i].gen) {
+            c->depth = i + 1;
+            trie_cursor_unlock(c);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Goes on depth first from the top of the path, to the next node where a key ends.
+// Returns 0 once the prefix node was visited, the path stays locked
+static
+int trie_cursor_step(trie_cursor_t * c) {
+    struct _trie_cursor_item * top;
+    struct _trie * next;
+    int offset;
+
+    while (1) {
+        top = c->path + c->depth - 1;
+        while (top->child == trie_get_child_num(top->node)) { // Goes up
+            if (c->depth - 1 == c->base)
+                return 0; // Every key with the prefix visited
+            trie_unlock(&(top->node->lock));
+            c->depth--;
+            top--;
+        }
+        offset = top->offset + trie_data_len(top->node); // Truncates the key after the node data
+        trie_arr_substitute_end(&(c->key), offset, &(trie_get_first(top->node, top->child)), 1);
+        next = trie_get_child(top->node, top->child);
+        top->child++;
+        trie_readlock(&(next->lock)); // Parent stays locked
+        trie_cursor_push(c, next, offset + 1);
+        trie_arr_substitute_end(&(c->key), offset + 1, trie_data(next), trie_data_len(next));
+        if (trie_data_end(next))
+            return 1;
+    }
+}
+
+// Single descent to the first key >= the current one (> if gt) with the prefix, building the path.
+// Returns 1 if found, with the path locked, otherwise 0 with nothing locked
+static
+int trie_cursor_seek(trie_cursor_t * c, int gt) {
+    struct _trie * cur, * next;
+    DATA_t * arr;
+    int len, offset, mismatch, found, pos, res;
+
+    // The key is rewritten while going down, so the search uses a copy
+    len = trie_arr_len(&(c->key));
+    arr = malloc((len + 1)*sizeof(DATA_t));
+    if (arr == NULL)
+        return 0;
+    memcpy(arr, trie_arr_data(&(c->key)), len*sizeof(DATA_t));
+
+    c->depth = 0;
+    c->base = -1;
+    cur = c->trie;
+    trie_readlock(&(cur->lock));
+    trie_cursor_push(c, cur, 0);
+    if (trie_is_empty(cur) && !trie_data_end(cur)) { // Empty trie
+        res = 0;
+    } else {
+        offset = 0;
+        while (1) { // cur is the top of the path, its data starts at offset in arr
+            mismatch = find_first_mismatch(arr + offset, len - offset, trie_data(cur), trie_data_len(cur));
+            if ((c->base < 0) && (offset + trie_data_len(cur) >= c->prefix_len)) {
+                if (offset + mismatch < c->prefix_len) {
+                    res = 0; // The prefix is not stored
                     break;
                 }
-            } else if (mismatch == trie_data.len) { // Middle of the data, data stored is longer
-                // Suffix will be made with a part of the current data, and the childs data
-                assert(mismatch < trie_data_len(cur));
-                if (trie_get_child_num(cur) == 0) assert(trie_data_end(cur)); // Debug purpose
-                tmp_len = trie_data_len(cur) - mismatch;
-                
-                if (!trie_iterator_first_iterator(iterator)) { // Compares the beginning of the data
-                    if (trie_iterator_data_len(iterator) < tmp_len) // If iterator data is less
-                        tmp_len = trie_iterator_data_len(iterator); // Must choose the shorter one
-                    retval = memcmp(trie_iterator_data(iterator), trie_data(cur) + mismatch,
-                                    tmp_len*sizeof(*trie_data(cur))); // Uses memcpy as comparator
-                    // Restores tmp_len
-                    tmp_len = trie_data_len(cur) - mismatch;
-                    
-                    if ((retval == 0) && (trie_iterator_data_len(iterator) < tmp_len)) { // Exact match
-                        retval = -1; // Shorter data comes before, use the first algorithm
-                    } else if (retval > 0) { // got over the rest of the data, skips
-                        trie_iterator_clear(iterator); // This sets as last iterator (i.e. the NULL iterator)
-                        retval = 0; // Might not go on, retval might lead to executing other things
-                        break; // Returns a not found, as usual
-                    }
-                } else { // This is the first iterator
-                    retval = -1; // Forces execution of first al
-                }
-
-                // if never got here, or first useful data here is after the iterator, then must choose the
-                if (trie_iterator_first_iterator(iterator) || (retval < 0)) { //      first possible iterator
-                    if (trie_iterator_first_iterator(iterator)) // First time here, must use the iterator
-                        trie_iterator_use_iterator(iterator); // This way does not execute this code next time
-                    // Adds at the beginning the remaining part of the data (beginning of the first possible iter)
-                    trie_iterator_substitute_end(iterator, 0, trie_data(cur) + mismatch, tmp_len);
-                    
-                    if (!trie_data_end(cur)) { // Data does not ends with this node
-                        assert(trie_get_child_num(cur) >= 2); // Must have at least two childs
-                        trie_readlock(&(trie_get_child(cur, 0)->lock)); // Readlocks next first child
-                        trie_iterator_substitute_end(iterator, tmp_len, &trie_get_first(cur, 0), 1); // only one character
-                        trie_get_first_iterator(trie_get_child(cur, 0), iterator, tmp_len + 1); // Auto unlocks
-                    } else {} // Data ends with this node, this is the first iterator (the shorter one)
-                    retval = 1; // In either case it is found an iterator
-                } else { // Normal, retval == 0 (i.e. beginning of the data matches)
-                    // Now searches in childs from wich to start
-                    if (trie_iterator_data_len(iterator) == tmp_len) // No data after this node
-                        a_id = b_id = 0; // Starts from the first child (NOTE: it might not exist, see after)
-                    else // Does a binary search for the first data inside childs
-                        a_id = trie_search_in_childs(&b_id, &(cur->childs), trie_iterator_data(iterator)[tmp_len]);
-                    
-                    if (b_id >= trie_get_child_num(cur)) { // Reached the end, sets the iterator to null
-                        retval = 0; // This forces clearing iterator (next)
-                    } else { // Normal case
-                        trie_readlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks the child we are going to use
-                        if (!a_id) { // If not found needs to substitute, and restart from a first iterator
-                            trie_iterator_substitute_end(iterator, tmp_len, &trie_get_first(cur, b_id), 1); // only one character
-                            trie_get_first_iterator(trie_get_child(cur, b_id), iterator, tmp_len + 1); // Gets next iterator from this root
-                            retval = 1;
-                        } else {
-                            retval = trie_next_iterator_helper(trie_get_child(cur, b_id), iterator, tmp_len + 1); // Gets next iterator from this root
-                            trie_unlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks next.
-                        }
-
-                        if ((retval == 0) && (++b_id < trie_get_child_num(cur))) { // If not found and can move to next data
-                            trie_readlock(&(trie_get_child(cur, b_id)->lock)); // Readlocks the child we are going to use
-                            trie_iterator_substitute_end(iterator, tmp_len, &trie_get_first(cur, b_id), 1); // only one character
-                            trie_get_first_iterator(trie_get_child(cur, b_id), iterator, tmp_len + 1); // Gets next iterator from this root
-                            // Mutex is auto unlocked
-                            retval = 1; // Ignores next iterator result. Even the first character added is a good solution!
-                        }
-                    }
+                c->base = c->depth - 1;
+            }
+            if ((mismatch == trie_data_len(cur)) && (mismatch < len - offset)) { // Goes on with a child
+                found = trie_search_in_childs(&pos, &(cur->childs), arr[offset + mismatch]);
+                c->path[c->depth - 1].child = found?(pos + 1):pos;
+                if (found) {
+                    next = trie_get_child(cur, pos);
+                    trie_readlock(&(next->lock)); // Parent stays locked
+                    offset += mismatch + 1;
+                    trie_cursor_push(c, next, offset);
+                    cur = next;
+                    continue;
                 }
-                
-                if (retval == 0) // Reached last element
-                    trie_iterator_clear(iterator);
-                
+                res = (c->base < 0)?0:trie_cursor_step(c); // Every child after arr, if any
                 break;
-            } else { // Both mismatches in the middle of the data, part of the input data does not matches, no iterator is possible
-                assert(mismatch < trie_data_len(cur));
-                assert(mismatch < trie_data.len);
-                retval = 0; break;
             }
-            assert(0);
-            __builtin_unreachable();
-        } // end while
+            if (c->base < 0) {
+                res = 0; // Diverges from arr before the prefix ends
+                break;
+            }
+            trie_arr_substitute_end(&(c->key), offset, trie_data(cur), trie_data_len(cur));
+            if (mismatch == len - offset) { // arr ends here: cur is arr, or greater if longer
+                if (((mismatch < trie_data_len(cur)) || !gt) && trie_data_end(cur))
+                    res = 1;
+                else
+                    res = trie_cursor_step(c);
+            } else if (trie_data_compare(trie_data(cur) + mismatch, arr + offset + mismatch, 1) > 0) {
+                res = trie_data_end(cur) || trie_cursor_step(c); // The whole subtree is after arr
+            } else { // The whole subtree is before arr
+                c->path[c->depth - 1].child = trie_get_child_num(cur);
+                res = trie_cursor_step(c);
+            }
+            break;
+        }
+    }
+    if (res == 0)
+        trie_cursor_unlock(c);
+    free(arr);
+    return res;
+}
+
+// The first key >= prefix, then the next one on the path, as long as they start with prefix
+int trie_cursor_next(trie_cursor_t * c) {
+    int res;
+
+    if ((c == NULL) || (c->trie == NULL))
+        return 0; // Invalid ptr, or reached the end
+    if ((c->depth > 0) && trie_cursor_resume(c)) {
+        res = trie_cursor_step(c);
+        if (res == 0)
+            trie_cursor_unlock(c);
+    } else {
+        res = trie_cursor_seek(c, c->started);
     }
+    c->started = 1;
+    if (res == 1) {
+        trie_cursor_leave(c);
+        return 1;
+    }
+    c->trie = NULL; // Past the keys starting with prefix
+    return 0;
+}
 
-    trie_unlock(&(cur->lock));
-    return retval;
+void trie_cursor_clear(trie_cursor_t * c) {
+    if (c == NULL)
+        return; // Invalid ptr
+    trie_arr_clear(&(c->key));
+    free(c->path);
+    c->path = NULL;
+    c->depth = c->path_alloc = 0;
+    c->trie = NULL;
 }
+
+// Parallel traversal
+#include "trie_parallel.c"
+
+// Aho-Corasick automaton
+#include "trie_aho.c"
+
+// Frozen tries
+#include "trie_louds.c"
+
+// Double array tries
+#include "trie_da.c"
+
+// Incremental checkpoints
+#include "trie_ckpt.c"
+
+// Write ahead log
+#include "trie_wal.c"
+
+// Flat combining writers
+#include "trie_combine.c"
+
+// Write optimized mode
+#include "trie_lsm.c"
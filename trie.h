@@ -1,42 +1,74 @@
 #ifndef TRIE_H
 #define TRIE_H
 
-typedef unsigned char DATA_t; // You may change this at your option
+#include <stdint.h> // uint8_t, uint16_t, uint32_t
+#include <stddef.h> // size_t
 
-#include <pthread.h> // mutex
-#include <stdint.h> // uint8_t
+// You may change this at your option, compile with -DTRIE_DATA_TYPE=uint16_t (or uint32_t)
+// to store arrays of wide symbols (i.e. token ids). Symbols are ordered numerically
+#ifndef TRIE_DATA_TYPE
+typedef unsigned char DATA_t;
+#else
+typedef TRIE_DATA_TYPE DATA_t;
+#endif
+
+// Compile with NO_PTHREAD for single thread usage: nodes will not contain any lock
+#ifndef NO_PTHREAD
+#    include <pthread.h> // mutex
+#endif
 #define USE_NOT_UPGRADABLE_MUTEX
 
 struct _trie; // Struct trie prototype
 
+// Compile with TRIE_COMPRESSED_REFS to address childs and node data with 32 bit references instead
+// of pointers: nodes come from chunked pools (at most 2^32 - 1 of them), data from a 4GB pool
+#ifndef TRIE_COMPRESSED_REFS
+typedef struct _trie * trie_node_ref_t;
+typedef const DATA_t * trie_label_ref_t;
+#else
+typedef uint32_t trie_node_ref_t; // Index of the node, see trie_refs.c
+typedef uint32_t trie_label_ref_t; // Offset of the data in the pool
+#endif
+
+#ifndef NO_PTHREAD
 struct _rwlock {
     pthread_rwlock_t rwlock; // mutex for this object
+    int writers; // Waiting for rwlock, new operations let them go first (see trie_readlock)
 #ifndef USE_NOT_UPGRADABLE_MUTEX
     pthread_rwlock_t write_peeding; // util R/W mutex for who asks to write
     pthread_mutex_t upgrade; // rwlock mutex
 #endif
 };
+#endif
 
 struct _childs {
     int child_num; // number of child nodes
     int child_alloc; // Nmber of elements dynamically allocated
-    struct _trie ** childs; // Dynamic array of pointer to childs
+    trie_node_ref_t * childs; // Dynamic array of references to childs
     DATA_t * firsts; // Array of first objects
 };
 
 struct _data {
     int len; // lenght of data, excluding first. first is stored elsewhere
-    const DATA_t * data; // array of data
+    trie_label_ref_t data; // array of data, read it with trie_data
 
     // data flags
     uint8_t end: 1; // true if reached end of data
     uint8_t dealloc: 1; // true only if data is an allocated ptr
+    uint8_t allocator; // Allocator of the trie (see trie_init_with_allocator), meaningful in the root
 };
 
 struct _trie {
+#ifndef NO_PTHREAD
     struct _rwlock lock; // compact way of keeping lock stuff
+#endif
     struct _data data; // compact way of keeping data
+#ifdef TRIE_COMPRESSED_REFS
+    trie_node_ref_t ref; // Index of this node, it fits the padding
+#endif
     struct _childs childs; // again a compact way to write
+    int count; // Number of keys stored in this subtree, this node included
+    int gen; // Generation of the last change in this subtree, see trie_ckpt_write
 };
 typedef struct _trie trie_t;
 typedef struct _trie * trie_ptr_t;
@@ -52,15 +84,49 @@ typedef struct {
 
 // Init/destroy utilities
 void trie_init(trie_ptr_t t);
-void trie_clear(trie_ptr_t t); // deletes every element from the trie
+void trie_clear(trie_ptr_t t); // deletes every element from the trie, back to malloc
 
 void trie_arr_init(trie_arr_t * arr); // Inits a trie array
 void trie_arr_clear(trie_arr_t * arr); // Clears a trie array
 
+// Node memory from custom hooks, NULL ones are malloc, realloc and free. Each block has a small
+// header with its size, so live bytes are known. The allocator must outlive the trie, bytes of every
+// trie using it are summed: use one for each trie to account them separately
+typedef struct {
+    void * (*alloc)(void * ctx, size_t size);
+    void * (*realloc)(void * ctx, void * ptr, size_t size);
+    void (*free)(void * ctx, void * ptr);
+    void * ctx; // Passed to the hooks
+    long long limit; // Live bytes allowed, 0 for no limit. trie_add fails instead of going over it
+    long long live; // Bytes allocated now, see trie_mem_used
+    long long reserved; // Taken by insertions in progress
+} trie_allocator_t;
+void trie_allocator_init(trie_allocator_t * allocator); // malloc, no limit
+// As trie_init, node memory comes from allocator until trie_clear. Returns FAIL if 255 allocators are in use
+int trie_init_with_allocator(trie_ptr_t t, trie_allocator_t * allocator);
+long long trie_mem_used(trie_ptr_t t); // Live bytes of the allocator of t, -1 if it has none
+
 // Trie utils
-void trie_add(trie_ptr_t t, const DATA_t * arr, int len); // adds an elemente to the trie
+// adds an elemente to the trie. Returns FAIL on invalid ptr, or if the memory limit is reached: nothing is added then
+int trie_add(trie_ptr_t t, const DATA_t * arr, int len);
+void trie_remove(trie_ptr_t t, const DATA_t * arr, int len); // removes an element from the trie, unless out of memory
+// Removes every key starting with prefix, returns how many, or FAIL if out of memory. Nodes are freed by a background thread
+int trie_remove_prefix(trie_ptr_t t, const DATA_t * prefix, int len);
+void trie_reaper_flush(void); // Waits until every removed node is freed
 int trie_find(trie_ptr_t t, const DATA_t * arr, int len); // searches for an element in the trie
                                                           // returns 1 if it exist, otherwise 0
+// Lenght of the longest key stored which is a prefix of arr, or -1 if there is none
+int trie_longest_prefix(trie_ptr_t t, const DATA_t * arr, int len);
+// Same as above for n arrays, res[i] is the result for arrs[i]. Root node is locked only once
+void trie_longest_prefix_batch(trie_ptr_t t, const DATA_t * const * arrs, const int * lens, int * res, int n);
+
+// Counting utilities, each one runs in O(depth)
+int trie_count(trie_ptr_t t); // Number of keys stored
+int trie_count_prefix(trie_ptr_t t, const DATA_t * arr, int len); // Number of keys starting with arr
+int trie_rank(trie_ptr_t t, const DATA_t * arr, int len); // Number of keys before arr (in sorted order)
+int trie_select(trie_ptr_t t, int k, trie_arr_t * key); // Copies the k-th key (from 0) into key.
+                                                        // returns 1 if it exist, otherwise 0
+
 #define TRIE_SUFFIX_FOUND     0 // Normal return value
 #define TRIE_NO_SUFFIX_FOUND  1 // Base for the suffix was not found
 #define TRIE_MULTIPLE_SUFFIX -1 // Found more than one suffix
@@ -74,6 +140,112 @@ void trie_iterator_init(trie_iterator_t * iterator);
 void trie_iterator_clear(trie_iterator_t * iterator);
 int trie_iterator_next(trie_ptr_t t, trie_iterator_t * iterator); // 1 if success, 0 if reached the end
 int trie_suffix_iterator_next(trie_ptr_t t, trie_arr_t trie_data, trie_iterator_t * iterator);
+// Seek: moves the iterator to the first key >= arr (ge), > arr (gt), or to the last key <= arr (le),
+// < arr (lt), with a single descent. 1 if found, 0 otherwise (iterator cleared, as at the end).
+// trie_iterator_next and trie_iterator_prev go on from there
+int trie_iterator_seek_ge(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len);
+int trie_iterator_seek_gt(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len);
+int trie_iterator_seek_le(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len);
+int trie_iterator_seek_lt(trie_ptr_t t, trie_iterator_t * iterator, const DATA_t * arr, int len);
+int trie_iterator_prev(trie_ptr_t t, trie_iterator_t * iterator); // Backwards, the first call gets the last key
+
+// Range scan: passes keys in [lo, hi) to callback, in sorted order. A NULL bound is unbounded.
+// callback returns nonzero to stop. Only the path to the current key is readlocked, so
+// callback must not modify the trie. Returns the number of keys passed to callback
+typedef int (*trie_scan_callback_t)(const DATA_t * key, int len, void * ctx);
+int trie_scan(trie_ptr_t t, const DATA_t * lo, int lo_len, const DATA_t * hi, int hi_len,
+              trie_scan_callback_t callback, void * ctx);
+// Same as above, copies at most max keys one after the other in keys, lens[i] is the lenght
+// of the i-th key. Returns the number of keys copied
+int trie_scan_buffer(trie_ptr_t t, const DATA_t * lo, int lo_len, const DATA_t * hi, int hi_len,
+                     trie_arr_t * keys, int * lens, int max);
+
+// Visits every key once, in sorted order, with a single depth first pass. Same callback and
+// locking as trie_scan. Returns the number of keys visited
+int trie_foreach(trie_ptr_t t, trie_scan_callback_t callback, void * ctx);
+
+// Node seen by trie_foreach_node, key is valid only during the callback
+typedef struct {
+    const DATA_t * key; // Key up to the end of the node data
+    int len; // Lenght of the key
+    int data_len; // Lenght of the node data, included in key. The symbol before is the edge label
+    int depth; // Number of nodes above this one
+    int child_num; // Number of childs
+    int count; // Number of keys in the subtree
+    int end; // 1 if key is stored
+} trie_node_info_t;
+typedef int (*trie_node_callback_t)(const trie_node_info_t * node, void * ctx);
+// Same as above for every node, useful for structural analytics. Returns the number of nodes visited
+int trie_foreach_node(trie_ptr_t t, trie_node_callback_t callback, void * ctx);
+
+// Keys stored one after the other, lens[i] is the lenght of the i-th key
+typedef struct {
+    trie_arr_t data; // All the keys
+    int * lens; // dynamic array
+    int num; // Number of keys
+    int alloc; // Allocated lens
+} trie_keys_t;
+void trie_keys_init(trie_keys_t * keys);
+void trie_keys_clear(trie_keys_t * keys);
+
+// Approximate search. Copies in keys the stored keys within Levenshtein distance max_dist
+// from arr, closest first (then in sorted order), at most max. dists[i], if dists is not NULL,
+// is the distance of the i-th key. Returns the number of keys found
+int trie_fuzzy_find(trie_ptr_t t, const DATA_t * arr, int len, int max_dist,
+                    trie_keys_t * keys, int * dists, int max);
+
+// Passes to callback, in sorted order, the keys matching pattern: '?' is any symbol, '*' any
+// sequence, [a-z] a class ([!a-z] or [^a-z] negated), '\\' escapes the next symbol.
+// Same locking as trie_scan. Returns the number of keys matched, or FAIL for malformed patterns
+int trie_match_pattern(trie_ptr_t t, const DATA_t * pattern, int len,
+                       trie_scan_callback_t callback, void * ctx);
+
+// Parallel traversal. The trie is split in subtrees, of similar size (see trie_count), visited
+// by workers threads (0 means one for each cpu). callback is called concurrently by different workers,
+// worker is the index of the calling one. Returns the number of keys visited
+typedef int (*trie_parallel_callback_t)(const DATA_t * key, int len, int worker, void * ctx);
+int trie_foreach_parallel(trie_ptr_t t, int workers, trie_parallel_callback_t callback, void * ctx);
+// Same as above, copies every key in keys, in sorted order. Returns the number of keys
+int trie_collect_parallel(trie_ptr_t t, int workers, trie_keys_t * keys);
+// Stops the pool threads of the parallel traversals, waiting for the runs in progress.
+// Not from inside a callback. Later runs start them again
+void trie_parallel_shutdown(void);
+
+// Aho-Corasick automaton built from the keys of a trie, to find all of them inside a text
+// in a single pass. It is a copy, later changes of the trie are not seen
+struct _trie_aho_state {
+    int first; // First child, childs are contiguous
+    int child_num;
+    int fail; // Failure link
+    int dict; // Output link, -1 if none
+    int key; // Key ending here (position in sorted order, see trie_select), or -1
+    int depth; // Lenght of the key
+};
+typedef struct {
+    struct _trie_aho_state * states;
+    DATA_t * symbols; // symbols[s] leads to state s
+    int * root; // Transitions of the root for byte symbols
+    int state_num;
+} trie_aho_t;
+int trie_aho_build(trie_ptr_t t, trie_aho_t * aho); // Returns SUCCESS or FAIL
+void trie_aho_clear(trie_aho_t * aho);
+
+// Scanning state, text can be passed in many buffers
+typedef struct {
+    const trie_aho_t * aho;
+    int state;
+    int pending; // Matches not reported yet, when the callback stopped
+    long long offset; // Symbols read
+} trie_aho_scanner_t;
+// end is the offset after the match from the beginning of the text, len its lenght, key its
+// position in sorted order. Returns nonzero to stop
+typedef int (*trie_aho_callback_t)(long long end, int len, int key, void * ctx);
+void trie_aho_scanner_init(trie_aho_scanner_t * scanner, const trie_aho_t * aho);
+// Reads text passing every match to callback. If callback stops, the next call goes on from
+// the following match: text must then start after the symbols already read (see offset).
+// Returns the number of matches
+int trie_aho_scan(trie_aho_scanner_t * scanner, const DATA_t * text, int len,
+                  trie_aho_callback_t callback, void * ctx);
 
 #include <stdio.h> // File input/output
 // Both functions return SUCCESS in case of success, or FAIL in case of fail
@@ -81,6 +253,289 @@ int trie_suffix_iterator_next(trie_ptr_t t, trie_arr_t trie_data, trie_iterator_
 #define FAIL   -1
 int trie_fwrite(FILE * fp, trie_ptr_t t); // Writes binary data, readable by fread
 int trie_fread(FILE * fp, trie_ptr_t t); // Reads binary data produced by fwrite
-int trie_fread_merge(FILE * fp, trie_ptr_t t); // Reads and merges to an existing trie
+int trie_fread_merge(FILE * fp, trie_ptr_t t); // Reads and merges to an existing trie, FAIL at the memory limit
+
+
+// Frozen trie: read only copy, LOUDS encoded (a few bits for each node, plus its symbols)
+struct _trie_bits {
+    uint64_t * words;
+    uint32_t * ranks; // Rank samples
+    int len; // Bits
+};
+typedef struct {
+    struct _trie_bits louds; // Tree structure
+    struct _trie_bits label_ends; // Where data of each node ends
+    struct _trie_bits ends; // Keys ending in each node
+    DATA_t * firsts; // First symbol of each node
+    DATA_t * labels; // Data of each node
+    int node_num;
+    int label_len;
+} trie_louds_t;
+int trie_freeze(trie_ptr_t t, trie_louds_t * f); // Returns SUCCESS or FAIL
+void trie_louds_clear(trie_louds_t * f);
+size_t trie_louds_size(const trie_louds_t * f); // Bytes used
+// Same as trie_find, trie_get_suffix and trie_foreach for keys starting with prefix
+int trie_louds_find(const trie_louds_t * f, const DATA_t * arr, int len);
+int trie_louds_get_suffix(const trie_louds_t * f, const DATA_t * arr, int len, trie_arr_t * suffix);
+int trie_louds_foreach_prefix(const trie_louds_t * f, const DATA_t * prefix, int len,
+                              trie_scan_callback_t callback, void * ctx);
+int trie_louds_fwrite(FILE * fp, const trie_louds_t * f); // Return SUCCESS or FAIL, as trie_fwrite
+int trie_louds_fread(FILE * fp, trie_louds_t * f);
+
+// Double array trie: read only copy, each transition is O(1). Labels are kept in a tail
+struct _trie_da_unit {
+    int32_t base; // Childs are at base + symbol + 1
+    int32_t check; // Parent unit
+    int32_t tail; // Rest of the node data, offset in tail
+    int32_t info; // Tail length << 1 | key ends here
+};
+struct _trie_da_link { // Codes (symbol + 1) of the first child and of the next sibling, 0 if none
+    int32_t child;
+    int32_t sibling;
+};
+typedef struct {
+    const struct _trie_da_unit * units;
+    const struct _trie_da_link * links;
+    const DATA_t * tail;
+    int unit_num;
+    int tail_len;
+    size_t size; // Bytes of the memory image
+    void * mem; // Memory image, NULL if not owned (trie_da_map)
+} trie_da_t;
+int trie_da_build(trie_ptr_t t, trie_da_t * d); // Returns SUCCESS or FAIL, symbols up to 16 bits
+void trie_da_clear(trie_da_t * d);
+int trie_da_find(const trie_da_t * d, const DATA_t * arr, int len);
+int trie_da_foreach_prefix(const trie_da_t * d, const DATA_t * prefix, int len,
+                           trie_scan_callback_t callback, void * ctx);
+int trie_da_fwrite(FILE * fp, const trie_da_t * d); // Writes the memory image
+int trie_da_map(const void * mem, size_t size, trie_da_t * d); // Uses an image in memory (mmap of a file), no copy
+
+// NUMA placement of node memory. Compile with -DTRIE_NUMA (Linux only), otherwise memory
+// comes from malloc and only TRIE_NUMA_DEFAULT is accepted
+#define TRIE_NUMA_MAX_NODES 64
+#define TRIE_NUMA_DEFAULT    0 // Node of the thread allocating (first touch)
+#define TRIE_NUMA_INTERLEAVE 1 // Pages spread between all nodes
+#define TRIE_NUMA_SUBTREE    2 // Keys with the same first symbol stay on the same node
+int trie_numa_policy(int policy); // Returns SUCCESS or FAIL, set it before adding keys
+int trie_numa_nodes(void);
+
+// Huge pages for node memory. Compile with -DTRIE_HUGE_PAGES (or -DTRIE_NUMA), otherwise
+// only TRIE_PAGES_NORMAL is accepted
+#define TRIE_PAGES_NORMAL  0
+#define TRIE_PAGES_THP     1 // madvise(MADV_HUGEPAGE), default with TRIE_HUGE_PAGES
+#define TRIE_PAGES_HUGETLB 2 // MAP_HUGETLB, needs reserved huge pages, otherwise as TRIE_PAGES_THP
+int trie_huge_pages(int mode); // Returns SUCCESS or FAIL, applies to chunks mapped later
+typedef struct { // Chunks are 2MB, except large blocks
+    int chunks; // Chunks mapped
+    int hugetlb_chunks; // Mapped with MAP_HUGETLB
+    int thp_chunks; // Advised as transparent huge pages
+    int fallbacks; // Huge pages asked but not given
+    int large_blocks; // Chunks holding a single large block
+} trie_mem_stats_t;
+void trie_mem_stats(trie_mem_stats_t * stats);
+
+// Read replicas: one copy of the trie for each node, lookups use the one of the socket they run on.
+// Writes go to every replica, one at a time
+typedef struct {
+    trie_t ** replicas; // Memory of replica i is on node i
+    int num;
+#ifndef NO_PTHREAD
+    pthread_mutex_t write_lock;
+#endif
+} trie_replicated_t;
+int trie_replicated_init(trie_replicated_t * r, int replicas); // replicas <= 0 means one for each node
+void trie_replicated_clear(trie_replicated_t * r);
+int trie_replicated_add(trie_replicated_t * r, const DATA_t * arr, int len); // FAIL as trie_add, no replica changes
+void trie_replicated_remove(trie_replicated_t * r, const DATA_t * arr, int len);
+int trie_replicated_find(trie_replicated_t * r, const DATA_t * arr, int len);
+trie_ptr_t trie_replicated_local(trie_replicated_t * r); // Replica of this socket, only to read
+
+// Finger search: lookups in sorted (or clustered) order resume from the path of the previous key,
+// which stays readlocked until the call returns. Looks for num keys, better if sorted.
+// Sets found[i] (if not NULL), returns how many were found
+int trie_find_sorted(trie_ptr_t t, const DATA_t * const * keys, const int * lens, int num, int * found);
+
+// Prefix cursor: keys starting with a prefix, in sorted order (i.e. autocomplete). The path of the
+// current key is kept, with no lock held between calls: the next call goes on from it, or seeks again
+// from the key if a node of the path changed meanwhile (see the generation stamps of trie_touch).
+// Keys added or removed meanwhile are seen or not as with trie_iterator_next
+struct _trie_cursor_item { // A node of the path
+    struct _trie * node;
+    int gen; // Stamp when the call returned
+    int child; // Next child to visit
+    int offset; // Where node data begins in the key
+};
+typedef struct {
+    trie_ptr_t trie; // NULL once the end is reached
+    int started;
+    int prefix_len;
+    trie_arr_t key; // Current key, prefix included. The prefix before the first one
+    struct _trie_cursor_item * path; // From the root to the node where the key ends
+    int depth, path_alloc; // Nodes in the path, 0 when it must be sought again
+    int base; // Prefix node, the first of the path reaching past the prefix
+} trie_cursor_t;
+#define trie_cursor_key(c)        (c)->key.data
+#define trie_cursor_key_len(c)    (c)->key.len
+#define trie_cursor_suffix(c)     ((c)->key.data + (c)->prefix_len) // Key without the prefix
+#define trie_cursor_suffix_len(c) ((c)->key.len - (c)->prefix_len)
+// prefix is copied, len 0 visits every key. Returns SUCCESS or FAIL (invalid ptr)
+int trie_cursor_init(trie_cursor_t * c, trie_ptr_t t, const DATA_t * prefix, int len);
+int trie_cursor_next(trie_cursor_t * c); // 1 if success, 0 if reached the end
+void trie_cursor_clear(trie_cursor_t * c);
+
+// Incremental checkpoints: only subtrees changed since the previous checkpoint are written, the
+// others are references to it. Files are path.chain and path.N (POSIX only)
+typedef struct {
+    long long checkpoints;
+    long long bytes; // Written by checkpoints
+    long long last_bytes; // Size of the last one
+    long long nodes_written, refs_written; // Subtrees written and referenced
+    long long nodes_read; // Loaded by trie_ckpt_open
+    long long merges, merge_bytes;
+    int chain; // Checkpoints needed to load the last one
+} trie_ckpt_stats_t;
+typedef struct {
+    trie_ptr_t trie;
+    char * path;
+    int first, last; // Chain of checkpoints, the first one is full
+    int since; // Generation of the last checkpoint
+    int max_chain; // Longer chains are merged in background
+    int merging, merger_started;
+    trie_ckpt_stats_t stats;
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock, write_lock;
+    pthread_cond_t merged;
+    pthread_t merger;
+#endif
+} trie_ckpt_t;
+// Loads the last checkpoint of path in t, if any. Returns SUCCESS or FAIL
+int trie_ckpt_open(trie_ckpt_t * c, trie_ptr_t t, const char * path, int max_chain);
+void trie_ckpt_close(trie_ckpt_t * c); // Waits for the merge
+int trie_ckpt_write(trie_ckpt_t * c); // Writers may go on meanwhile
+int trie_ckpt_merge(trie_ckpt_t * c); // Rewrites the last checkpoint as a full one
+void trie_ckpt_stats(trie_ckpt_t * c, trie_ckpt_stats_t * stats);
+int trie_ckpt_remove(const char * path); // Removes the files
+
+// Write ahead log: trie_wal_* operations are applied, then logged (if applied), recovery loads the last
+// checkpoint and replays the log. Files are path.ckpt.*, path.log and path.log.old (POSIX only)
+#define TRIE_WAL_ASYNC 0 // Written every 64KB, lost with the process on a crash
+#define TRIE_WAL_BATCH 1 // Synced every sync_ms, lost on power failure within that time
+#define TRIE_WAL_SYNC  2 // Synced before returning, concurrent writers share the same sync (group commit)
+#define TRIE_WAL_STRIPES 64
+typedef struct {
+    int durability; // TRIE_WAL_*
+    int sync_ms; // TRIE_WAL_BATCH
+    long checkpoint_bytes; // Log size starting a checkpoint, <= 0 means only with trie_wal_checkpoint
+    int max_chain; // Incremental checkpoints merged in background when more
+} trie_wal_config_t;
+typedef struct {
+    long long records; // Logged
+    long long payload_bytes; // Bytes of the keys logged
+    long long log_bytes; // Bytes written to the log
+    long long syncs;
+    long long checkpoints;
+    long long checkpoint_bytes; // Bytes written to checkpoints
+    long long replayed; // Records replayed by the recovery
+    long long recovery_us; // Recovery time
+} trie_wal_stats_t;
+typedef struct {
+    trie_ptr_t trie;
+    char * path;
+    int fd; // Current log
+    trie_wal_config_t config;
+    unsigned char * buf, * spare; // Records not written yet, the spare one is filled while the other is written
+    size_t buf_len, buf_alloc, spare_alloc;
+    long long lsn, written_lsn, synced_lsn; // Records appended, written, synced
+    long log_size;
+    long long last_sync_us;
+    int flushing, checkpointing, checkpoint_asked, closing;
+    int failed; // A flush failed, operations are refused until a flush succeeds
+    trie_wal_stats_t stats;
+    trie_ckpt_t ckpt;
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+    pthread_cond_t flushed, wake;
+    pthread_mutex_t stripes[TRIE_WAL_STRIPES]; // Operations on the same key are applied in log order
+    pthread_t thread; // Syncs (TRIE_WAL_BATCH) and checkpoints
+#endif
+} trie_wal_t;
+void trie_wal_config_init(trie_wal_config_t * config); // TRIE_WAL_BATCH, 10ms, 64MB, 8
+// Recovers t (it should be empty) from the files, then logs. config may be NULL. Returns SUCCESS or FAIL
+int trie_wal_open(trie_wal_t * w, trie_ptr_t t, const char * path, const trie_wal_config_t * config);
+int trie_wal_close(trie_wal_t * w); // Syncs the log, t is not cleared
+// Return FAIL if the trie refuses the key, or if the log cannot be written (see trie_wal_sync)
+int trie_wal_add(trie_wal_t * w, const DATA_t * arr, int len);
+int trie_wal_remove(trie_wal_t * w, const DATA_t * arr, int len);
+int trie_wal_remove_prefix(trie_wal_t * w, const DATA_t * prefix, int len); // Keys removed, or FAIL
+int trie_wal_sync(trie_wal_t * w); // Makes every operation durable, writing again the ones of a failed write
+int trie_wal_checkpoint(trie_wal_t * w); // Writes a checkpoint and truncates the log
+void trie_wal_stats(trie_wal_t * w, trie_wal_stats_t * stats);
+
+// Flat combining for skewed inserts (many keys under the same hot node): writers publish their
+// operation in a slot, whoever takes the combiner lock applies every published one, sorted, while
+// the others wait for their result instead of queueing on the node locks. Slots are cache line
+// aligned: a malloc'ed trie_combiner_t needs aligned_alloc(64, ...)
+#define TRIE_COMBINER_SLOTS 64
+typedef struct {
+    int state; // Free, being filled, published or applied
+    int op; // Add or remove
+    int len, res;
+    const DATA_t * arr;
+} __attribute__((aligned(64))) trie_combiner_slot_t; // One cache line each
+typedef struct {
+    trie_ptr_t trie;
+    trie_combiner_slot_t slots[TRIE_COMBINER_SLOTS];
+    long long batches; // Times a thread combined
+    long long combined; // Operations applied by them
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock; // Taken by the combiner
+#endif
+} trie_combiner_t;
+void trie_combiner_init(trie_combiner_t * c, trie_ptr_t t);
+void trie_combiner_clear(trie_combiner_t * c); // t is not cleared
+int trie_combiner_add(trie_combiner_t * c, const DATA_t * arr, int len); // Same as trie_add
+void trie_combiner_remove(trie_combiner_t * c, const DATA_t * arr, int len);
+
+// Write optimized mode for ingestion: each thread adds keys to its own memtable, full memtables are
+// frozen and merged into the base trie by a background thread, which moves whole subtrees when the
+// base does not have them. Lookups and trie_lsm_foreach see both. Only trie_lsm_* functions may
+// change the base until trie_lsm_close
+typedef struct {
+    int writers; // Memtables, more threads share them
+    int memtable_keys; // Keys of a memtable when it is frozen
+    int max_frozen; // Writers freezing more memtables wait for the merge
+} trie_lsm_config_t;
+typedef struct {
+    long long freezes, merges;
+    long long merged_keys; // New keys of the base
+    long long grafts; // Subtrees moved to the base
+    long long splits; // Nodes split to match the other trie
+} trie_lsm_stats_t;
+struct _trie_lsm_writer;
+struct _trie_lsm_table;
+typedef struct {
+    trie_ptr_t base;
+    trie_lsm_config_t config;
+    struct _trie_lsm_writer * writers;
+    struct _trie_lsm_table * frozen, * frozen_last; // Merged in this order
+    int frozen_num, closing;
+    trie_lsm_stats_t stats;
+#ifndef NO_PTHREAD
+    pthread_rwlock_t tables; // Writelocked to change the memtables, readlocked to look into them
+    pthread_mutex_t lock; // Frozen memtables and stats
+    pthread_cond_t wake, merged;
+    pthread_t merger;
+#endif
+} trie_lsm_t;
+void trie_lsm_config_init(trie_lsm_config_t * config); // One writer for each cpu, 64K keys, 2 for each writer
+int trie_lsm_open(trie_lsm_t * l, trie_ptr_t base, const trie_lsm_config_t * config); // config may be NULL
+int trie_lsm_close(trie_lsm_t * l); // Every key is in the base after it
+int trie_lsm_add(trie_lsm_t * l, const DATA_t * arr, int len); // Same as trie_add
+int trie_lsm_find(trie_lsm_t * l, const DATA_t * arr, int len);
+int trie_lsm_flush(trie_lsm_t * l); // Freezes every memtable, returns when they are in the base
+// Every key once, in sorted order, merging memtables and base. Freezes wait for it, callback must
+// not change l. Returns the number of keys visited
+int trie_lsm_foreach(trie_lsm_t * l, trie_scan_callback_t callback, void * ctx);
+void trie_lsm_stats(trie_lsm_t * l, trie_lsm_stats_t * stats); // Also after trie_lsm_close
 
 #endif // TRIE_H defined
@@ -0,0 +1,449 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#ifndef TRIE_HPP
+#define TRIE_HPP
+
+// Header only C++ binding. It does not depend on trie.h, so DATA_t is not used here:
+// each trie<T> has its own element type, and comparisons are inlined by the compiler
+// Requires C++17, std::span lookups are available with C++20
+
+#include <algorithm> // lower_bound, mismatch
+#include <cstddef> // size_t
+#include <iterator> // forward_iterator_tag
+#include <memory> // allocator, allocator_traits
+#include <mutex> // unique_lock
+#include <shared_mutex> // shared_mutex, shared_lock
+#include <string_view> // basic_string_view
+#include <type_traits> // enable_if
+#include <utility> // move, swap
+#include <vector>
+#if __cplusplus >= 202002L
+#    include <span>
+#endif
+
+namespace trielib {
+
+// ===========================
+// ===   LOCKING POLICIES  ===
+// ===========================
+
+// Single thread policy, every lock call is removed by the compiler
+struct no_lock {
+    void lock() {}
+    void unlock() {}
+    void lock_shared() {}
+    void unlock_shared() {}
+};
+
+// Readers/writer lock for the whole trie
+struct shared_lock {
+    void lock() { m.lock(); }
+    void unlock() { m.unlock(); }
+    void lock_shared() { m.lock_shared(); }
+    void unlock_shared() { m.unlock_shared(); }
+private:
+    std::shared_mutex m;
+};
+
+// ==================
+// ===  KEY VIEW  ===
+// ==================
+
+// Non owning view over a contiguous array of T. Built from std::basic_string_view,
+// std::span, std::vector, std::basic_string or any object with data() and size()
+template <class T>
+class key_view {
+public:
+    constexpr key_view() noexcept : ptr(nullptr), len(0) {}
+    constexpr key_view(const T * data, std::size_t size) noexcept : ptr(data), len(size) {}
+
+    template <class C, class = std::enable_if_t<
+              std::is_convertible_v<decltype(std::declval<const C &>().data()), const T *>>>
+    constexpr key_view(const C & c) noexcept : ptr(c.data()), len(c.size()) {}
+
+    constexpr const T * data() const noexcept { return ptr; }
+    constexpr std::size_t size() const noexcept { return len; }
+    constexpr bool empty() const noexcept { return len == 0; }
+    constexpr const T & operator[](std::size_t i) const noexcept { return ptr[i]; }
+    constexpr const T * begin() const noexcept { return ptr; }
+    constexpr const T * end() const noexcept { return ptr + len; }
+    constexpr key_view subview(std::size_t off) const noexcept { return key_view(ptr + off, len - off); }
+
+private:
+    const T * ptr;
+    std::size_t len;
+};
+
+// ==============
+// ===  TRIE  ===
+// ==============
+
+template <class T, class Alloc = std::allocator<T>, class Lock = no_lock>
+class trie {
+    struct node;
+    using alloc_traits = std::allocator_traits<Alloc>;
+    using node_alloc_t = typename alloc_traits::template rebind_alloc<node>;
+    using node_alloc_traits = typename alloc_traits::template rebind_traits<node>;
+    using ptr_alloc_t = typename alloc_traits::template rebind_alloc<node *>;
+
+public:
+    using value_type = T;
+    using allocator_type = Alloc;
+    using key_type = std::vector<T, Alloc>; // Owning key, may be moved inside the trie
+    using view_type = key_view<T>;
+    using size_type = std::size_t;
+    class const_iterator;
+    using iterator = const_iterator; // Keys are immutable
+
+private:
+    struct node {
+        explicit node(const Alloc & a) : data(a), firsts(a), childs(ptr_alloc_t(a)), end(false) {}
+
+        key_type data; // Node data, excluding the first element (stored by the parent)
+        std::vector<T, Alloc> firsts; // Sorted first element of each child
+        std::vector<node *, ptr_alloc_t> childs; // Child nodes, same order as firsts
+        bool end; // true if a key ends here
+    };
+
+public:
+    explicit trie(const Alloc & a = Alloc()) : alloc(a), root(nullptr), count(0) {} // Root allocated on first insert
+
+    trie(const trie & other) : alloc(alloc_traits::select_on_container_copy_construction(other.alloc)),
+                               root(nullptr), count(0) {
+        std::shared_lock<Lock> guard(other.lock); // Other may be modified by other threads
+        root = clone(other.root);
+        count = other.count;
+    }
+
+    trie(trie && other) noexcept : alloc(std::move(other.alloc)), root(other.root), count(other.count) {
+        other.root = nullptr; // Moved from trie is empty and still usable
+        other.count = 0;
+    }
+
+    trie & operator=(trie other) noexcept { // Copy and swap
+        std::swap(alloc, other.alloc);
+        std::swap(root, other.root);
+        std::swap(count, other.count);
+        return *this;
+    }
+
+    ~trie() {
+        if (root != nullptr)
+            destroy(root);
+    }
+
+    // === Modifiers ===
+
+    bool insert(view_type key) { // Returns true if the key was not already inside
+        std::unique_lock<Lock> guard(lock);
+        return insert_helper(key, nullptr);
+    }
+
+    bool insert(key_type && key) { // Storage of key may be reused for the new node
+        std::unique_lock<Lock> guard(lock);
+        return insert_helper(view_type(key.data(), key.size()), &key);
+    }
+
+    bool erase(view_type key) { // Returns true if the key was removed
+        std::unique_lock<Lock> guard(lock);
+        return erase_helper(key);
+    }
+
+    void clear() {
+        std::unique_lock<Lock> guard(lock);
+        if (root != nullptr)
+            destroy(root);
+        root = nullptr;
+        count = 0;
+    }
+
+    // === Lookup ===
+
+    bool contains(view_type key) const {
+        std::shared_lock<Lock> guard(lock);
+        const node * t;
+        std::size_t off;
+        return (locate(key, t, off) && off == t->data.size() && t->end);
+    }
+
+    size_type size() const noexcept { return count; }
+    bool empty() const noexcept { return count == 0; }
+    allocator_type get_allocator() const { return alloc; }
+
+    // === Iterators ===
+    // Iterators do not lock, use read_lock() when other threads may modify the trie
+
+    std::shared_lock<Lock> read_lock() const { return std::shared_lock<Lock>(lock); }
+
+    const_iterator begin() const { return root == nullptr ? end() : const_iterator(root, key_type(alloc)); }
+    const_iterator end() const { return const_iterator(alloc); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    struct range {
+        const_iterator first, last;
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+    };
+
+    // All the keys starting with prefix, in order. Iterated keys include the prefix
+    range prefix_range(view_type prefix) const {
+        const node * t;
+        std::size_t off;
+        if (!locate(prefix, t, off))
+            return range{end(), end()};
+        key_type key(prefix.begin(), prefix.end(), alloc);
+        key.insert(key.end(), t->data.begin() + off, t->data.end()); // Rest of the node data
+        return range{const_iterator(t, std::move(key)), end()};
+    }
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = key_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const key_type *;
+        using reference = const key_type &;
+
+        const_iterator() = default;
+
+        reference operator*() const { return key; }
+        pointer operator->() const { return &key; }
+
+        const_iterator & operator++() { next(); return *this; }
+        const_iterator operator++(int) { const_iterator old(*this); next(); return old; }
+
+        bool operator==(const const_iterator & other) const {
+            if (stack.empty() || other.stack.empty())
+                return stack.empty() == other.stack.empty();
+            return stack.back().t == other.stack.back().t && key == other.key;
+        }
+        bool operator!=(const const_iterator & other) const { return !(*this == other); }
+
+    private:
+        friend class trie;
+
+        struct frame {
+            const node * t;
+            std::size_t next; // Next child to visit
+            std::size_t len; // Key lenght at the end of this node data
+        };
+
+        explicit const_iterator(const Alloc & a) : key(a) {} // End iterator
+
+        const_iterator(const node * base, key_type && prefix) : key(std::move(prefix)) {
+            stack.push_back(frame{base, 0, key.size()});
+            if (!base->end) // Otherwise the prefix itself is the first key
+                next();
+        }
+
+        void next() { // Depth first, keys are sorted because childs are sorted
+            while (!stack.empty()) {
+                frame & f = stack.back();
+                if (f.next == f.t->childs.size()) {
+                    stack.pop_back();
+                    continue;
+                }
+                const node * c = f.t->childs[f.next];
+                key.resize(f.len); // Truncates to this node, then appends the child
+                key.push_back(f.t->firsts[f.next]);
+                key.insert(key.end(), c->data.begin(), c->data.end());
+                f.next++;
+                stack.push_back(frame{c, 0, key.size()});
+                if (c->end)
+                    return;
+            }
+            key.clear(); // Reached the end
+        }
+
+        std::vector<frame> stack;
+        key_type key;
+    };
+
+private:
+    // Binary search of the first element, compiler inlines the comparisons for T
+    static std::size_t search_in_childs(const node * t, const T & to_search, bool & found) {
+        auto it = std::lower_bound(t->firsts.begin(), t->firsts.end(), to_search);
+        found = (it != t->firsts.end()) && !(to_search < *it);
+        return it - t->firsts.begin();
+    }
+
+    static std::size_t find_first_mismatch(const key_type & data, view_type key) {
+        std::size_t n = std::min(data.size(), key.size());
+        return std::mismatch(data.begin(), data.begin() + n, key.begin()).first - data.begin();
+    }
+
+    // Looks for the node where key ends, off is the lenght of node data matched
+    bool locate(view_type key, const node *& t, std::size_t & off) const {
+        bool found;
+        std::size_t pos;
+        t = root; // Root node has always empty data
+        off = 0;
+        if (root == nullptr) // Empty trie, never inserted or moved from
+            return false;
+        while (!key.empty()) {
+            pos = search_in_childs(t, key[0], found);
+            if (!found)
+                return false;
+            t = t->childs[pos];
+            key = key.subview(1);
+            off = find_first_mismatch(t->data, key);
+            if (off < t->data.size()) // Mismatch inside the node, only valid if key ended
+                return off == key.size();
+            key = key.subview(off);
+        }
+        return true;
+    }
+
+    bool insert_helper(view_type key, key_type * storage) {
+        bool found;
+        std::size_t pos, mismatch, done = 0;
+        node * t, * next, * mid;
+
+        if (root == nullptr)
+            root = new_node();
+        t = root;
+        while (done < key.size()) {
+            pos = search_in_childs(t, key[done], found);
+            if (!found) { // New leaf, with all the remaining data
+                t->firsts.insert(t->firsts.begin() + pos, key[done]);
+                next = new_node();
+                if (storage != nullptr) { // Reuses the key buffer
+                    storage->erase(storage->begin(), storage->begin() + done + 1);
+                    next->data = std::move(*storage);
+                } else {
+                    next->data.assign(key.begin() + done + 1, key.end());
+                }
+                next->end = true;
+                t->childs.insert(t->childs.begin() + pos, next);
+                count++;
+                return true;
+            }
+            next = t->childs[pos];
+            done++;
+            mismatch = find_first_mismatch(next->data, key.subview(done));
+            if (mismatch < next->data.size()) { // Splits next in two nodes
+                mid = new_node();
+                mid->data.assign(next->data.begin(), next->data.begin() + mismatch);
+                mid->firsts.push_back(next->data[mismatch]);
+                mid->childs.push_back(next);
+                next->data.erase(next->data.begin(), next->data.begin() + mismatch + 1);
+                t->childs[pos] = mid;
+                next = mid;
+            }
+            t = next;
+            done += mismatch;
+        }
+
+        if (t->end)
+            return false; // Already inside
+        t->end = true;
+        count++;
+        return true;
+    }
+
+    bool erase_helper(view_type key) {
+        bool found;
+        std::size_t pos = 0, parent_pos = 0, mismatch;
+        node * t = root, * parent = nullptr, * grandparent = nullptr;
+
+        if (root == nullptr)
+            return false;
+        while (!key.empty()) {
+            std::size_t p = search_in_childs(t, key[0], found);
+            if (!found)
+                return false;
+            grandparent = parent;
+            parent = t;
+            parent_pos = pos;
+            pos = p;
+            t = t->childs[p];
+            key = key.subview(1);
+            mismatch = find_first_mismatch(t->data, key);
+            if (mismatch < t->data.size())
+                return false;
+            key = key.subview(mismatch);
+        }
+        if (!t->end)
+            return false;
+
+        t->end = false;
+        count--;
+        if (t == root)
+            return true; // Root node is never removed
+        if (t->childs.empty()) { // Unlinks from the parent
+            parent->childs.erase(parent->childs.begin() + pos);
+            parent->firsts.erase(parent->firsts.begin() + pos);
+            destroy(t);
+            if (parent != root && !parent->end && parent->childs.size() == 1)
+                merge(grandparent, parent_pos); // Parent became useless
+        } else if (t->childs.size() == 1) {
+            merge(parent, pos);
+        }
+        return true;
+    }
+
+    // Merges the only child of parent->childs[pos] inside it
+    void merge(node * parent, std::size_t pos) {
+        node * t = parent->childs[pos];
+        node * c = t->childs[0];
+        c->data.insert(c->data.begin(), t->firsts[0]);
+        c->data.insert(c->data.begin(), t->data.begin(), t->data.end());
+        parent->childs[pos] = c;
+        t->childs.clear(); // Do not destroy c
+        destroy(t);
+    }
+
+    node * new_node() {
+        node_alloc_t a(alloc);
+        node * t = node_alloc_traits::allocate(a, 1);
+        node_alloc_traits::construct(a, t, alloc);
+        return t;
+    }
+
+    void destroy(node * t) {
+        node_alloc_t a(alloc);
+        for (node * c : t->childs)
+            destroy(c);
+        node_alloc_traits::destroy(a, t);
+        node_alloc_traits::deallocate(a, t, 1);
+    }
+
+    node * clone(const node * t) {
+        if (t == nullptr)
+            return nullptr;
+        node * c = new_node();
+        c->data = t->data;
+        c->firsts = t->firsts;
+        c->end = t->end;
+        c->childs.reserve(t->childs.size());
+        for (const node * child : t->childs)
+            c->childs.push_back(clone(child));
+        return c;
+    }
+
+    Alloc alloc;
+    node * root; // Root node data is always empty, nullptr until the first insert
+    size_type count; // Number of keys
+    mutable Lock lock;
+};
+
+} // namespace trielib
+
+#endif // TRIE_HPP defined
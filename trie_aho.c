@@ -0,0 +1,271 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include <assert.h>
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_utils.c, trie_childs.c, trie_mutex.c
+
+/*
+   Automaton layout:
+   States are the symbols of the keys, as in a not compressed trie, numbered in breadth first
+   order. Since childs of the same state are visited in a row, they are contiguous: a state
+   stores only the first one and their number, and symbols[s] is the symbol leading to s.
+   So following a transition reads one small contiguous array. With byte symbols transitions
+   of the root, the most used state, are also saved in a table.
+   fail is the longest proper suffix of the state which is also a state, dict the longest one
+   which is also a key (output link). key is the position of the key in sorted order (see
+   trie_select), -1 if no key ends in the state.
+*/
+
+#define TRIE_AHO_ROOT 0
+
+// Temporany state, in depth first order
+struct _trie_aho_tmp {
+    int parent;
+    int depth;
+    int key;
+    DATA_t symbol;
+};
+
+struct _trie_aho_build {
+    struct _trie_aho_tmp * states;
+    int num, alloc;
+    int keys; // Keys found until now
+};
+
+static inline
+int trie_aho_tmp_add(struct _trie_aho_build * b, int parent, DATA_t symbol) {
+    if (b->num == b->alloc) { // Doubles
+        b->alloc = (b->alloc == 0)?64:(2*b->alloc);
+        b->states = realloc(b->states, (b->alloc)*sizeof*(b->states));
+        assert(b->states);
+    }
+    b->states[b->num].parent = parent;
+    b->states[b->num].depth = (parent < 0)?0:(b->states[parent].depth + 1);
+    b->states[b->num].key = -1;
+    b->states[b->num].symbol = symbol;
+    return b->num++;
+}
+
+// Adds a state for each symbol in t subtree. t must be readlocked, and it is left locked
+static
+void trie_aho_walk(struct _trie * t, struct _trie_aho_build * b, int state) {
+    int i;
+    struct _trie * next;
+
+    for (i = 0; i < trie_data_len(t); i++) // Node data
+        state = trie_aho_tmp_add(b, state, trie_data(t)[i]);
+    if (trie_data_end(t))
+        b->states[state].key = b->keys++;
+
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        next = trie_get_child(t, i);
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        trie_aho_walk(next, b, trie_aho_tmp_add(b, state, trie_get_first(t, i)));
+        trie_unlock(&(next->lock));
+    }
+}
+
+// Next state from s reading symbol, -1 if there is no transition
+static inline
+int trie_aho_goto(const trie_aho_t * aho, int s, DATA_t symbol) {
+    const DATA_t * begin, * end, * mid;
+
+    if ((sizeof(DATA_t) == 1) && (s == TRIE_AHO_ROOT))
+        return aho->root[(unsigned char)symbol];
+    begin = aho->symbols + aho->states[s].first;
+    end = begin + aho->states[s].child_num;
+    if (aho->states[s].child_num <= CHILD_LINEAR_SEARCH) { // Few childs, scans them
+        for (; (begin < end) && (*begin < symbol); begin++);
+    } else { // Binary search
+        while (begin < end) {
+            mid = begin + (end - begin)/2;
+            if (*mid < symbol)
+                begin = mid + 1;
+            else
+                end = mid;
+        }
+        end = aho->symbols + aho->states[s].first + aho->states[s].child_num;
+    }
+    if ((begin < end) && (*begin == symbol))
+        return begin - aho->symbols;
+    return -1;
+}
+
+int trie_aho_build(trie_ptr_t t, trie_aho_t * aho) {
+    struct _trie_aho_build b;
+    int * order, * depth_begin; // order[tmp state] = breadth first position
+    int i, d, s, p, f, max_depth;
+
+    if ((t == NULL) || (aho == NULL))
+        return FAIL; // Invalid ptr
+
+    memset(&b, 0, sizeof(b));
+    trie_aho_tmp_add(&b, -1, 0); // Root
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    if (!trie_is_empty(t) || trie_data_end(t))
+        trie_aho_walk(t, &b, TRIE_AHO_ROOT);
+    trie_unlock(&(t->lock));
+    b.states[TRIE_AHO_ROOT].key = -1; // The empty key matches nothing
+
+    // Sorting by depth (stable) gives the breadth first order
+    max_depth = 0;
+    for (i = 0; i < b.num; i++)
+        if (b.states[i].depth > max_depth)
+            max_depth = b.states[i].depth;
+    depth_begin = calloc(max_depth + 2, sizeof(*depth_begin));
+    order = malloc(b.num*sizeof(*order));
+    assert(depth_begin && order);
+    for (i = 0; i < b.num; i++)
+        depth_begin[b.states[i].depth + 1]++;
+    for (d = 1; d <= max_depth + 1; d++)
+        depth_begin[d] += depth_begin[d - 1];
+    for (i = 0; i < b.num; i++)
+        order[i] = depth_begin[b.states[i].depth]++;
+
+    aho->state_num = b.num;
+    aho->states = malloc(b.num*sizeof(*(aho->states)));
+    aho->symbols = malloc(b.num*sizeof(*(aho->symbols)));
+    aho->root = NULL;
+    assert(aho->states && aho->symbols);
+    for (i = 0; i < b.num; i++) {
+        s = order[i];
+        aho->symbols[s] = b.states[i].symbol;
+        aho->states[s].key = b.states[i].key;
+        aho->states[s].depth = b.states[i].depth;
+        aho->states[s].first = 0;
+        aho->states[s].child_num = 0;
+    }
+    for (i = 1; i < b.num; i++) { // Childs are visited in order, the first one is the smallest
+        s = order[i];
+        p = order[b.states[i].parent];
+        if (aho->states[p].child_num++ == 0)
+            aho->states[p].first = s;
+    }
+    free(order);
+    free(depth_begin);
+    free(b.states);
+
+    if (sizeof(DATA_t) == 1) { // Table for the root
+        aho->root = malloc(256*sizeof(*(aho->root)));
+        assert(aho->root);
+        for (i = 0; i < 256; i++)
+            aho->root[i] = -1;
+        for (i = 0; i < aho->states[TRIE_AHO_ROOT].child_num; i++)
+            aho->root[(unsigned char)aho->symbols[aho->states[TRIE_AHO_ROOT].first + i]] =
+                aho->states[TRIE_AHO_ROOT].first + i;
+    }
+
+    // Failure and output links, in breadth first order parents come first
+    aho->states[TRIE_AHO_ROOT].fail = TRIE_AHO_ROOT;
+    aho->states[TRIE_AHO_ROOT].dict = -1;
+    for (p = 0; p < b.num; p++) {
+        for (s = aho->states[p].first; s < aho->states[p].first + aho->states[p].child_num; s++) {
+            f = -1;
+            if (p != TRIE_AHO_ROOT) { // Follows the failures of the parent
+                for (f = aho->states[p].fail; ; f = aho->states[f].fail) {
+                    if ((d = trie_aho_goto(aho, f, aho->symbols[s])) >= 0) {
+                        f = d;
+                        break;
+                    }
+                    if (f == TRIE_AHO_ROOT) {
+                        f = -1;
+                        break;
+                    }
+                }
+            }
+            aho->states[s].fail = (f < 0)?TRIE_AHO_ROOT:f;
+            f = aho->states[s].fail;
+            aho->states[s].dict = (aho->states[f].key >= 0)?f:aho->states[f].dict;
+        }
+    }
+    return SUCCESS;
+}
+
+void trie_aho_clear(trie_aho_t * aho) {
+    if (aho == NULL)
+        return; // Invalid ptr
+    free(aho->states);
+    free(aho->symbols);
+    free(aho->root);
+    aho->states = NULL;
+    aho->symbols = NULL;
+    aho->root = NULL;
+    aho->state_num = 0;
+}
+
+void trie_aho_scanner_init(trie_aho_scanner_t * scanner, const trie_aho_t * aho) {
+    scanner->aho = aho;
+    scanner->state = TRIE_AHO_ROOT;
+    scanner->pending = -1;
+    scanner->offset = 0;
+}
+
+// Reports keys ending in state m and in its output links. If callback stops, saves where
+static inline
+int trie_aho_report(trie_aho_scanner_t * scanner, int m, int * found,
+                    trie_aho_callback_t callback, void * ctx) {
+    const trie_aho_t * aho = scanner->aho;
+
+    for (; m >= 0; m = aho->states[m].dict) {
+        (*found)++;
+        if (callback(scanner->offset, aho->states[m].depth, aho->states[m].key, ctx)) {
+            scanner->pending = aho->states[m].dict; // Next call goes on from here
+            return 1;
+        }
+    }
+    scanner->pending = -1;
+    return 0;
+}
+
+int trie_aho_scan(trie_aho_scanner_t * scanner, const DATA_t * text, int len,
+                  trie_aho_callback_t callback, void * ctx) {
+    const trie_aho_t * aho;
+    int i, s, next, found;
+
+    if ((scanner == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+
+    aho = scanner->aho;
+    found = 0;
+    if (trie_aho_report(scanner, scanner->pending, &found, callback, ctx)) // Stopped last time
+        return found;
+
+    s = scanner->state;
+    for (i = 0; i < len; i++) {
+        while ((next = trie_aho_goto(aho, s, text[i])) < 0) { // Follows failures
+            if (s == TRIE_AHO_ROOT) {
+                next = TRIE_AHO_ROOT;
+                break;
+            }
+            s = aho->states[s].fail;
+        }
+        s = next;
+        scanner->state = s;
+        scanner->offset++; // Matches end here
+
+        // Every key ending here: the state itself, then the output links
+        if (trie_aho_report(scanner, (aho->states[s].key >= 0)?s:aho->states[s].dict, &found, callback, ctx))
+            return found; // Resumes after this symbol
+    }
+    return found;
+}
@@ -0,0 +1,689 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <assert.h>
+#include "trie.h"
+
+/*
+   Memory of the nodes: node structs, child arrays and node data. Everything else
+   (iterators, buffers, frozen copies) uses malloc.
+
+   Without TRIE_NUMA this is malloc. With TRIE_NUMA (Linux only) memory comes from
+   chunks of TRIE_CHUNK_SIZE bytes, aligned to their size, each one bound to a NUMA node
+   with mbind. A chunk holds blocks of a single size class, its header is found masking
+   the block address, so blocks have no header. Each node (pool) has a free list for
+   each class; the last pool is interleaved between all nodes. Blocks larger than the
+   largest class get a mapping of their own, with the same header.
+
+   The pool is the one preferred by the thread (see trie_mem_prefer), otherwise it
+   depends on the policy. trie_add prefers the pool of the key subtree for TRIE_NUMA_SUBTREE.
+
+   TRIE_HUGE_PAGES also enables chunks, on a single node. Chunks are huge page sized and
+   aligned, so each one can be backed by a single huge page: with TRIE_PAGES_HUGETLB they
+   are mapped with MAP_HUGETLB, with TRIE_PAGES_THP (default) madvise asks transparent huge
+   pages. When huge pages are not available normal pages are used, counters tell which ones.
+*/
+
+#if !defined(TRIE_NUMA) && !defined(TRIE_HUGE_PAGES) // Plain malloc
+
+#define trie_mem_base_alloc(size)        malloc(size)
+#define trie_mem_base_realloc(ptr, size) realloc(ptr, size)
+#define trie_mem_base_free(ptr)          free(ptr)
+#define trie_mem_current_node()          0
+
+static inline
+int trie_mem_prefer(int pool) { // There is a single pool
+    (void)pool;
+    return -1;
+}
+
+static inline
+int trie_mem_subtree(const DATA_t * arr, int len) {
+    (void)arr;
+    (void)len;
+    return -1;
+}
+
+int trie_numa_policy(int policy) {
+    return (policy == TRIE_NUMA_DEFAULT)?SUCCESS:FAIL;
+}
+
+int trie_numa_nodes(void) {
+    return 1;
+}
+
+int trie_huge_pages(int mode) {
+    return (mode == TRIE_PAGES_NORMAL)?SUCCESS:FAIL;
+}
+
+void trie_mem_stats(trie_mem_stats_t * stats) {
+    memset(stats, 0, sizeof(*stats)); // Nothing is mapped here
+}
+
+#else // TRIE_NUMA or TRIE_HUGE_PAGES
+
+#include <stdio.h> // snprintf
+#include <stdint.h> // uintptr_t
+#include <unistd.h> // syscall, sysconf
+#include <sys/mman.h> // mmap
+#include <sys/syscall.h> // SYS_mbind, SYS_getcpu
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#endif
+
+#define TRIE_CHUNK_SIZE (2*1024*1024) // Bytes
+#define TRIE_CHUNK_HEADER 64 // Bytes, keeps blocks aligned
+#define TRIE_MEM_CLASSES 20
+#define TRIE_NODE_REFRESH 1024 // Allocations before asking again the node of the thread
+
+#define TRIE_MPOL_PREFERRED 1 // Same as linux/mempolicy.h
+#define TRIE_MPOL_INTERLEAVE 3
+
+static const int trie_mem_class_size[TRIE_MEM_CLASSES] = {
+    16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024,
+    1536, 2048, 3072, 4096, 8192, 16384, 32768, 65536
+};
+
+struct _trie_chunk { // Header of every chunk
+    int cls; // Size class, -1 for a single large block
+    int pool;
+    size_t size; // Bytes mapped
+};
+
+struct _trie_pool_class {
+    void * free; // Free blocks, each one points to the next
+    char * bump, * bump_end; // Never used part of the last chunk
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+static struct _trie_pool_class trie_pools[TRIE_NUMA_MAX_NODES + 1][TRIE_MEM_CLASSES];
+static int trie_numa_mode = TRIE_NUMA_DEFAULT;
+#ifdef TRIE_HUGE_PAGES
+static int trie_pages_mode = TRIE_PAGES_THP;
+#else
+static int trie_pages_mode = TRIE_PAGES_NORMAL;
+#endif
+static trie_mem_stats_t trie_stats; // Updated with atomic operations
+static int trie_numa_node_num = 0; // 0 until initialized
+static __thread int trie_mem_preferred = -1;
+static __thread int trie_mem_node_cache = -1;
+static __thread int trie_mem_node_age = 0;
+
+#ifndef NO_PTHREAD
+static pthread_once_t trie_numa_once = PTHREAD_ONCE_INIT;
+#endif
+
+static
+void trie_numa_init(void) {
+    char path[64];
+    int i, j;
+
+    for (i = 0; i < TRIE_NUMA_MAX_NODES; i++) { // Nodes are numbered from 0
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", i);
+        if (access(path, F_OK) != 0)
+            break;
+    }
+    trie_numa_node_num = (i == 0)?1:i; // No sysfs, a single node
+#ifndef NO_PTHREAD
+    for (i = 0; i <= TRIE_NUMA_MAX_NODES; i++)
+        for (j = 0; j < TRIE_MEM_CLASSES; j++)
+            pthread_mutex_init(&(trie_pools[i][j].lock), NULL);
+#else
+    (void)j;
+#endif
+}
+
+static inline
+void trie_numa_check_init(void) {
+#ifndef NO_PTHREAD
+    pthread_once(&trie_numa_once, trie_numa_init);
+#else
+    if (trie_numa_node_num == 0)
+        trie_numa_init();
+#endif
+}
+
+int trie_numa_nodes(void) {
+    trie_numa_check_init();
+    return trie_numa_node_num;
+}
+
+int trie_numa_policy(int policy) {
+    if ((policy != TRIE_NUMA_DEFAULT) && (policy != TRIE_NUMA_INTERLEAVE) && (policy != TRIE_NUMA_SUBTREE))
+        return FAIL;
+    trie_numa_check_init();
+    trie_numa_mode = policy;
+    return SUCCESS;
+}
+
+int trie_huge_pages(int mode) {
+    if ((mode != TRIE_PAGES_NORMAL) && (mode != TRIE_PAGES_THP) && (mode != TRIE_PAGES_HUGETLB))
+        return FAIL;
+    trie_pages_mode = mode;
+    return SUCCESS;
+}
+
+void trie_mem_stats(trie_mem_stats_t * stats) {
+    stats->chunks = trie_atomic_load(&(trie_stats.chunks));
+    stats->hugetlb_chunks = trie_atomic_load(&(trie_stats.hugetlb_chunks));
+    stats->thp_chunks = trie_atomic_load(&(trie_stats.thp_chunks));
+    stats->fallbacks = trie_atomic_load(&(trie_stats.fallbacks));
+    stats->large_blocks = trie_atomic_load(&(trie_stats.large_blocks));
+}
+
+// Node of the cpu running the thread. Threads seldom move, so it is asked again only sometimes
+static inline
+int trie_mem_current_node(void) {
+    unsigned cpu, node;
+    if ((trie_mem_node_cache < 0) || (++trie_mem_node_age >= TRIE_NODE_REFRESH)) {
+        trie_mem_node_age = 0;
+        if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0)
+            node = 0;
+        trie_mem_node_cache = node % trie_numa_nodes();
+    }
+    return trie_mem_node_cache;
+}
+
+// Sets the pool for the allocations of this thread, -1 for none. Returns the previous one
+static inline
+int trie_mem_prefer(int pool) {
+    int prev = trie_mem_preferred;
+    trie_mem_preferred = pool;
+    return prev;
+}
+
+// Pool of the subtree of a key, for TRIE_NUMA_SUBTREE. -1 otherwise
+static inline
+int trie_mem_subtree(const DATA_t * arr, int len) {
+    if ((trie_numa_mode != TRIE_NUMA_SUBTREE) || (trie_mem_preferred >= 0))
+        return trie_mem_preferred; // Keeps the preference
+    return ((len > 0)?(int)((uintmax_t)arr[0] % trie_numa_nodes()):0);
+}
+
+static inline
+int trie_mem_pool(void) {
+    if (trie_mem_preferred >= 0)
+        return trie_mem_preferred % trie_numa_nodes();
+    if (trie_numa_mode == TRIE_NUMA_INTERLEAVE)
+        return TRIE_NUMA_MAX_NODES; // Interleaved pool
+    return trie_mem_current_node();
+}
+
+// Binds memory to the node of pool. If mbind fails (no NUMA support) memory is used as it is
+static inline
+void trie_mem_bind(void * mem, size_t size, int pool) {
+    unsigned long mask[(TRIE_NUMA_MAX_NODES + 8*sizeof(unsigned long) - 1)/(8*sizeof(unsigned long))];
+    int i, mode;
+
+    if (trie_numa_nodes() == 1)
+        return; // Nothing to choose
+    memset(mask, 0, sizeof(mask));
+    if (pool == TRIE_NUMA_MAX_NODES) { // Every node
+        mode = TRIE_MPOL_INTERLEAVE;
+        for (i = 0; i < trie_numa_nodes(); i++)
+            mask[i/(8*sizeof(unsigned long))] |= 1UL << (i % (8*sizeof(unsigned long)));
+    } else { // Preferred, so a full node does not make allocations fail
+        mode = TRIE_MPOL_PREFERRED;
+        mask[pool/(8*sizeof(unsigned long))] |= 1UL << (pool % (8*sizeof(unsigned long)));
+    }
+    syscall(SYS_mbind, mem, size, mode, mask, TRIE_NUMA_MAX_NODES + 1, 0);
+}
+
+// Maps size bytes (rounded to pages) beginning at a TRIE_CHUNK_SIZE boundary
+static
+struct _trie_chunk * trie_chunk_map(size_t size, int cls, int pool) {
+    char * mem, * begin;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    begin = NULL;
+#ifdef MAP_HUGETLB
+    if (trie_pages_mode == TRIE_PAGES_HUGETLB) { // Huge pages are aligned to their size
+        size = (size + TRIE_CHUNK_SIZE - 1)/TRIE_CHUNK_SIZE*TRIE_CHUNK_SIZE;
+        mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if ((mem != MAP_FAILED) && (((uintptr_t)mem & (TRIE_CHUNK_SIZE - 1)) == 0)) {
+            begin = mem;
+            trie_atomic_add(&(trie_stats.hugetlb_chunks), 1);
+        } else { // No huge pages reserved (or not 2MB ones), falls back
+            if (mem != MAP_FAILED)
+                munmap(mem, size);
+            trie_atomic_add(&(trie_stats.fallbacks), 1);
+        }
+    }
+#endif
+
+    if (begin == NULL) {
+        size = (size + page - 1)/page*page;
+        mem = mmap(NULL, size + TRIE_CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+            return NULL;
+        begin = (char *)(((uintptr_t)mem + TRIE_CHUNK_SIZE - 1) & ~(uintptr_t)(TRIE_CHUNK_SIZE - 1));
+        if (begin > mem) // Unmaps what is outside
+            munmap(mem, begin - mem);
+        munmap(begin + size, mem + size + TRIE_CHUNK_SIZE - (begin + size));
+#ifdef MADV_HUGEPAGE
+        if (trie_pages_mode != TRIE_PAGES_NORMAL) { // Also after a MAP_HUGETLB fallback
+            if (madvise(begin, size, MADV_HUGEPAGE) == 0)
+                trie_atomic_add(&(trie_stats.thp_chunks), 1);
+            else
+                trie_atomic_add(&(trie_stats.fallbacks), 1);
+        }
+#endif
+    }
+    trie_atomic_add(&(trie_stats.chunks), 1);
+    if (cls < 0)
+        trie_atomic_add(&(trie_stats.large_blocks), 1);
+
+    trie_mem_bind(begin, size, pool); // Before the first touch
+    ((struct _trie_chunk *)begin)->cls = cls;
+    ((struct _trie_chunk *)begin)->pool = pool;
+    ((struct _trie_chunk *)begin)->size = size;
+    return (struct _trie_chunk *)begin;
+}
+
+#define trie_chunk_of(ptr) ((struct _trie_chunk *)((uintptr_t)(ptr) & ~(uintptr_t)(TRIE_CHUNK_SIZE - 1)))
+
+static inline
+int trie_mem_class(size_t size) {
+    int cls;
+    for (cls = 0; cls < TRIE_MEM_CLASSES; cls++)
+        if (size <= (size_t)trie_mem_class_size[cls])
+            return cls;
+    return -1; // Too large
+}
+
+static
+void * trie_mem_alloc_pool(size_t size, int pool) {
+    struct _trie_pool_class * p;
+    struct _trie_chunk * chunk;
+    void * res;
+    int cls;
+
+    cls = trie_mem_class(size);
+    if (cls < 0) { // Mapping of its own
+        chunk = trie_chunk_map(TRIE_CHUNK_HEADER + size, -1, pool);
+        return (chunk == NULL)?NULL:((char *)chunk + TRIE_CHUNK_HEADER);
+    }
+
+    p = &(trie_pools[pool][cls]);
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(p->lock));
+#endif
+    if (p->free != NULL) { // Reuses a block
+        res = p->free;
+        p->free = *(void **)res;
+    } else {
+        if (p->bump + trie_mem_class_size[cls] > p->bump_end) { // Chunk full, a new one
+            chunk = trie_chunk_map(TRIE_CHUNK_SIZE, cls, pool);
+            if (chunk == NULL) {
+#ifndef NO_PTHREAD
+                pthread_mutex_unlock(&(p->lock));
+#endif
+                return NULL;
+            }
+            p->bump = (char *)chunk + TRIE_CHUNK_HEADER;
+            p->bump_end = (char *)chunk + TRIE_CHUNK_SIZE;
+        }
+        res = p->bump;
+        p->bump += trie_mem_class_size[cls];
+    }
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(p->lock));
+#endif
+    return res;
+}
+
+static inline
+void * trie_mem_base_alloc(size_t size) {
+    trie_numa_check_init();
+    return trie_mem_alloc_pool(size, trie_mem_pool());
+}
+
+static inline
+void trie_mem_base_free(void * ptr) {
+    struct _trie_chunk * chunk;
+    struct _trie_pool_class * p;
+
+    if (ptr == NULL)
+        return;
+    chunk = trie_chunk_of(ptr);
+    if (chunk->cls < 0) { // Large block
+        trie_atomic_add(&(trie_stats.chunks), -1);
+        trie_atomic_add(&(trie_stats.large_blocks), -1);
+        munmap(chunk, chunk->size);
+        return;
+    }
+    p = &(trie_pools[chunk->pool][chunk->cls]);
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(p->lock));
+#endif
+    *(void **)ptr = p->free;
+    p->free = ptr;
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(p->lock));
+#endif
+}
+
+// Moves the block only if it does not fit anymore. It stays in the same pool
+static inline
+void * trie_mem_base_realloc(void * ptr, size_t size) {
+    struct _trie_chunk * chunk;
+    void * res;
+    size_t old;
+
+    if (ptr == NULL)
+        return trie_mem_base_alloc(size);
+    chunk = trie_chunk_of(ptr);
+    old = (chunk->cls < 0)?(chunk->size - TRIE_CHUNK_HEADER):(size_t)trie_mem_class_size[chunk->cls];
+    if (size <= old)
+        return ptr;
+    res = trie_mem_alloc_pool(size, chunk->pool);
+    if (res == NULL)
+        return NULL;
+    memcpy(res, ptr, old);
+    trie_mem_base_free(ptr);
+    return res;
+}
+
+#endif // TRIE_NUMA or TRIE_HUGE_PAGES
+
+//  ====================
+//  ==== ALLOCATORS ====
+//  ====================
+
+/*
+   A trie made with trie_init_with_allocator takes node memory from the hooks of its allocator.
+   Each block begins with a header holding its size, so freeing it tells how many bytes go away.
+
+   Nodes do not know their trie: the root keeps the index of its allocator in trie_allocators, and
+   each operation sets it for the thread (see trie_mem_enter), as trie_mem_prefer does for pools.
+   Subtrees given to the reaper carry the index too. Without an allocator memory is as above.
+   Each root and each subtree waiting for the reaper holds a reference to its index, the index
+   is free again once trie_clear and the reaper release the last one.
+
+   Insertions reserve what they may allocate before changing anything (see trie_add_reserve),
+   so the limit makes them fail with the trie untouched. Removals are never refused.
+*/
+
+#define TRIE_MAX_ALLOCATORS 256 // Index 0 means none, it fits the node field
+#define TRIE_MEM_HEADER 16 // Bytes, keeps blocks aligned as malloc does
+
+static trie_allocator_t * trie_allocators[TRIE_MAX_ALLOCATORS]; // Registered ones
+static int trie_allocators_refs[TRIE_MAX_ALLOCATORS]; // Roots and reaped subtrees using each one
+#ifndef NO_PTHREAD
+static pthread_mutex_t trie_allocators_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+static __thread trie_allocator_t * trie_mem_allocator = NULL; // Of the trie the thread is changing
+
+// Node memory of t for this thread, returns the allocator to give back to trie_mem_leave
+static inline
+trie_allocator_t * trie_mem_enter(trie_ptr_t t) {
+    trie_allocator_t * prev = trie_mem_allocator;
+    trie_mem_allocator = trie_allocators[t->data.allocator];
+    return prev;
+}
+#define trie_mem_leave(prev) (trie_mem_allocator = (prev))
+
+static inline
+void * trie_mem_alloc(size_t size) {
+    trie_allocator_t * a = trie_mem_allocator;
+    size_t * block;
+
+    if (a == NULL)
+        return trie_mem_base_alloc(size);
+    size += TRIE_MEM_HEADER;
+    block = (a->alloc != NULL)?a->alloc(a->ctx, size):malloc(size);
+    if (block == NULL)
+        return NULL;
+    *block = size;
+    trie_atomic_add(&(a->live), (long long)size);
+    return (char *)block + TRIE_MEM_HEADER;
+}
+
+static inline
+void * trie_mem_realloc(void * ptr, size_t size) {
+    trie_allocator_t * a = trie_mem_allocator;
+    size_t * block;
+    size_t old;
+
+    if (a == NULL)
+        return trie_mem_base_realloc(ptr, size);
+    if (ptr == NULL)
+        return trie_mem_alloc(size);
+    block = (size_t *)((char *)ptr - TRIE_MEM_HEADER);
+    old = *block;
+    size += TRIE_MEM_HEADER;
+    block = (a->realloc != NULL)?a->realloc(a->ctx, block, size):realloc(block, size);
+    if (block == NULL)
+        return NULL; // Old block is still there
+    *block = size;
+    trie_atomic_add(&(a->live), (long long)size - (long long)old);
+    return (char *)block + TRIE_MEM_HEADER;
+}
+
+static inline
+void trie_mem_free(void * ptr) {
+    trie_allocator_t * a = trie_mem_allocator;
+    size_t * block;
+
+    if (a == NULL) {
+        trie_mem_base_free(ptr);
+        return;
+    }
+    if (ptr == NULL)
+        return;
+    block = (size_t *)((char *)ptr - TRIE_MEM_HEADER);
+    trie_atomic_add(&(a->live), -(long long)*block);
+    if (a->free != NULL)
+        a->free(a->ctx, block);
+    else
+        free(block);
+}
+
+// Takes bytes from the limit until trie_mem_unreserve, when they are allocated
+static inline
+int trie_mem_reserve(long long bytes) {
+    trie_allocator_t * a = trie_mem_allocator;
+    long long reserved;
+
+    if (a == NULL)
+        return SUCCESS;
+    reserved = trie_atomic_add(&(a->reserved), bytes);
+    if ((a->limit > 0) && (reserved + trie_atomic_load(&(a->live)) > a->limit)) {
+        trie_atomic_add(&(a->reserved), -bytes);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static inline
+void trie_mem_unreserve(long long bytes) {
+    if (trie_mem_allocator != NULL)
+        trie_atomic_add(&(trie_mem_allocator->reserved), -bytes);
+}
+
+void trie_allocator_init(trie_allocator_t * allocator) {
+    if (allocator != NULL)
+        memset(allocator, 0, sizeof(*allocator));
+}
+
+int trie_init_with_allocator(trie_ptr_t t, trie_allocator_t * allocator) {
+    int i, res;
+
+    if ((t == NULL) || (allocator == NULL))
+        return FAIL; // Invalid ptr
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&trie_allocators_lock);
+#endif
+    res = 0;
+    for (i = 1; i < TRIE_MAX_ALLOCATORS; i++) {
+        if (trie_allocators[i] == allocator) { // Already there
+            res = i;
+            break;
+        }
+        if ((trie_allocators[i] == NULL) && (res == 0)) // First free one
+            res = i;
+    }
+    if (res != 0) {
+        trie_allocators[res] = allocator;
+        trie_allocators_refs[res]++; // Released by trie_clear
+    }
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&trie_allocators_lock);
+#endif
+    if (res == 0)
+        return FAIL; // Every index is taken
+    trie_init(t);
+    t->data.allocator = res;
+    return SUCCESS;
+}
+
+// One more root or reaped subtree uses the allocator at index
+static
+void trie_mem_ref(int index) {
+    if (index == 0)
+        return; // malloc
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&trie_allocators_lock);
+#endif
+    assert(trie_allocators[index] != NULL);
+    trie_allocators_refs[index]++;
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&trie_allocators_lock);
+#endif
+}
+
+// Releases a reference, the last one frees the index
+static
+void trie_mem_unref(int index) {
+    if (index == 0)
+        return; // malloc
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&trie_allocators_lock);
+#endif
+    assert(trie_allocators_refs[index] > 0);
+    if (--(trie_allocators_refs[index]) == 0)
+        trie_allocators[index] = NULL;
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&trie_allocators_lock);
+#endif
+}
+
+long long trie_mem_used(trie_ptr_t t) {
+    if ((t == NULL) || (trie_allocators[t->data.allocator] == NULL))
+        return -1;
+    return trie_atomic_load(&(trie_allocators[t->data.allocator]->live));
+}
+
+//  ==========================
+//  ==== REPLICATED TRIES ====
+//  ==========================
+
+// Writes are serialized, so every replica sees them in the same order. Memory of replica i
+// is in pool i, so with one replica for each node lookups never leave the socket
+int trie_replicated_init(trie_replicated_t * r, int replicas) {
+    int i, prev;
+
+    if (r == NULL)
+        return FAIL; // Invalid ptr
+    if (replicas <= 0)
+        replicas = trie_numa_nodes(); // One for each node
+    r->num = replicas;
+    r->replicas = malloc(replicas*sizeof(*(r->replicas)));
+    assert(r->replicas);
+    for (i = 0; i < replicas; i++) {
+        prev = trie_mem_prefer(i);
+        r->replicas[i] = trie_mem_alloc(sizeof(trie_t));
+        assert(r->replicas[i]);
+        trie_init(r->replicas[i]);
+        trie_mem_prefer(prev);
+    }
+#ifndef NO_PTHREAD
+    pthread_mutex_init(&(r->write_lock), NULL);
+#endif
+    return SUCCESS;
+}
+
+void trie_replicated_clear(trie_replicated_t * r) {
+    int i;
+
+    if ((r == NULL) || (r->replicas == NULL))
+        return; // Invalid ptr
+    for (i = 0; i < r->num; i++) {
+        trie_clear(r->replicas[i]);
+        trie_mem_free(r->replicas[i]);
+    }
+    free(r->replicas);
+    r->replicas = NULL;
+    r->num = 0;
+#ifndef NO_PTHREAD
+    pthread_mutex_destroy(&(r->write_lock));
+#endif
+}
+
+trie_ptr_t trie_replicated_local(trie_replicated_t * r) {
+    return r->replicas[trie_mem_current_node() % r->num];
+}
+
+// Adds or removes in every replica. If a replica cannot add the key it was missing everywhere,
+// so it is removed again from the ones before
+static
+int trie_replicated_write(trie_replicated_t * r, const DATA_t * arr, int len, int add) {
+    int i, prev, res = SUCCESS;
+
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(r->write_lock));
+#endif
+    for (i = 0; i < r->num; i++) {
+        prev = trie_mem_prefer(i);
+        if (add)
+            res = trie_add(r->replicas[i], arr, len);
+        else
+            trie_remove(r->replicas[i], arr, len);
+        trie_mem_prefer(prev);
+        if (res != SUCCESS)
+            break;
+    }
+    while ((res != SUCCESS) && (--i >= 0))
+        trie_remove(r->replicas[i], arr, len);
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(r->write_lock));
+#endif
+    return res;
+}
+
+int trie_replicated_add(trie_replicated_t * r, const DATA_t * arr, int len) {
+    if ((r == NULL) || (arr == NULL))
+        return FAIL; // Invalid ptr
+    return trie_replicated_write(r, arr, len, 1);
+}
+
+void trie_replicated_remove(trie_replicated_t * r, const DATA_t * arr, int len) {
+    if ((r == NULL) || (arr == NULL))
+        return; // Invalid ptr
+    trie_replicated_write(r, arr, len, 0);
+}
+
+int trie_replicated_find(trie_replicated_t * r, const DATA_t * arr, int len) {
+    if (r == NULL)
+        return 0; // Invalid ptr
+    return trie_find(trie_replicated_local(r), arr, len);
+}
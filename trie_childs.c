@@ -24,11 +24,16 @@
 
 // Child relocation options
 #define CHILD_RELOC_FACTOR 1.618 // A good choiche is between 1.5 and 2
-#define CHILD_RELOC_MAX ((int)sizeof(DATA_t)*8) // Maximum number of preventive allocs,
+#define CHILD_RELOC_MAX ((sizeof(DATA_t) == 1)?8:INT_MAX) // Maximum number of preventive allocs,
 // It might depend on what you are doing: for example if you are storing english word lowercase
 // setting it to 26 would be a good option (26 chars in alphabet)
-// Keep in mind that phisical maximum number of child is sizeof(DATA_t)*8
+// Wide alphabets (token ids) are sparse, so there the child array always grows geometrically
 // Set to INT_MAX to disable
+#define CHILD_MAX ((sizeof(DATA_t) >= sizeof(int))?INT_MAX:(1 << (8*sizeof(DATA_t)))) // Size of the alphabet,
+// phisical maximum number of childs
+
+// Child search options
+#define CHILD_LINEAR_SEARCH 8 // Below this number of childs a linear scan is faster than a binary search
 
 #include <stdio.h>
 
@@ -37,8 +42,8 @@ static inline
 void trie_add_first_n_childs(struct _childs * const childs, int n) {
     assert(childs->childs == NULL && childs->firsts == NULL); // First time here
     childs->child_alloc = n; // For the first allocs two childrens
-    childs->childs = malloc((childs->child_alloc)*sizeof*(childs->childs));
-    childs->firsts = malloc((childs->child_alloc)*sizeof*(childs->firsts));
+    childs->childs = trie_mem_alloc((childs->child_alloc)*sizeof*(childs->childs));
+    childs->firsts = trie_mem_alloc((childs->child_alloc)*sizeof*(childs->firsts));
     assert(childs->childs != NULL && childs->firsts != NULL); // Both success
     childs->child_num = n;
 }
@@ -75,9 +80,9 @@ static inline
 void trie_destroy_childs(struct _childs * const childs) {
     int i;
     for (i = 0; i < childs->child_num; i++)
-        free(childs->childs[i]);
-    free(childs->childs);
-    free(childs->firsts);
+        trie_node_free(trie_node_ptr(childs->childs[i]));
+    trie_mem_free(childs->childs);
+    trie_mem_free(childs->firsts);
     // This may not be necessary, but for a well done work resets also them
     childs->child_alloc = 0;
     childs->child_num = 0;
@@ -85,12 +90,11 @@ void trie_destroy_childs(struct _childs * const childs) {
     childs->firsts = NULL;
 }
 
-// This function makes comparations with memcp
+// This function compares symbols numerically, so wide DATA_t are sorted correctly
 static inline
 int trie_search_in_childs(int * const res, const struct _childs * const childs, const DATA_t to_search) {
     const DATA_t * begin, * end; // Data is searched into an array of DATA_t
     const DATA_t * mid;
-    int memcmp_res;
 
     // This function does not need to lock mutexes
     // because it actually doesn't read childs
@@ -98,13 +102,19 @@ int trie_search_in_childs(int * const res, const struct _childs * const childs,
     begin = childs->firsts; // Begin of the array
     end = childs->firsts + childs->child_num; // End of the array
 
-    while (begin < end) {
+    if (childs->child_num <= CHILD_LINEAR_SEARCH) { // Few childs, scans them
+        while ((begin < end) && (*begin < to_search))
+            begin++;
+        *res = (begin - childs->firsts); // Either the element, or where it should be saved
+        return (begin < end) && (*begin == to_search);
+    }
+
+    while (begin < end) { // Large (sparse) alphabets, binary search
         mid = begin + (end - begin) / 2; // Gets the middle point
-        memcmp_res = memcmp(mid, &to_search, sizeof(*mid));
-        if (memcmp_res > 0) { // to_search may be before (*mid > to_search)
+        if (*mid > to_search) { // to_search may be before
             end = mid;
             continue; // next loop
-        } else if (memcmp_res < 0) { // to_search may be after (*mid < to_search)
+        } else if (*mid < to_search) { // to_search may be after
             begin = mid + 1; // Begin has been compared, skip to the next one
             continue; // next loop
         } else { // exact match (*mid == to_search)
@@ -134,8 +144,10 @@ void trie_insert_child(struct _childs * const childs, const int new_pos) {
             if (childs->child_alloc > CHILD_RELOC_MAX) // If reached maximum
                 childs->child_alloc = CHILD_RELOC_MAX; // Sets to the maximum
         }
-        childs->childs = realloc(childs->childs, sizeof*(childs->childs)*(childs->child_alloc)); // Actually allocs
-        childs->firsts = realloc(childs->firsts, sizeof*(childs->firsts)*(childs->child_alloc)); // Actually allocs
+        if (childs->child_alloc > CHILD_MAX) // More childs than symbols are never used
+            childs->child_alloc = CHILD_MAX;
+        childs->childs = trie_mem_realloc(childs->childs, sizeof*(childs->childs)*(childs->child_alloc)); // Actually allocs
+        childs->firsts = trie_mem_realloc(childs->firsts, sizeof*(childs->firsts)*(childs->child_alloc)); // Actually allocs
     } // else reallocation is not needed
 
     childs->child_num++; // Increases the number of children
@@ -0,0 +1,685 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdio.h> // FILE, rename
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <assert.h>
+#include <fcntl.h> // open
+#include <unistd.h> // fsync, unlink
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#endif
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_io.c (__trie_fwrite_symbols, __trie_fread_symbols), trie_utils.c (trie_own_data)
+
+/*
+   Incremental checkpoints. Every writer stores the current generation in the nodes of its path
+   (trie_touch), a checkpoint takes a new generation: subtrees whose root has an older one did not
+   change since the previous checkpoint, which is referenced instead of writing them again.
+
+   Files, for a given path:
+   path.chain   number of the last checkpoint
+   path.N       checkpoint N
+   Header: "TRIC", sizeof(DATA_t), int32 N, int32 base (checkpoint referenced, -1 for a full one).
+   Root:   int32 len (0 for the empty trie, -(len+1) if a key ends there, len+1 otherwise),
+           len symbols, int32 child num, childs.
+   Child:  int32 len as above, first symbol, len symbols, int32 child num, childs.
+           Or int32 0 and the first symbol: the subtree starting with the same key in the base.
+   A chain is loaded from the full checkpoint on, each one stealing unchanged subtrees from the
+   trie of its base. The merge rewrites the last checkpoint of a long chain as a full one.
+*/
+
+#define TRIE_CKPT_MAGIC "TRIC"
+
+typedef struct {
+    FILE * fp;
+    trie_ptr_t base; // Trie of the base checkpoint, NULL for a full one
+    DATA_t * key; // Key where the current node begins
+    int len, alloc;
+    long long nodes, refs;
+} trie_ckpt_io_t;
+
+// path.N, in a new buffer
+static
+char * trie_ckpt_name(const char * path, int seq, const char * suffix) {
+    char * name = malloc(strlen(path) + strlen(suffix) + 16);
+    assert(name);
+    if (seq >= 0)
+        sprintf(name, "%s.%d%s", path, seq, suffix);
+    else
+        sprintf(name, "%s%s", path, suffix);
+    return name;
+}
+
+static inline
+void trie_ckpt_lock(trie_ckpt_t * c) {
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(c->lock));
+#else
+    (void)c;
+#endif
+}
+
+static inline
+void trie_ckpt_unlock(trie_ckpt_t * c) {
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(c->lock));
+#else
+    (void)c;
+#endif
+}
+
+static
+int trie_ckpt_sync_dir(const char * path) {
+    char * dir;
+    char * slash;
+    int fd, res;
+
+    dir = trie_ckpt_name(path, -1, "");
+    slash = strrchr(dir, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == dir)
+        slash[1] = '\0'; // Root directory
+    else
+        *slash = '\0';
+    fd = open(dir, O_RDONLY);
+    free(dir);
+    if (fd < 0)
+        return FAIL;
+    res = (fsync(fd) == 0)?SUCCESS:FAIL;
+    close(fd);
+    return res;
+}
+
+//   =================
+//   ===   WRITE   ===
+//   =================
+
+static inline
+int trie_ckpt_write_len(FILE * fp, struct _trie * t) {
+    int32_t len = trie_data_len(t) + 1;
+    if (trie_data_end(t))
+        len = -len;
+    return (fwrite(&len, sizeof(len), 1, fp) == 1)?SUCCESS:FAIL;
+}
+
+// Writes data and childs of t, which is readlocked
+static
+int trie_ckpt_write_node(trie_ckpt_io_t * io, struct _trie * t, int since) {
+    int i, res;
+    int32_t tmp;
+    struct _trie * child;
+
+    io->nodes++;
+    if (__trie_fwrite_symbols(io->fp, trie_data(t), trie_data_len(t)) != (size_t)trie_data_len(t))
+        return FAIL;
+    tmp = trie_get_child_num(t);
+    if (fwrite(&tmp, sizeof(tmp), 1, io->fp) != 1)
+        return FAIL;
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        child = trie_get_child(t, i);
+        trie_readlock(&(child->lock));
+        if (trie_get_gen(child) <= since) { // Unchanged since the base
+            tmp = 0;
+            res = (fwrite(&tmp, sizeof(tmp), 1, io->fp) == 1)?SUCCESS:FAIL;
+            if (__trie_fwrite_symbols(io->fp, &(trie_get_first(t, i)), 1) != 1)
+                res = FAIL;
+            io->refs++;
+        } else {
+            res = trie_ckpt_write_len(io->fp, child);
+            if (__trie_fwrite_symbols(io->fp, &(trie_get_first(t, i)), 1) != 1)
+                res = FAIL;
+            if (res == SUCCESS)
+                res = trie_ckpt_write_node(io, child, since);
+        }
+        trie_unlock(&(child->lock));
+        if (res != SUCCESS)
+            return FAIL;
+    }
+    return SUCCESS;
+}
+
+// Writes checkpoint seq of t to fp, subtrees not changed after generation since are references to base
+static
+int trie_ckpt_write_file(trie_ckpt_io_t * io, trie_ptr_t t, int seq, int base, int since) {
+    int32_t header[2];
+    int res;
+
+    header[0] = seq;
+    header[1] = base;
+    if ((fwrite(TRIE_CKPT_MAGIC, 1, strlen(TRIE_CKPT_MAGIC), io->fp) != strlen(TRIE_CKPT_MAGIC)) ||
+        (putc((unsigned char)sizeof(DATA_t), io->fp) == EOF) ||
+        (fwrite(header, sizeof(header), 1, io->fp) != 1))
+        return FAIL;
+
+    trie_readlock(&(t->lock));
+    if (trie_is_empty(t)) {
+        header[0] = 0;
+        res = (fwrite(header, sizeof(header[0]), 1, io->fp) == 1)?SUCCESS:FAIL;
+    } else {
+        res = trie_ckpt_write_len(io->fp, t);
+        if (res == SUCCESS)
+            res = trie_ckpt_write_node(io, t, since);
+    }
+    trie_unlock(&(t->lock));
+    return res;
+}
+
+//   ================
+//   ===   READ   ===
+//   ================
+
+// Unlinks the node beginning with key from the trie, an empty node takes its place. NULL if not found
+static
+struct _trie * trie_ckpt_steal(trie_ptr_t t, const DATA_t * key, int len) {
+    int mismatch, pos, offset;
+    struct _trie * cur, * next;
+
+    if ((t == NULL) || trie_is_empty(t))
+        return NULL;
+    cur = t;
+    offset = 0;
+    while (1) {
+        mismatch = find_first_mismatch(key + offset, len - offset, trie_data(cur), trie_data_len(cur));
+        if ((mismatch < trie_data_len(cur)) || (offset + mismatch >= len) ||
+            !trie_search_in_childs(&pos, &(cur->childs), key[offset + mismatch]))
+            return NULL; // The key ends inside cur, or its node is missing
+        offset += mismatch + 1;
+        next = trie_get_child(cur, pos);
+        if (offset == len) { // next begins with key
+            trie_own_data(next, trie_data(cur), trie_data_len(cur)); // cur is going to be freed
+            trie_init_new_child(cur, pos); // Placeholder, freed with the rest of t
+            return next;
+        }
+        cur = next;
+    }
+}
+
+static inline
+int trie_ckpt_read_len(FILE * fp, int32_t * len) {
+    return (fread(len, sizeof(*len), 1, fp) == 1)?SUCCESS:FAIL;
+}
+
+static
+int trie_ckpt_read_node(trie_ckpt_io_t * io, struct _trie * t);
+
+// Reads child pos of parent, its key is io->key
+static
+int trie_ckpt_read_child(trie_ckpt_io_t * io, struct _trie * parent, int pos) {
+    int32_t len;
+    struct _trie * t;
+    int res;
+
+    trie_set_child(parent, pos, NULL); // Until allocated
+    if ((trie_ckpt_read_len(io->fp, &len) != SUCCESS) || (len == INT32_MIN))
+        return FAIL;
+    if (io->len == io->alloc) { // Doubles
+        io->alloc = (io->alloc == 0)?64:(2*io->alloc);
+        io->key = realloc(io->key, io->alloc*sizeof(*(io->key)));
+        assert(io->key);
+    }
+    if (__trie_fread_symbols(io->fp, &(trie_get_first(parent, pos)), 1) != 1)
+        return FAIL;
+    io->key[io->len++] = trie_get_first(parent, pos);
+
+    if (len == 0) { // Reference to the base
+        io->refs++;
+        t = trie_ckpt_steal(io->base, io->key, io->len);
+        io->len--;
+        if (t == NULL)
+            return FAIL;
+        trie_set_child(parent, pos, t);
+        return SUCCESS;
+    }
+    trie_init_new_child(parent, pos);
+    t = trie_get_child(parent, pos);
+    if (len < 0) {
+        trie_set_data_end(t);
+        len = -len;
+    }
+    trie_data_len(t) = len - 1;
+    res = trie_ckpt_read_node(io, t);
+    io->len--;
+    return res;
+}
+
+// Reads data and childs of t, its length is already set
+static
+int trie_ckpt_read_node(trie_ckpt_io_t * io, struct _trie * t) {
+    int32_t num;
+    int i, start;
+
+    io->nodes++;
+    t->data.dealloc = 1;
+    trie_set_data(t, trie_label_alloc(trie_data_len(t) + 1)); // + 1 avoids malloc(0)
+    assert(t->data.data);
+    if ((__trie_fread_symbols(io->fp, (DATA_t*)trie_data(t), trie_data_len(t)) != (size_t)trie_data_len(t)) ||
+        (trie_ckpt_read_len(io->fp, &num) != SUCCESS) || (num < 0))
+        return FAIL;
+
+    start = io->len; // Key of the childs
+    if (io->len + trie_data_len(t) >= io->alloc) {
+        io->alloc = 2*(io->len + trie_data_len(t) + 1);
+        io->key = realloc(io->key, io->alloc*sizeof(*(io->key)));
+        assert(io->key);
+    }
+    memcpy(io->key + io->len, trie_data(t), trie_data_len(t)*sizeof(*(io->key)));
+    io->len += trie_data_len(t);
+
+    if (num > 0)
+        trie_add_first_n_childs(&(t->childs), num);
+    t->count = trie_data_end(t);
+    for (i = 0; i < num; i++) {
+        if (trie_ckpt_read_child(io, t, i) != SUCCESS) {
+            trie_get_child_num(t) = i + (trie_get_childs(t)[i] != 0); // Clears only those read
+            return FAIL;
+        }
+        t->count += trie_get_child(t, i)->count;
+    }
+    io->len = start;
+    return SUCCESS;
+}
+
+// Opens checkpoint seq, reads the header
+static
+FILE * trie_ckpt_open_file(const char * path, int seq, int * base) {
+    char magic[sizeof(TRIE_CKPT_MAGIC)];
+    char * name;
+    int32_t header[2];
+    FILE * fp;
+
+    name = trie_ckpt_name(path, seq, "");
+    fp = fopen(name, "rb");
+    free(name);
+    if (fp == NULL)
+        return NULL;
+    if ((fread(magic, 1, strlen(TRIE_CKPT_MAGIC), fp) != strlen(TRIE_CKPT_MAGIC)) ||
+        (memcmp(magic, TRIE_CKPT_MAGIC, strlen(TRIE_CKPT_MAGIC)) != 0) ||
+        (getc(fp) != (int)sizeof(DATA_t)) ||
+        (fread(header, sizeof(header), 1, fp) != 1) || (header[0] != seq)) {
+        fclose(fp);
+        return NULL;
+    }
+    *base = header[1];
+    return fp;
+}
+
+// Reads one checkpoint into t (empty), taking unchanged subtrees from base
+static
+int trie_ckpt_read_file(FILE * fp, trie_ptr_t t, trie_ptr_t base, long long * nodes) {
+    trie_ckpt_io_t io;
+    int32_t len;
+    int res;
+
+    memset(&io, 0, sizeof(io));
+    io.fp = fp;
+    io.base = base;
+    if (trie_ckpt_read_len(fp, &len) != SUCCESS)
+        return FAIL;
+    if (len == 0) // Empty trie
+        return SUCCESS;
+    if (len < 0) {
+        trie_set_data_end(t);
+        len = -len;
+    }
+    trie_data_len(t) = len - 1;
+    res = trie_ckpt_read_node(&io, t);
+    if (trie_get_childs(t) == NULL) // As trie_fread, a root with keys always has childs
+        trie_alloc_childs(&(t->childs));
+    free(io.key);
+    *nodes += io.nodes;
+    return res;
+}
+
+// Loads checkpoint seq and its bases into t. Sets the first checkpoint of the chain
+static
+int trie_ckpt_load(const char * path, int seq, trie_ptr_t t, int * first, long long * nodes) {
+    trie_t tmp[2];
+    trie_ptr_t cur, base;
+    trie_allocator_t * allocator;
+    FILE ** files;
+    int num, alloc, i, res, next;
+
+    allocator = trie_mem_enter(t); // Nodes read, and those taken from the bases, belong to t
+    files = NULL;
+    num = alloc = 0;
+    while (seq >= 0) { // Opens the chain, from the last one
+        if (num == alloc) {
+            alloc = (alloc == 0)?8:(2*alloc);
+            files = realloc(files, alloc*sizeof(*files));
+            assert(files);
+        }
+        *first = seq;
+        files[num] = trie_ckpt_open_file(path, seq, &next);
+        if ((files[num] == NULL) || (next >= seq)) { // Missing, or not a chain
+            res = FAIL;
+            if (files[num] != NULL)
+                num++;
+            goto end;
+        }
+        num++;
+        seq = next;
+    }
+
+    trie_clear_keys(t); // Also reinits it, keeping its allocator
+    res = SUCCESS;
+    base = NULL;
+    for (i = num - 1; i >= 0; i--) { // From the full one
+        cur = (i == 0)?t:(tmp + (i%2));
+        if (cur != t) {
+            trie_init(cur);
+            cur->data.allocator = t->data.allocator; // Its subtrees may move to t
+            trie_mem_ref(cur->data.allocator); // Released by trie_clear
+        }
+        if (res == SUCCESS)
+            res = trie_ckpt_read_file(files[i], cur, base, nodes);
+        if (base != NULL)
+            trie_clear(base);
+        base = cur;
+    }
+end:
+    for (i = 0; i < num; i++)
+        fclose(files[i]);
+    free(files);
+    trie_mem_leave(allocator);
+    return res;
+}
+
+// Writes t as checkpoint seq: temporary file, then rename
+static
+int trie_ckpt_write_seq(trie_ckpt_t * c, trie_ptr_t t, int seq, int base, int since, long long * bytes) {
+    trie_ckpt_io_t io;
+    char * tmp, * name;
+    FILE * fp;
+    int res;
+
+    tmp = trie_ckpt_name(c->path, seq, ".tmp");
+    name = trie_ckpt_name(c->path, seq, "");
+    memset(&io, 0, sizeof(io));
+    res = FAIL;
+    fp = fopen(tmp, "wb");
+    if (fp != NULL) {
+        io.fp = fp;
+        res = trie_ckpt_write_file(&io, t, seq, base, since);
+        if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0))
+            res = FAIL;
+        *bytes = ftell(fp);
+        fclose(fp);
+    }
+    if ((res == SUCCESS) && (rename(tmp, name) != 0))
+        res = FAIL;
+    if (res != SUCCESS)
+        unlink(tmp);
+    free(tmp);
+    free(name);
+
+    trie_ckpt_lock(c);
+    c->stats.nodes_written += io.nodes;
+    c->stats.refs_written += io.refs;
+    trie_ckpt_unlock(c);
+    return res;
+}
+
+// Rewrites the last checkpoint as a full one, then removes the older ones
+static
+int trie_ckpt_merge_now(trie_ckpt_t * c) {
+    trie_t t;
+    long long bytes, nodes;
+    int seq, first, i, res;
+
+    trie_ckpt_lock(c);
+    seq = c->last;
+    first = c->first;
+    trie_ckpt_unlock(c);
+    if (seq == first)
+        return SUCCESS; // Already full
+
+    nodes = 0;
+    trie_init(&t);
+    res = trie_ckpt_load(c->path, seq, &t, &i, &nodes);
+    if (res == SUCCESS)
+        res = trie_ckpt_write_seq(c, &t, seq, -1, -1, &bytes); // Replaces it, same content
+    trie_clear(&t);
+    if ((res == SUCCESS) && (trie_ckpt_sync_dir(c->path) == SUCCESS)) {
+        for (i = first; i < seq; i++) { // Not needed anymore
+            char * name = trie_ckpt_name(c->path, i, "");
+            unlink(name);
+            free(name);
+        }
+        trie_ckpt_lock(c);
+        c->first = seq;
+        c->stats.merges++;
+        c->stats.merge_bytes += bytes;
+        trie_ckpt_unlock(c);
+    }
+    return res;
+}
+
+#ifndef NO_PTHREAD
+static
+void * trie_ckpt_merge_thread(void * arg) {
+    trie_ckpt_t * c = arg;
+    trie_ckpt_merge_now(c);
+    trie_ckpt_lock(c);
+    c->merging = 0;
+    pthread_cond_broadcast(&(c->merged));
+    trie_ckpt_unlock(c);
+    return NULL;
+}
+#endif
+
+//   ===============
+//   ===   API   ===
+//   ===============
+
+int trie_ckpt_open(trie_ckpt_t * c, trie_ptr_t t, const char * path, int max_chain) {
+    char * name;
+    FILE * fp;
+    int seq, res;
+    long long nodes;
+
+    if ((c == NULL) || (t == NULL) || (path == NULL) || (path[0] == '\0'))
+        return FAIL; // Invalid ptr
+    memset(c, 0, sizeof(*c));
+    c->trie = t;
+    c->path = trie_ckpt_name(path, -1, "");
+    c->max_chain = (max_chain > 0)?max_chain:1;
+    c->first = c->last = -1;
+    c->since = -1; // Next one is full
+
+    name = trie_ckpt_name(path, -1, ".chain");
+    fp = fopen(name, "r");
+    free(name);
+    res = SUCCESS;
+    if (fp != NULL) {
+        if (fscanf(fp, "%d", &seq) != 1)
+            seq = -1;
+        fclose(fp);
+        if (seq >= 0) {
+            nodes = 0;
+            res = trie_ckpt_load(path, seq, t, &(c->first), &nodes);
+            c->last = seq;
+            c->stats.nodes_read = nodes;
+            // Loaded nodes have this generation or an older one, as the checkpoint just read
+            c->since = trie_atomic_add_sc(&trie_generation, 1) - 1;
+        }
+    }
+    if (res != SUCCESS) {
+        free(c->path);
+        c->path = NULL;
+        return FAIL;
+    }
+#ifndef NO_PTHREAD
+    pthread_mutex_init(&(c->lock), NULL);
+    pthread_mutex_init(&(c->write_lock), NULL);
+    pthread_cond_init(&(c->merged), NULL);
+#endif
+    return SUCCESS;
+}
+
+void trie_ckpt_close(trie_ckpt_t * c) {
+    if ((c == NULL) || (c->path == NULL))
+        return; // Invalid ptr
+#ifndef NO_PTHREAD
+    trie_ckpt_lock(c);
+    while (c->merging)
+        pthread_cond_wait(&(c->merged), &(c->lock));
+    trie_ckpt_unlock(c);
+    if (c->merger_started)
+        pthread_join(c->merger, NULL);
+    pthread_mutex_destroy(&(c->lock));
+    pthread_mutex_destroy(&(c->write_lock));
+    pthread_cond_destroy(&(c->merged));
+#endif
+    free(c->path);
+    c->path = NULL;
+}
+
+int trie_ckpt_write(trie_ckpt_t * c) {
+    char * tmp, * name;
+    FILE * fp;
+    int seq, base, since, gen, res;
+    long long bytes;
+
+    if ((c == NULL) || (c->path == NULL))
+        return FAIL; // Invalid ptr
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(c->write_lock)); // One at a time, each references the previous
+#endif
+    // Writers after this take a newer generation
+    gen = trie_atomic_add_sc(&trie_generation, 1) - 1;
+    trie_ckpt_lock(c);
+    seq = c->last + 1;
+    base = c->last;
+    since = (base >= 0)?c->since:-1;
+    trie_ckpt_unlock(c);
+
+    bytes = 0;
+    res = trie_ckpt_write_seq(c, c->trie, seq, (since >= 0)?base:-1, since, &bytes);
+    if (res == SUCCESS) { // Now it is the last one
+        tmp = trie_ckpt_name(c->path, -1, ".chain.tmp");
+        name = trie_ckpt_name(c->path, -1, ".chain");
+        fp = fopen(tmp, "w");
+        res = ((fp != NULL) && (fprintf(fp, "%d\n", seq) > 0))?SUCCESS:FAIL;
+        if (fp != NULL) {
+            if ((fflush(fp) != 0) || (fsync(fileno(fp)) != 0))
+                res = FAIL;
+            fclose(fp);
+        }
+        if ((res == SUCCESS) && ((rename(tmp, name) != 0) || (trie_ckpt_sync_dir(c->path) != SUCCESS)))
+            res = FAIL;
+        free(tmp);
+        free(name);
+    }
+
+    trie_ckpt_lock(c);
+    if (res == SUCCESS) {
+        c->last = seq;
+        c->since = gen;
+        if (since < 0) // Full
+            c->first = seq;
+        c->stats.checkpoints++;
+        c->stats.bytes += bytes;
+        c->stats.last_bytes = bytes;
+    }
+    seq = c->last - c->first + 1; // Chain length
+#ifndef NO_PTHREAD
+    if ((res == SUCCESS) && (seq > c->max_chain) && !c->merging) { // Merges in background
+        c->merging = 1;
+        trie_ckpt_unlock(c);
+        if (c->merger_started)
+            pthread_join(c->merger, NULL);
+        c->merger_started = (pthread_create(&(c->merger), NULL, trie_ckpt_merge_thread, c) == 0);
+        if (!c->merger_started) { // No thread, merges here
+            trie_ckpt_merge_now(c);
+            trie_ckpt_lock(c);
+            c->merging = 0;
+            trie_ckpt_unlock(c);
+        }
+        trie_ckpt_lock(c);
+    }
+    trie_ckpt_unlock(c);
+    pthread_mutex_unlock(&(c->write_lock));
+#else
+    trie_ckpt_unlock(c);
+    if ((res == SUCCESS) && (seq > c->max_chain))
+        trie_ckpt_merge_now(c);
+#endif
+    return res;
+}
+
+int trie_ckpt_merge(trie_ckpt_t * c) {
+    int res;
+
+    if ((c == NULL) || (c->path == NULL))
+        return FAIL; // Invalid ptr
+#ifndef NO_PTHREAD
+    trie_ckpt_lock(c);
+    while (c->merging)
+        pthread_cond_wait(&(c->merged), &(c->lock));
+    c->merging = 1;
+    trie_ckpt_unlock(c);
+#endif
+    res = trie_ckpt_merge_now(c);
+#ifndef NO_PTHREAD
+    trie_ckpt_lock(c);
+    c->merging = 0;
+    pthread_cond_broadcast(&(c->merged));
+    trie_ckpt_unlock(c);
+#endif
+    return res;
+}
+
+void trie_ckpt_stats(trie_ckpt_t * c, trie_ckpt_stats_t * stats) {
+    trie_ckpt_lock(c);
+    *stats = c->stats;
+    stats->chain = (c->last >= 0)?(c->last - c->first + 1):0;
+    trie_ckpt_unlock(c);
+}
+
+int trie_ckpt_remove(const char * path) {
+    char * name;
+    FILE * fp;
+    int seq, base, res;
+
+    if (path == NULL)
+        return FAIL; // Invalid ptr
+    name = trie_ckpt_name(path, -1, ".chain");
+    fp = fopen(name, "r");
+    if ((fp == NULL) || (fscanf(fp, "%d", &seq) != 1))
+        seq = -1;
+    if (fp != NULL)
+        fclose(fp);
+    res = unlink(name);
+    free(name);
+    while (seq >= 0) { // The chain, from the last one
+        fp = trie_ckpt_open_file(path, seq, &base);
+        if (fp == NULL)
+            break;
+        fclose(fp);
+        name = trie_ckpt_name(path, seq, "");
+        unlink(name);
+        free(name);
+        seq = (base < seq)?base:-1;
+    }
+    return (res == 0)?SUCCESS:FAIL;
+}
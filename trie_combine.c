@@ -0,0 +1,240 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <string.h> // memset
+#include <assert.h>
+#include <stdint.h> // uintptr_t
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#include <sched.h> // sched_yield
+#endif
+#include "trie.h"
+
+// This source uses functions from:
+//    trie.c (trie_add, trie_add_helper, trie_path_*, trie_remove), trie_utils.c (trie_data_compare)
+
+/*
+   Flat combining. When many writers go down the same path each one takes the write lock of the
+   hot node in turn, and the lock bounces between them. Here a writer claims a free slot, fills
+   it and publishes it, then tries the combiner lock: the one getting it applies every published
+   operation (its own included) and marks them applied, the others wait on their own slot, which
+   stays in their cache until it changes. The adds of a batch are applied in key order with a
+   single descent: the path to the node where their keys part is locked once,
+   and kept while each one goes in below it. Removes come after them, one at a time: every
+   operation of a batch is pending at once, so any order is one they could have had.
+
+   Slots are claimed with a compare and swap, starting from one chosen once for each thread; if
+   every slot is taken the operation is applied directly. A combiner makes a few passes over the
+   slots, then leaves the lock to someone else.
+*/
+
+#define TRIE_COMBINER_FREE      0
+#define TRIE_COMBINER_FILLING   1 // Claimed, not published yet
+#define TRIE_COMBINER_PUBLISHED 2
+#define TRIE_COMBINER_APPLIED   3 // res is set, the owner frees it
+#define TRIE_COMBINER_ADD       0
+#define TRIE_COMBINER_REMOVE    1
+#define TRIE_COMBINER_PASSES    4 // Over the slots, for each combiner
+#define TRIE_COMBINER_SPINS     64 // Checks of the slot before yielding
+
+void trie_combiner_init(trie_combiner_t * c, trie_ptr_t t) {
+    assert(((uintptr_t)(c->slots) & 63) == 0); // Slots do not share cache lines
+    memset(c, 0, sizeof(*c));
+    c->trie = t;
+#ifndef NO_PTHREAD
+    pthread_mutex_init(&(c->lock), NULL);
+#endif
+}
+
+void trie_combiner_clear(trie_combiner_t * c) {
+#ifndef NO_PTHREAD
+    pthread_mutex_destroy(&(c->lock));
+#endif
+    c->trie = NULL;
+}
+
+static inline
+int trie_combiner_apply(trie_combiner_t * c, int op, const DATA_t * arr, int len) {
+    if (op == TRIE_COMBINER_ADD)
+        return trie_add(c->trie, arr, len);
+    trie_remove(c->trie, arr, len);
+    return SUCCESS;
+}
+
+#ifndef NO_PTHREAD
+
+static __thread int trie_combiner_hint = -1; // First slot tried by the thread
+static int trie_combiner_threads = 0;
+
+// Adds num sorted keys, sharing the first symbols, in one descent: the path down to the deepest
+// node the common prefix goes beyond is readlocked once, and kept while each key is added below
+// that node (its parent keeps it from going away). Sets res[i] as trie_add
+static
+void trie_add_sorted(trie_ptr_t t, const DATA_t * const * arrs, const int * lens, int num, int * res) {
+    int i, common, offset, mismatch, pos, len, pool;
+    struct _trie * hot, * next;
+    trie_allocator_t * allocator;
+    trie_path_t path;
+
+    if (num == 0)
+        return;
+    common = find_first_mismatch(arrs[0], lens[0], arrs[num - 1], lens[num - 1]); // Sorted, so of every key
+    len = 0;
+    for (i = 0; i < num; i++)
+        len = (lens[i] > len)?lens[i]:len;
+
+    allocator = trie_mem_enter(t);
+    trie_readlock(&(t->lock));
+    if (trie_is_empty(t) || (trie_path_init(&path, len) != SUCCESS)) { // One at a time
+        trie_unlock(&(t->lock));
+        trie_mem_leave(allocator);
+        for (i = 0; i < num; i++)
+            res[i] = trie_add(t, arrs[i], lens[i]);
+        return;
+    }
+    hot = t;
+    offset = 0; // Where the data of hot begins in the keys
+    while (1) {
+        mismatch = find_first_mismatch(arrs[0] + offset, common - offset, trie_data(hot), trie_data_len(hot));
+        if ((mismatch < trie_data_len(hot)) || (offset + mismatch == common) ||
+            !trie_search_in_childs(&pos, &(hot->childs), arrs[0][offset + mismatch]))
+            break; // Keys go different ways in hot
+        next = trie_get_child(hot, pos);
+        trie_readlock(&(next->lock));
+        path.nodes[path.depth++] = hot;
+        offset += mismatch + 1;
+        hot = next;
+    }
+
+    for (i = 0; i < num; i++) {
+        if (i > 0)
+            trie_readlock(&(hot->lock));
+        if (trie_is_root(t, hot) && trie_is_empty(hot)) { // Emptied meanwhile
+            trie_unlock(&(hot->lock));
+            break;
+        }
+        pool = trie_mem_prefer(trie_mem_subtree(arrs[i], lens[i]));
+        res[i] = trie_add_helper(t, &path, hot, arrs[i] + offset, lens[i] - offset, 0); // Unlocks hot
+        trie_mem_prefer(pool);
+    }
+    trie_path_unlock(&path);
+    trie_mem_leave(allocator);
+    for (; i < num; i++)
+        res[i] = trie_add(t, arrs[i], lens[i]);
+}
+
+static inline
+int trie_combiner_compare(const trie_combiner_slot_t * a, const trie_combiner_slot_t * b) {
+    int res = trie_data_compare(a->arr, b->arr, (a->len < b->len)?a->len:b->len);
+
+    return (res != 0)?res:(a->len - b->len);
+}
+
+// Applies published operations, the caller holds the combiner lock
+static
+void trie_combiner_combine(trie_combiner_t * c) {
+    trie_combiner_slot_t * batch[TRIE_COMBINER_SLOTS], * slot;
+    const DATA_t * arrs[TRIE_COMBINER_SLOTS];
+    int lens[TRIE_COMBINER_SLOTS], res[TRIE_COMBINER_SLOTS];
+    int pass, i, j, num, adds;
+
+    for (pass = 0; pass < TRIE_COMBINER_PASSES; pass++) {
+        num = 0;
+        for (i = 0; i < TRIE_COMBINER_SLOTS; i++) {
+            if (__atomic_load_n(&(c->slots[i].state), __ATOMIC_ACQUIRE) != TRIE_COMBINER_PUBLISHED)
+                continue;
+            slot = &(c->slots[i]);
+            for (j = num; (j > 0) && (trie_combiner_compare(batch[j - 1], slot) > 0); j--)
+                batch[j] = batch[j - 1]; // Insertion sort, batches are short
+            batch[j] = slot;
+            num++;
+        }
+        if (num == 0)
+            break; // Nothing else published
+        for (i = adds = 0; i < num; i++) { // Adds, still sorted
+            if (batch[i]->op != TRIE_COMBINER_ADD)
+                continue;
+            arrs[adds] = batch[i]->arr;
+            lens[adds++] = batch[i]->len;
+        }
+        trie_add_sorted(c->trie, arrs, lens, adds, res);
+        for (i = adds = 0; i < num; i++) {
+            if (batch[i]->op == TRIE_COMBINER_ADD)
+                batch[i]->res = res[adds++];
+            else
+                batch[i]->res = trie_combiner_apply(c, batch[i]->op, batch[i]->arr, batch[i]->len);
+            __atomic_store_n(&(batch[i]->state), TRIE_COMBINER_APPLIED, __ATOMIC_RELEASE);
+        }
+        c->batches++;
+        c->combined += num;
+    }
+}
+
+static
+int trie_combiner_op(trie_combiner_t * c, int op, const DATA_t * arr, int len) {
+    trie_combiner_slot_t * slot = NULL;
+    int i, spins, expected, res;
+
+    if (trie_combiner_hint < 0)
+        trie_combiner_hint = __atomic_fetch_add(&trie_combiner_threads, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < TRIE_COMBINER_SLOTS; i++) { // Claims a slot
+        slot = &(c->slots[(trie_combiner_hint + i)%TRIE_COMBINER_SLOTS]);
+        expected = TRIE_COMBINER_FREE;
+        if (__atomic_compare_exchange_n(&(slot->state), &expected, TRIE_COMBINER_FILLING, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == TRIE_COMBINER_SLOTS) // Every slot is taken
+        return trie_combiner_apply(c, op, arr, len);
+    slot->op = op;
+    slot->arr = arr;
+    slot->len = len;
+    __atomic_store_n(&(slot->state), TRIE_COMBINER_PUBLISHED, __ATOMIC_RELEASE);
+
+    spins = 0;
+    while (__atomic_load_n(&(slot->state), __ATOMIC_ACQUIRE) != TRIE_COMBINER_APPLIED) {
+        if (pthread_mutex_trylock(&(c->lock)) == 0) { // This thread combines
+            trie_combiner_combine(c);
+            pthread_mutex_unlock(&(c->lock));
+            continue; // Its own operation is applied unless published too late, then again
+        }
+        if (++spins%TRIE_COMBINER_SPINS == 0)
+            sched_yield(); // Lets the combiner run
+    }
+    res = slot->res;
+    __atomic_store_n(&(slot->state), TRIE_COMBINER_FREE, __ATOMIC_RELEASE);
+    return res;
+}
+
+#else // NO_PTHREAD, there is no one to combine with
+
+#define trie_combiner_op(c, op, arr, len) trie_combiner_apply(c, op, arr, len)
+
+#endif // NO_PTHREAD
+
+int trie_combiner_add(trie_combiner_t * c, const DATA_t * arr, int len) {
+    if ((c == NULL) || (c->trie == NULL) || (arr == NULL))
+        return FAIL;
+    return trie_combiner_op(c, TRIE_COMBINER_ADD, arr, len);
+}
+
+void trie_combiner_remove(trie_combiner_t * c, const DATA_t * arr, int len) {
+    if ((c == NULL) || (c->trie == NULL) || (arr == NULL))
+        return;
+    trie_combiner_op(c, TRIE_COMBINER_REMOVE, arr, len);
+}
@@ -0,0 +1,320 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdio.h> // fwrite
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <stdint.h> // int32_t
+#include <assert.h>
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_utils.c, trie_childs.c, trie_mutex.c
+
+/*
+   Frozen double array trie. Each node of the trie is a unit, the root is unit 0.
+   Child of unit s starting with symbol c is t = base[s] + code(c), if check[t] == s.
+   The rest of the node data (tail compression of the labels) is tail[tail, tail + len),
+   info stores len and the end flag. Each transition is a single array access, there
+   is no search in childs.
+   links (first child and next sibling, as codes) are used only to iterate, so they are
+   kept apart from units.
+
+   Memory image, which is also the file format (it can be mmapped, see trie_da_map):
+   [ magic "TRID" ] [ 1 byte sizeof(DATA_t) ] [ 3 bytes 0 ] [ int32 unit_num ] [ int32 tail_len ]
+   [ units ] [ links ] [ tail ]
+   Only symbols up to 16 bits are supported, codes go from 1 to 2^16.
+*/
+
+#define TRIE_DA_MAGIC "TRID"
+#define TRIE_DA_HEADER 16 // Bytes
+#define TRIE_DA_FREE -1 // check of a free unit
+#define TRIE_DA_ROOT_CHECK -2 // check of the root, never a parent
+#define TRIE_DA_MAX_CODE ((sizeof(DATA_t) == 1)?256:65536)
+
+#define trie_da_code(c) ((int)((sizeof(DATA_t) == 1)?(unsigned char)(c):(uint16_t)(c)) + 1)
+#define trie_da_symbol(code) ((DATA_t)((code) - 1))
+#define trie_da_tail_len(d, s) ((d)->units[s].info >> 1)
+#define trie_da_end(d, s) ((d)->units[s].info & 1)
+
+struct _trie_da_build {
+    struct _trie_da_unit * units;
+    struct _trie_da_link * links;
+    int alloc; // Allocated units
+    int used; // One after the last used unit
+    int free_hint; // No free unit before this one
+    trie_arr_t tail;
+};
+
+static inline
+void trie_da_reserve(struct _trie_da_build * b, int num) {
+    int i;
+    if (num <= b->alloc)
+        return;
+    i = b->alloc;
+    b->alloc = (2*b->alloc > num)?(2*b->alloc):num; // Doubles
+    b->units = realloc(b->units, (b->alloc)*sizeof*(b->units));
+    b->links = realloc(b->links, (b->alloc)*sizeof*(b->links));
+    assert(b->units && b->links);
+    for (; i < b->alloc; i++) { // New units are free
+        b->units[i].base = 0;
+        b->units[i].check = TRIE_DA_FREE;
+        b->units[i].tail = 0;
+        b->units[i].info = 0;
+        b->links[i].child = 0;
+        b->links[i].sibling = 0;
+    }
+}
+
+static inline
+void trie_da_set_node(struct _trie_da_build * b, int s, struct _trie * t) {
+    b->units[s].tail = trie_arr_len(&(b->tail));
+    b->units[s].info = (trie_data_len(t) << 1) | (trie_data_end(t)?1:0);
+    trie_arr_substitute_end(&(b->tail), trie_arr_len(&(b->tail)), trie_data(t), trie_data_len(t));
+}
+
+// Places the childs of t, which is unit s, then their childs. t must be readlocked, and it is left locked
+static
+void trie_da_place(struct _trie * t, struct _trie_da_build * b, int s) {
+    struct _trie * next;
+    int i, base, slot;
+
+    if (trie_empty_childs(t))
+        return; // base is 0, no unit is checked by s
+
+    // First base where every child fits
+    base = b->free_hint - trie_da_code(trie_get_first(t, 0));
+    if (base < 1)
+        base = 1;
+    while (1) {
+        trie_da_reserve(b, base + TRIE_DA_MAX_CODE + 1);
+        for (i = 0; i < trie_get_child_num(t); i++)
+            if (b->units[base + trie_da_code(trie_get_first(t, i))].check != TRIE_DA_FREE)
+                break;
+        if (i == trie_get_child_num(t))
+            break;
+        base++;
+    }
+
+    b->units[s].base = base;
+    b->links[s].child = trie_da_code(trie_get_first(t, 0));
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        slot = base + trie_da_code(trie_get_first(t, i));
+        b->units[slot].check = s;
+        if (i + 1 < trie_get_child_num(t))
+            b->links[slot].sibling = trie_da_code(trie_get_first(t, i + 1));
+        if (slot >= b->used)
+            b->used = slot + 1;
+    }
+    while (b->units[b->free_hint].check != TRIE_DA_FREE)
+        b->free_hint++;
+
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        slot = base + trie_da_code(trie_get_first(t, i));
+        next = trie_get_child(t, i);
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        trie_da_set_node(b, slot, next);
+        trie_da_place(next, b, slot);
+        trie_unlock(&(next->lock));
+    }
+}
+
+// Points units, links and tail inside the memory image
+static
+int trie_da_attach(trie_da_t * d, const void * mem, size_t size) {
+    const unsigned char * bytes = mem;
+    int32_t unit_num, tail_len;
+
+    if ((size < TRIE_DA_HEADER) || (memcmp(bytes, TRIE_DA_MAGIC, 4) != 0) || (bytes[4] != sizeof(DATA_t)))
+        return FAIL;
+    memcpy(&unit_num, bytes + 8, sizeof(unit_num));
+    memcpy(&tail_len, bytes + 12, sizeof(tail_len));
+    if ((unit_num < 1) || (tail_len < 0) || (size < TRIE_DA_HEADER + (size_t)unit_num*(sizeof(*(d->units)) +
+         sizeof(*(d->links))) + (size_t)tail_len*sizeof(DATA_t)))
+        return FAIL; // Truncated
+
+    d->unit_num = unit_num;
+    d->tail_len = tail_len;
+    d->units = (const struct _trie_da_unit *)(bytes + TRIE_DA_HEADER);
+    d->links = (const struct _trie_da_link *)(d->units + unit_num);
+    d->tail = (const DATA_t *)(d->links + unit_num);
+    d->size = TRIE_DA_HEADER + (size_t)unit_num*(sizeof(*(d->units)) + sizeof(*(d->links))) +
+              (size_t)tail_len*sizeof(DATA_t);
+    return SUCCESS;
+}
+
+int trie_da_build(trie_ptr_t t, trie_da_t * d) {
+    struct _trie_da_build b;
+    unsigned char * image;
+    int32_t value;
+    size_t size;
+
+    if ((t == NULL) || (d == NULL) || (sizeof(DATA_t) > 2))
+        return FAIL; // Invalid ptr, or alphabet too large
+
+    memset(&b, 0, sizeof(b));
+    trie_arr_init(&(b.tail));
+    trie_da_reserve(&b, TRIE_DA_MAX_CODE + 1);
+    b.units[0].check = TRIE_DA_ROOT_CHECK;
+    b.used = b.free_hint = 1;
+
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    trie_da_set_node(&b, 0, t);
+    trie_da_place(t, &b, 0);
+    trie_unlock(&(t->lock));
+
+    // Builds the memory image, unused units at the end are dropped
+    size = TRIE_DA_HEADER + (size_t)b.used*(sizeof(*(b.units)) + sizeof(*(b.links))) +
+           (size_t)trie_arr_len(&(b.tail))*sizeof(DATA_t);
+    image = calloc(size, 1);
+    assert(image);
+    memcpy(image, TRIE_DA_MAGIC, 4);
+    image[4] = sizeof(DATA_t);
+    value = b.used;
+    memcpy(image + 8, &value, sizeof(value));
+    value = trie_arr_len(&(b.tail));
+    memcpy(image + 12, &value, sizeof(value));
+    memcpy(image + TRIE_DA_HEADER, b.units, b.used*sizeof(*(b.units)));
+    memcpy(image + TRIE_DA_HEADER + b.used*sizeof(*(b.units)), b.links, b.used*sizeof(*(b.links)));
+    if (trie_arr_len(&(b.tail)) > 0) // Tail is not allocated if every node data is empty
+        memcpy(image + TRIE_DA_HEADER + b.used*(sizeof(*(b.units)) + sizeof(*(b.links))),
+               trie_arr_data(&(b.tail)), trie_arr_len(&(b.tail))*sizeof(DATA_t));
+    free(b.units);
+    free(b.links);
+    trie_arr_clear(&(b.tail));
+
+    d->mem = image;
+    return trie_da_attach(d, image, size);
+}
+
+int trie_da_map(const void * mem, size_t size, trie_da_t * d) {
+    if ((mem == NULL) || (d == NULL))
+        return FAIL; // Invalid ptr
+    d->mem = NULL; // Not owned
+    return trie_da_attach(d, mem, size);
+}
+
+void trie_da_clear(trie_da_t * d) {
+    if (d == NULL)
+        return; // Invalid ptr
+    free(d->mem);
+    memset(d, 0, sizeof(*d));
+}
+
+int trie_da_fwrite(FILE * fp, const trie_da_t * d) {
+    if ((fp == NULL) || (d == NULL) || (d->units == NULL))
+        return FAIL; // Invalid ptr
+    return (fwrite((const unsigned char *)(d->units) - TRIE_DA_HEADER, 1, d->size, fp) == d->size)?SUCCESS:FAIL;
+}
+
+// Child of s starting with symbol, or -1
+static inline
+int trie_da_child(const trie_da_t * d, int s, DATA_t symbol) {
+    int t;
+    t = d->units[s].base + trie_da_code(symbol);
+    if ((d->units[s].base == 0) || (t >= d->unit_num) || (d->units[t].check != s))
+        return -1;
+    return t;
+}
+
+// Walks down arr as far as it matches. Returns the unit reached, and sets *mismatch to the
+// symbols of its tail matched. If arr is not found returns -1
+static inline
+int trie_da_walk_down(const trie_da_t * d, const DATA_t * arr, int len, int * mismatch) {
+    int s, m;
+
+    s = 0;
+    while (1) {
+        m = find_first_mismatch(arr, len, d->tail + d->units[s].tail, trie_da_tail_len(d, s));
+        if (m == len) { // arr ends inside (or at the end of) this unit
+            *mismatch = m;
+            return s;
+        } else if (m < trie_da_tail_len(d, s)) { // Mismatch in the middle of the tail
+            return -1;
+        }
+        s = trie_da_child(d, s, arr[m]);
+        if (s < 0)
+            return -1;
+        arr += m + 1;
+        len -= m + 1;
+    }
+}
+
+int trie_da_find(const trie_da_t * d, const DATA_t * arr, int len) {
+    int s, mismatch;
+
+    if ((d == NULL) || (d->units == NULL))
+        return 0; // Invalid ptr
+    s = trie_da_walk_down(d, arr, len, &mismatch);
+    return (s >= 0) && (mismatch == trie_da_tail_len(d, s)) && trie_da_end(d, s);
+}
+
+int trie_da_foreach_prefix(const trie_da_t * d, const DATA_t * prefix, int len,
+                           trie_scan_callback_t callback, void * ctx) {
+    struct _trie_da_item {
+        int unit;
+        int code; // Next child, 0 if none
+        int offset; // Where childs begin in key
+    } * stack;
+    int s, sp, alloc, found, mismatch, offset;
+    DATA_t symbol;
+    trie_arr_t key;
+
+    if ((d == NULL) || (d->units == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+    s = trie_da_walk_down(d, prefix, len, &mismatch);
+    if (s < 0)
+        return 0; // No key starts with prefix
+
+    trie_arr_init(&key);
+    trie_arr_substitute_end(&key, 0, prefix, len);
+    trie_arr_substitute_end(&key, len, d->tail + d->units[s].tail + mismatch, trie_da_tail_len(d, s) - mismatch);
+    stack = NULL;
+    sp = alloc = 0;
+    found = 0;
+    while (1) { // Visits unit s, key is complete
+        if (trie_da_end(d, s)) {
+            found++;
+            if (callback(trie_arr_data(&key), trie_arr_len(&key), ctx))
+                break;
+        }
+        if (sp == alloc) { // Doubles
+            alloc = (alloc == 0)?16:(2*alloc);
+            stack = realloc(stack, alloc*sizeof(*stack));
+            assert(stack);
+        }
+        stack[sp].unit = s;
+        stack[sp].code = d->links[s].child;
+        stack[sp].offset = trie_arr_len(&key);
+        sp++;
+
+        while ((sp > 0) && (stack[sp - 1].code == 0)) // Goes up
+            sp--;
+        if (sp == 0) // Every unit visited
+            break;
+        symbol = trie_da_symbol(stack[sp - 1].code);
+        s = d->units[stack[sp - 1].unit].base + stack[sp - 1].code;
+        stack[sp - 1].code = d->links[s].sibling;
+        offset = stack[sp - 1].offset; // Truncates the key
+        trie_arr_substitute_end(&key, offset, &symbol, 1); // adds the first character
+        trie_arr_substitute_end(&key, offset + 1, d->tail + d->units[s].tail, trie_da_tail_len(d, s));
+    }
+    free(stack);
+    trie_arr_clear(&key);
+    return found;
+}
@@ -20,6 +20,7 @@
 #include <limits.h> // INT_MIN
 #include <string.h> // strlen, memcmp
 #include <stddef.h> // size_t
+#include <stdint.h> // uintmax_t
 #include "trie.h"
 
 // This source uses functions from:
@@ -41,6 +42,10 @@
                it is stored in memory -2^31 (INT_MIN), otherwise if node is 0-lenght and end-flag is false it is stored 0
 
    Before root node there is a Magic number, undef the correspunding macro to disable
+
+   Wide symbols (sizeof(DATA_t) > 1): after the magic number there is one byte with sizeof(DATA_t),
+   and each symbol is stored as a variable lenght integer (7 bits per byte, high bit set if more bytes follow).
+   Token ids of large sparse alphabets are usually small numbers, so most of them take one or two bytes
 */
 
 /* Compile with NO_MAGIC_NUMBER and/or NO_SAFE_READ_WRITE to disable options */
@@ -55,6 +60,37 @@
 //   ===   WRITE   ===
 //   =================
 
+// Returns the number of symbols wrote, as fwrite does
+static inline
+size_t __trie_fwrite_symbols(FILE * fp, const DATA_t * data, int n) {
+    int i;
+    uintmax_t value;
+    unsigned char byte;
+
+    if (sizeof(DATA_t) == 1) // Plain bytes, no coding
+        return fwrite(data, sizeof(*data), n, fp);
+
+    for (i = 0; i < n; i++) {
+        value = (uintmax_t)data[i] & (UINTMAX_MAX >> (8*(sizeof(uintmax_t) - sizeof(DATA_t)))); // Unsigned value
+        do {
+            byte = value & 0x7F;
+            value >>= 7;
+            if (value != 0)
+                byte |= 0x80; // More bytes follow
+            if (putc(byte, fp) == EOF)
+                return i;
+        } while (value != 0);
+    }
+    return n;
+}
+
+static inline
+int __trie_fwrite_symbol_size(FILE * fp) {
+    if (sizeof(DATA_t) == 1) // Nothing stored for byte tries, format is unchanged
+        return SUCCESS;
+    return (putc((unsigned char)sizeof(DATA_t), fp) == EOF)?FAIL:SUCCESS;
+}
+
 static inline // inlines when possible
 int __trie_fwrite_node(FILE * fp, struct _trie * parent, int n_child) {
     struct _trie * t = trie_get_child(parent, n_child);
@@ -76,8 +112,8 @@ int __trie_fwrite_node(FILE * fp, struct _trie * parent, int n_child) {
     if (trie_data_end(t)) // tmp_len is always != from zero
         tmp_len = -tmp_len; // uses the negative size
     res  = fwrite(&tmp_len, sizeof(tmp_len), 1, fp); // Writes lenght
-    res += fwrite(&(trie_get_first(parent, n_child)), sizeof(trie_get_first(parent, n_child)), 1, fp); // Writes first chunk of data
-    res += fwrite(trie_data(t), sizeof*(trie_data(t)), trie_data_len(t), fp); // Writes the rest of the data, lenght is always data_len(...)
+    res += __trie_fwrite_symbols(fp, &(trie_get_first(parent, n_child)), 1); // Writes first chunk of data
+    res += __trie_fwrite_symbols(fp, trie_data(t), trie_data_len(t)); // Writes the rest of the data, lenght is always data_len(...)
 
     // === Now stores childs ===
     res += fwrite(&trie_get_child_num(t), sizeof(trie_get_child_num(t)), 1, fp); // First stores child num
@@ -138,6 +174,12 @@ int trie_fwrite(FILE * fp, trie_ptr_t t) {
 #    else // if not def SAFE_READ_WRITE
     (void)res; // Uses res
 #    endif
+#endif
+    res = __trie_fwrite_symbol_size(fp);
+    assert(res == SUCCESS);
+#ifdef SAFE_READ_WRITE
+    if (res != SUCCESS)
+        return FAIL;
 #endif
 
     trie_readlock(&(t->lock));
@@ -157,7 +199,7 @@ int trie_fwrite(FILE * fp, trie_ptr_t t) {
     else if (trie_data_end(t) && (tmp_len == 0))
         tmp_len = INT_MIN; // -2^31, if sizeof(int) == 4
     res  = fwrite(&tmp_len, sizeof(tmp_len), 1, fp); // Writes lenght
-    res += fwrite(trie_data(t), sizeof*(trie_data(t)), trie_data_len(t), fp); // Writes the whole data
+    res += __trie_fwrite_symbols(fp, trie_data(t), trie_data_len(t)); // Writes the whole data
 
     // === Now stores childs ===   (exactly the same as above)
     res += fwrite(&trie_get_child_num(t), sizeof(trie_get_child_num(t)), 1, fp); // First stores child num
@@ -222,6 +264,37 @@ int __trie_check_magic(FILE * fp) {
 #endif
 }
 
+static inline
+int __trie_check_symbol_size(FILE * fp) {
+    if (sizeof(DATA_t) == 1)
+        return SUCCESS;
+    return (getc(fp) == (int)sizeof(DATA_t))?SUCCESS:FAIL; // Written with the same DATA_t
+}
+
+// Returns the number of symbols read, as fread does
+static inline
+size_t __trie_fread_symbols(FILE * fp, DATA_t * data, int n) {
+    int i, byte, shift;
+    uintmax_t value;
+
+    if (sizeof(DATA_t) == 1) // Plain bytes, no coding
+        return fread(data, sizeof(*data), n, fp);
+
+    for (i = 0; i < n; i++) {
+        value = 0;
+        shift = 0;
+        do {
+            byte = getc(fp);
+            if ((byte == EOF) || (shift >= (int)(8*sizeof(DATA_t)))) // Truncated or too long
+                return i;
+            value |= (uintmax_t)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        data[i] = (DATA_t)value;
+    }
+    return n;
+}
+
 static inline
 int __trie_fread_node(FILE * fp, struct _trie * parent, int n_child) {
     struct _trie * t;
@@ -251,9 +324,9 @@ int __trie_fread_node(FILE * fp, struct _trie * parent, int n_child) {
     
     assert(trie_data_len(t) >= 0);
     t->data.dealloc = 1; // This chunk needs to be deallocated
-    trie_data(t) = malloc(trie_data_len(t)*sizeof*trie_data(t)); // Allocs enough data
-    res = fread(&(trie_get_first(parent, n_child)), sizeof(trie_get_first(parent, n_child)), 1, fp); // Reads first chunk of data
-    res += fread((DATA_t*)trie_data(t), sizeof*(trie_data(t)), trie_data_len(t), fp); // Reads the rest of the data, lenght is always data_len(...)
+    trie_set_data(t, trie_label_alloc(trie_data_len(t))); // Allocs enough data
+    res = __trie_fread_symbols(fp, &(trie_get_first(parent, n_child)), 1); // Reads first chunk of data
+    res += __trie_fread_symbols(fp, (DATA_t*)trie_data(t), trie_data_len(t)); // Reads the rest of the data, lenght is always data_len(...)
 
     // === Reads childs ===
     res += fread(&trie_get_child_num(t), sizeof(trie_get_child_num(t)), 1, fp); // First stores child num
@@ -267,6 +340,7 @@ int __trie_fread_node(FILE * fp, struct _trie * parent, int n_child) {
     }
 #endif
     trie_add_first_n_childs(&(t->childs), trie_get_child_num(t));
+    t->count = trie_data_end(t); // Counts keys of the subtree
     for (i = 0; i < trie_get_child_num(t); i++) { // Now for each child
         res = __trie_fread_node(fp, t, i); // t is new parent, i means i-th child
         assert(res == SUCCESS);
@@ -274,11 +348,13 @@ int __trie_fread_node(FILE * fp, struct _trie * parent, int n_child) {
         if (res != SUCCESS)
            return FAIL;
 #endif
+        t->count += trie_get_child(t, i)->count;
     }
     return SUCCESS;
 }
 
-int trie_fread(FILE * fp, trie_ptr_t t) {
+static
+int __trie_fread(FILE * fp, trie_ptr_t t) {
     int i, tmp_len;
     size_t res;
 
@@ -297,6 +373,12 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
     if (res != SUCCESS)
         return FAIL;
 #endif
+    res = __trie_check_symbol_size(fp);
+    assert("Symbol size check failed" && res == SUCCESS);
+#ifdef SAFE_READ_WRITE
+    if (res != SUCCESS)
+        return FAIL;
+#endif
 
     // === Reads data ===
     res = fread(&tmp_len, sizeof(tmp_len), 1, fp); // Reads data lenght
@@ -307,8 +389,7 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
 #endif
 
     // ==== First erases the trie ====
-    trie_clear(t);
-    trie_init(t);
+    trie_clear_keys(t); // Also reinits it, keeping its allocator
 
     if (tmp_len < 0) { // Data ends here 
         trie_set_data_end(t);
@@ -323,8 +404,8 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
     
     assert(trie_data_len(t) >= 0);
     t->data.dealloc = 1; // This chunk needs to be deallocated
-    trie_data(t) = malloc(trie_data_len(t)*sizeof*trie_data(t)); // Allocs enough data
-    res = fread((DATA_t*)trie_data(t), sizeof*(trie_data(t)), trie_data_len(t), fp); // Reads the rest of the data, lenght is always data_len(...)
+    trie_set_data(t, trie_label_alloc(trie_data_len(t))); // Allocs enough data
+    res = __trie_fread_symbols(fp, (DATA_t*)trie_data(t), trie_data_len(t)); // Reads the rest of the data, lenght is always data_len(...)
 
     // === Reads childs === (exactly as above)
     res += fread(&trie_get_child_num(t), sizeof(trie_get_child_num(t)), 1, fp); // First stores child num
@@ -338,6 +419,7 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
         return FAIL;
     }
 #endif
+    t->count = trie_data_end(t); // Counts keys of the whole trie
     if (trie_get_child_num(t) != 0) { // Normal case
         trie_add_first_n_childs(&(t->childs), trie_get_child_num(t));
         for (i = 0; i < trie_get_child_num(t); i++) { // Now for each child
@@ -347,11 +429,12 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
             if (res != SUCCESS)
                return FAIL;
 #endif
+            t->count += trie_get_child(t, i)->count;
         }
     } else { // Empty childs, it might means empty trie or not
         if (trie_data_len(t) == 0 && ! trie_data_end(t)) { // Empty trie
             trie_get_childs(t) = NULL; // No children for the root node
-            free((DATA_t*)trie_data(t));
+            trie_label_free(trie_data(t));
             t->data.dealloc = 0; // Already freed
         } else {
             trie_init_childs(&(t->childs)); // Inits root node (it should be already initialized)
@@ -361,7 +444,20 @@ int trie_fread(FILE * fp, trie_ptr_t t) {
     return SUCCESS;
 }
 
-// Merges a read trie
+// Nodes are read with the allocator of t
+int trie_fread(FILE * fp, trie_ptr_t t) {
+    trie_allocator_t * prev;
+    int res;
+
+    if (t == NULL)
+        return __trie_fread(fp, t); // Checks fp only
+    prev = trie_mem_enter(t);
+    res = __trie_fread(fp, t);
+    trie_mem_leave(prev);
+    return res;
+}
+
+// Merges a read trie. Stops at the first key that cannot be added (memory limit)
 int trie_fread_merge(FILE * fp, trie_ptr_t t) {
     int res;
     trie_t trie; // Temporany
@@ -379,7 +475,9 @@ int trie_fread_merge(FILE * fp, trie_ptr_t t) {
     }
 
     while (trie_iterator_next(&trie, &iter)) {
-        trie_add(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+        res = trie_add(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter));
+        if (res != SUCCESS)
+            break; // Keys already merged stay
 
         // Now searches the data inside the trie (for debug)
         assert(trie_find(t, trie_iterator_data(&iter), trie_iterator_data_len(&iter)));
@@ -388,6 +486,6 @@ int trie_fread_merge(FILE * fp, trie_ptr_t t) {
     trie_iterator_clear(&iter);
     trie_clear(&trie);    
 
-    return SUCCESS;
+    return res;
 }
 
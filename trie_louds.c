@@ -0,0 +1,519 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdio.h> // fread, fwrite
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <stdint.h> // uint64_t
+#include <assert.h>
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_utils.c, trie_childs.c, trie_mutex.c, trie.c (TRIE_SUFFIX_FOUND, ...)
+
+/*
+   Frozen (read only) trie, LOUDS encoded. Nodes are the nodes of the trie, numbered in
+   breadth first order, the root is 0.
+   louds:  "10", then for each node one 1 for each child and a 0. Childs of node i are the
+           contiguous nodes from select0(i + 1) - i, and they are select0(i + 2) - select0(i + 1) - 1.
+   firsts: first symbol of each node but the root (firsts[i - 1] for node i). Childs are
+           contiguous, so firsts of the childs of a node are a sorted array.
+   labels: data of every node, one after the other.
+   label_ends: for each node, one 0 for each symbol of its data and a 1. Data of node i ends
+           at select1(i + 1) - i in labels.
+   ends:   bit i is set if a key ends in node i.
+   A node takes about 4 bits, plus its symbols, instead of a struct _trie with its locks.
+
+   Rank samples (every TRIE_BITS_BLOCK words) are not stored in files, they are computed
+   after reading.
+*/
+
+#define TRIE_BITS_BLOCK 8 // Words for each rank sample, 512 bits
+#ifndef NO_MAGIC_NUMBER
+#    define LOUDS_MAGIC_NUMBER "TRIL" // Same as MAGIC_NUMBER, for frozen tries
+#endif
+
+//   ===================
+//   ===  BITVECTOR  ===
+//   ===================
+
+static inline
+int trie_bits_words(int len) {
+    return (len + 63)/64;
+}
+
+static
+void trie_bits_init(struct _trie_bits * b, int len) {
+    b->len = len;
+    b->words = calloc(trie_bits_words(len) + 1, sizeof(*(b->words))); // + 1 avoids calloc(0)
+    b->ranks = NULL;
+    assert(b->words);
+}
+
+static
+void trie_bits_clear(struct _trie_bits * b) {
+    free(b->words);
+    free(b->ranks);
+    b->words = NULL;
+    b->ranks = NULL;
+    b->len = 0;
+}
+
+#define trie_bits_set(b, pos) ((b)->words[(pos)/64] |= (UINT64_C(1) << ((pos)%64)))
+#define trie_bits_get(b, pos) (((b)->words[(pos)/64] >> ((pos)%64)) & 1)
+
+// Computes the rank samples, number of ones before each block
+static
+void trie_bits_index(struct _trie_bits * b) {
+    int i, blocks;
+    uint32_t ones;
+
+    blocks = trie_bits_words(b->len)/TRIE_BITS_BLOCK + 1;
+    b->ranks = malloc((blocks + 1)*sizeof(*(b->ranks)));
+    assert(b->ranks);
+    ones = 0;
+    for (i = 0; i < blocks*TRIE_BITS_BLOCK; i++) {
+        if (i % TRIE_BITS_BLOCK == 0)
+            b->ranks[i/TRIE_BITS_BLOCK] = ones;
+        if (i < trie_bits_words(b->len))
+            ones += __builtin_popcountll(b->words[i]);
+    }
+    b->ranks[blocks] = ones;
+}
+
+// Number of ones in [0, pos)
+static inline
+int trie_bits_rank1(const struct _trie_bits * b, int pos) {
+    int i, rank;
+
+    rank = b->ranks[pos/(64*TRIE_BITS_BLOCK)];
+    for (i = (pos/(64*TRIE_BITS_BLOCK))*TRIE_BITS_BLOCK; i < pos/64; i++)
+        rank += __builtin_popcountll(b->words[i]);
+    if (pos % 64)
+        rank += __builtin_popcountll(b->words[pos/64] & ((UINT64_C(1) << (pos%64)) - 1));
+    return rank;
+}
+
+// Position of the k-th (from 1) bit equal to bit. k must be valid
+static inline
+int trie_bits_select(const struct _trie_bits * b, int k, int bit) {
+    int begin, end, mid, i, count;
+    uint64_t word;
+
+    // Last block with less than k bits before it
+    begin = 0;
+    end = trie_bits_words(b->len)/TRIE_BITS_BLOCK + 1;
+    while (end - begin > 1) {
+        mid = begin + (end - begin)/2;
+        count = bit?(int)b->ranks[mid]:(mid*64*TRIE_BITS_BLOCK - (int)b->ranks[mid]);
+        if (count < k)
+            begin = mid;
+        else
+            end = mid;
+    }
+    k -= bit?(int)b->ranks[begin]:(begin*64*TRIE_BITS_BLOCK - (int)b->ranks[begin]);
+
+    for (i = begin*TRIE_BITS_BLOCK; ; i++) { // Then the word
+        word = bit?b->words[i]:~(b->words[i]);
+        count = __builtin_popcountll(word);
+        if (count >= k)
+            break;
+        k -= count;
+    }
+    while (--k > 0) // Then the bit, clears the lowest ones
+        word &= word - 1;
+    return i*64 + __builtin_ctzll(word);
+}
+
+#define trie_bits_select1(b, k) trie_bits_select(b, k, 1)
+#define trie_bits_select0(b, k) trie_bits_select(b, k, 0)
+
+//   ===================
+//   ===   FREEZE    ===
+//   ===================
+
+// Node of the trie, in depth first order
+struct _trie_louds_tmp {
+    int depth;
+    int child_num;
+    int end;
+    int label; // Offset in the labels buffer
+    int label_len;
+    DATA_t first;
+};
+
+struct _trie_louds_build {
+    struct _trie_louds_tmp * nodes;
+    int num, alloc;
+    trie_arr_t labels;
+};
+
+// t must be readlocked, and it is left locked
+static
+void trie_louds_walk(struct _trie * t, struct _trie_louds_build * b, int depth, DATA_t first) {
+    struct _trie_louds_tmp * node;
+    struct _trie * next;
+    int i;
+
+    if (b->num == b->alloc) { // Doubles
+        b->alloc = (b->alloc == 0)?64:(2*b->alloc);
+        b->nodes = realloc(b->nodes, (b->alloc)*sizeof*(b->nodes));
+        assert(b->nodes);
+    }
+    node = b->nodes + b->num++;
+    node->depth = depth;
+    node->child_num = trie_get_child_num(t);
+    node->end = trie_data_end(t);
+    node->label = trie_arr_len(&(b->labels));
+    node->label_len = trie_data_len(t);
+    node->first = first;
+    trie_arr_substitute_end(&(b->labels), node->label, trie_data(t), trie_data_len(t));
+
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        next = trie_get_child(t, i);
+        trie_readlock(&(next->lock)); // Parent stays locked, only the current path is
+        trie_louds_walk(next, b, depth + 1, trie_get_first(t, i));
+        trie_unlock(&(next->lock));
+    }
+}
+
+static
+void trie_louds_alloc(trie_louds_t * f, int node_num, int label_len) {
+    f->node_num = node_num;
+    f->label_len = label_len;
+    trie_bits_init(&(f->louds), 2*node_num + 1);
+    trie_bits_init(&(f->label_ends), label_len + node_num);
+    trie_bits_init(&(f->ends), node_num);
+    f->firsts = malloc(node_num*sizeof(*(f->firsts))); // One more than needed, never 0
+    f->labels = malloc((label_len + 1)*sizeof(*(f->labels)));
+    assert(f->firsts && f->labels);
+}
+
+static
+void trie_louds_index(trie_louds_t * f) {
+    trie_bits_index(&(f->louds));
+    trie_bits_index(&(f->label_ends));
+    trie_bits_index(&(f->ends));
+}
+
+int trie_freeze(trie_ptr_t t, trie_louds_t * f) {
+    struct _trie_louds_build b;
+    struct _trie_louds_tmp * node;
+    int * depth_begin, * order;
+    int i, d, max_depth, pos, label_pos;
+
+    if ((t == NULL) || (f == NULL))
+        return FAIL; // Invalid ptr
+
+    memset(&b, 0, sizeof(b));
+    trie_arr_init(&(b.labels));
+    trie_readlock(&(t->lock)); // locks root trie read mutex
+    trie_louds_walk(t, &b, 0, 0);
+    trie_unlock(&(t->lock));
+
+    // Sorting by depth (stable) gives the breadth first order, childs stay contiguous
+    max_depth = 0;
+    for (i = 0; i < b.num; i++)
+        if (b.nodes[i].depth > max_depth)
+            max_depth = b.nodes[i].depth;
+    depth_begin = calloc(max_depth + 2, sizeof(*depth_begin));
+    order = malloc(b.num*sizeof(*order)); // order[breadth first position] = depth first one
+    assert(depth_begin && order);
+    for (i = 0; i < b.num; i++)
+        depth_begin[b.nodes[i].depth + 1]++;
+    for (d = 1; d <= max_depth + 1; d++)
+        depth_begin[d] += depth_begin[d - 1];
+    for (i = 0; i < b.num; i++)
+        order[depth_begin[b.nodes[i].depth]++] = i;
+
+    trie_louds_alloc(f, b.num, trie_arr_len(&(b.labels)));
+    trie_bits_set(&(f->louds), 0); // Super root
+    pos = 2;
+    label_pos = 0;
+    for (i = 0; i < b.num; i++) {
+        node = b.nodes + order[i];
+        for (d = 0; d < node->child_num; d++, pos++)
+            trie_bits_set(&(f->louds), pos);
+        pos++; // 0 closing the childs
+        if (i > 0)
+            f->firsts[i - 1] = node->first;
+        memcpy(f->labels + label_pos, trie_arr_data(&(b.labels)) + node->label, node->label_len*sizeof(*(f->labels)));
+        label_pos += node->label_len;
+        trie_bits_set(&(f->label_ends), label_pos + i);
+        if (node->end)
+            trie_bits_set(&(f->ends), i);
+    }
+    assert(pos == f->louds.len);
+    trie_louds_index(f);
+
+    free(order);
+    free(depth_begin);
+    free(b.nodes);
+    trie_arr_clear(&(b.labels));
+    return SUCCESS;
+}
+
+void trie_louds_clear(trie_louds_t * f) {
+    if (f == NULL)
+        return; // Invalid ptr
+    trie_bits_clear(&(f->louds));
+    trie_bits_clear(&(f->label_ends));
+    trie_bits_clear(&(f->ends));
+    free(f->firsts);
+    free(f->labels);
+    f->firsts = NULL;
+    f->labels = NULL;
+    f->node_num = f->label_len = 0;
+}
+
+size_t trie_louds_size(const trie_louds_t * f) {
+    const struct _trie_bits * bits[3] = {&(f->louds), &(f->label_ends), &(f->ends)};
+    size_t size;
+    int i;
+
+    size = sizeof(*f) + (f->node_num + f->label_len)*sizeof(DATA_t);
+    for (i = 0; i < 3; i++)
+        size += trie_bits_words(bits[i]->len)*sizeof(uint64_t) +
+                (trie_bits_words(bits[i]->len)/TRIE_BITS_BLOCK + 2)*sizeof(uint32_t);
+    return size;
+}
+
+//   ===================
+//   ===   SEARCH    ===
+//   ===================
+
+// Data of node i is labels[*begin, *end)
+static inline
+void trie_louds_label(const trie_louds_t * f, int i, int * begin, int * end) {
+    *begin = (i == 0)?0:(trie_bits_select1(&(f->label_ends), i) - (i - 1));
+    *end = trie_bits_select1(&(f->label_ends), i + 1) - i;
+}
+
+// Childs of node i are [*first, *first + returned value)
+static inline
+int trie_louds_childs(const trie_louds_t * f, int i, int * first) {
+    int zero;
+    zero = trie_bits_select0(&(f->louds), i + 1);
+    *first = zero - i;
+    return trie_bits_select0(&(f->louds), i + 2) - zero - 1;
+}
+
+// Child of node i starting with symbol, or -1
+static inline
+int trie_louds_search_child(const trie_louds_t * f, int i, DATA_t symbol) {
+    const DATA_t * begin, * end, * mid;
+    int first, num;
+
+    num = trie_louds_childs(f, i, &first);
+    begin = f->firsts + first - 1;
+    end = begin + num;
+    while (begin < end) { // Binary search, firsts of the childs are sorted
+        mid = begin + (end - begin)/2;
+        if (*mid < symbol)
+            begin = mid + 1;
+        else
+            end = mid;
+    }
+    if ((begin < f->firsts + first - 1 + num) && (*begin == symbol))
+        return (begin - f->firsts) + 1;
+    return -1;
+}
+
+// Walks down arr as far as it matches. Returns the node reached, and sets *mismatch to the
+// symbols of its data matched. If arr is not found returns -1
+static inline
+int trie_louds_walk_down(const trie_louds_t * f, const DATA_t * arr, int len, int * mismatch, int * begin, int * end) {
+    int i, m;
+
+    i = 0;
+    while (1) {
+        trie_louds_label(f, i, begin, end);
+        m = find_first_mismatch(arr, len, f->labels + *begin, *end - *begin);
+        if (m == len) { // arr ends inside (or at the end of) this node
+            *mismatch = m;
+            return i;
+        } else if (m < *end - *begin) { // Mismatch in the middle of the data
+            return -1;
+        }
+        i = trie_louds_search_child(f, i, arr[m]);
+        if (i < 0)
+            return -1;
+        arr += m + 1;
+        len -= m + 1;
+    }
+}
+
+int trie_louds_find(const trie_louds_t * f, const DATA_t * arr, int len) {
+    int i, mismatch, begin, end;
+
+    if (f == NULL)
+        return 0; // Invalid ptr
+    i = trie_louds_walk_down(f, arr, len, &mismatch, &begin, &end);
+    return (i >= 0) && (mismatch == end - begin) && trie_bits_get(&(f->ends), i);
+}
+
+// Same results as trie_get_suffix
+int trie_louds_get_suffix(const trie_louds_t * f, const DATA_t * arr, int len, trie_arr_t * suffix) {
+    int i, mismatch, begin, end, first;
+
+    if ((f == NULL) || ((f->node_num == 1) && !trie_bits_get(&(f->ends), 0)))
+        return TRIE_NO_SUFFIX_FOUND; // Invalid ptr, or empty trie
+    i = trie_louds_walk_down(f, arr, len, &mismatch, &begin, &end);
+    if (i < 0)
+        return TRIE_NO_SUFFIX_FOUND;
+
+    if (mismatch == end - begin) { // Reached end of data, and end of node
+        if (!trie_bits_get(&(f->ends), i))
+            return TRIE_MULTIPLE_SUFFIX;
+        if (trie_louds_childs(f, i, &first) != 0) // Not univocal way of interpretation
+            return TRIE_NO_SUFFIX_FOUND;
+        if (suffix != NULL)
+            trie_arr_len(suffix) = 0;
+        return TRIE_SUFFIX_FOUND;
+    }
+    if (!trie_bits_get(&(f->ends), i)) // Middle of the data, data does not end with this node
+        return TRIE_MULTIPLE_SUFFIX;
+    if (suffix != NULL) // Stores the remaining part of the data
+        trie_arr_substitute_end(suffix, 0, f->labels + begin + mismatch, end - begin - mismatch);
+    return TRIE_SUFFIX_FOUND;
+}
+
+int trie_louds_foreach_prefix(const trie_louds_t * f, const DATA_t * prefix, int len,
+                              trie_scan_callback_t callback, void * ctx) {
+    struct _trie_louds_item {
+        int child, last; // Next child to visit, and the one after the last
+        int offset; // Where childs begin in key
+    } * stack;
+    int i, sp, alloc, found, mismatch, begin, end, offset;
+    trie_arr_t key;
+
+    if ((f == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+    i = trie_louds_walk_down(f, prefix, len, &mismatch, &begin, &end);
+    if (i < 0)
+        return 0; // No key starts with prefix
+
+    trie_arr_init(&key);
+    trie_arr_substitute_end(&key, 0, prefix, len);
+    trie_arr_substitute_end(&key, len, f->labels + begin + mismatch, end - begin - mismatch); // Rest of the data
+    stack = NULL;
+    sp = alloc = 0;
+    found = 0;
+    while (1) { // Visits node i, key is complete
+        if (trie_bits_get(&(f->ends), i)) {
+            found++;
+            if (callback(trie_arr_data(&key), trie_arr_len(&key), ctx))
+                break;
+        }
+        if (sp == alloc) { // Doubles
+            alloc = (alloc == 0)?16:(2*alloc);
+            stack = realloc(stack, alloc*sizeof(*stack));
+            assert(stack);
+        }
+        stack[sp].last = trie_louds_childs(f, i, &(stack[sp].child));
+        stack[sp].last += stack[sp].child;
+        stack[sp].offset = trie_arr_len(&key);
+        sp++;
+
+        while ((sp > 0) && (stack[sp - 1].child == stack[sp - 1].last)) // Goes up
+            sp--;
+        if (sp == 0) // Every node visited
+            break;
+        i = stack[sp - 1].child++;
+        offset = stack[sp - 1].offset; // Truncates the key
+        trie_arr_substitute_end(&key, offset, f->firsts + i - 1, 1); // adds the first character
+        trie_louds_label(f, i, &begin, &end);
+        trie_arr_substitute_end(&key, offset + 1, f->labels + begin, end - begin);
+    }
+    free(stack);
+    trie_arr_clear(&key);
+    return found;
+}
+
+//   ===================
+//   ===    FILES    ===
+//   ===================
+
+/*
+   File format:
+   [ magic number "TRIL" ] [ 1 byte sizeof(DATA_t) ] [ int node_num ] [ int label_len ]
+   [ louds words ] [ label_ends words ] [ ends words ] [ firsts ] [ labels ]
+   Words and symbols are stored as in memory, so files are read back by the same architecture
+*/
+
+int trie_louds_fwrite(FILE * fp, const trie_louds_t * f) {
+    const struct _trie_bits * bits[3] = {&(f->louds), &(f->label_ends), &(f->ends)};
+    unsigned char symbol_size;
+    size_t res;
+    int i;
+
+    if ((fp == NULL) || (f == NULL))
+        return FAIL; // Invalid ptr
+#ifdef LOUDS_MAGIC_NUMBER
+    if (fwrite(LOUDS_MAGIC_NUMBER, 1, strlen(LOUDS_MAGIC_NUMBER), fp) != strlen(LOUDS_MAGIC_NUMBER))
+        return FAIL;
+#endif
+    symbol_size = sizeof(DATA_t);
+    res  = fwrite(&symbol_size, 1, 1, fp);
+    res += fwrite(&(f->node_num), sizeof(f->node_num), 1, fp);
+    res += fwrite(&(f->label_len), sizeof(f->label_len), 1, fp);
+    if (res != 3)
+        return FAIL;
+    for (i = 0; i < 3; i++)
+        if (fwrite(bits[i]->words, sizeof(uint64_t), trie_bits_words(bits[i]->len), fp) != (size_t)trie_bits_words(bits[i]->len))
+            return FAIL;
+    if (fwrite(f->firsts, sizeof(DATA_t), f->node_num - 1, fp) != (size_t)(f->node_num - 1))
+        return FAIL;
+    if (fwrite(f->labels, sizeof(DATA_t), f->label_len, fp) != (size_t)(f->label_len))
+        return FAIL;
+    return SUCCESS;
+}
+
+int trie_louds_fread(FILE * fp, trie_louds_t * f) {
+    struct _trie_bits * bits[3] = {&(f->louds), &(f->label_ends), &(f->ends)};
+    unsigned char symbol_size;
+    int i, node_num, label_len;
+#ifdef LOUDS_MAGIC_NUMBER
+    char magic[sizeof(LOUDS_MAGIC_NUMBER)];
+#endif
+
+    if ((fp == NULL) || (f == NULL))
+        return FAIL; // Invalid ptr
+#ifdef LOUDS_MAGIC_NUMBER
+    if ((fread(magic, 1, strlen(LOUDS_MAGIC_NUMBER), fp) != strlen(LOUDS_MAGIC_NUMBER)) ||
+        (memcmp(magic, LOUDS_MAGIC_NUMBER, strlen(LOUDS_MAGIC_NUMBER)) != 0))
+        return FAIL;
+#endif
+    if ((fread(&symbol_size, 1, 1, fp) != 1) || (symbol_size != sizeof(DATA_t)))
+        return FAIL; // Different symbols
+    if ((fread(&node_num, sizeof(node_num), 1, fp) != 1) || (fread(&label_len, sizeof(label_len), 1, fp) != 1) ||
+        (node_num < 1) || (label_len < 0))
+        return FAIL;
+
+    trie_louds_alloc(f, node_num, label_len);
+    for (i = 0; i < 3; i++)
+        if (fread(bits[i]->words, sizeof(uint64_t), trie_bits_words(bits[i]->len), fp) != (size_t)trie_bits_words(bits[i]->len))
+            break;
+    if ((i < 3) || (fread(f->firsts, sizeof(DATA_t), node_num - 1, fp) != (size_t)(node_num - 1)) ||
+        (fread(f->labels, sizeof(DATA_t), label_len, fp) != (size_t)label_len)) {
+        trie_louds_clear(f);
+        return FAIL;
+    }
+    trie_louds_index(f);
+    return SUCCESS;
+}
@@ -0,0 +1,554 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memset
+#include <assert.h>
+#include <unistd.h> // sysconf
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#endif
+#include "trie.h"
+
+// This source uses functions from:
+//    trie.c (trie_add, trie_find, trie_iterator_next), trie_utils.c (trie_own_data), trie_childs.c
+
+/*
+   Write optimized mode. Each writer (threads are spread between them) adds to its own memtable,
+   a plain trie nobody else writes, so its locks are never contended. A full memtable is frozen:
+   it goes at the end of the frozen list and the writer starts a new one. The merger thread takes
+   frozen memtables in order and merges each one into the base, then drops it.
+
+   The merge walks both tries together. A subtree of the memtable starting with a symbol the base
+   node does not have is moved there as it is, with no copy: only its data is copied if it points
+   inside the data of its parent (see trie_attach_existent_data). When both have the symbol,
+   the node whose data is longer is split where they differ, so both nodes end at the same key,
+   and the merge goes on in their childs. Base nodes are writelocked hand over hand, readers of
+   the base wait only on the node being changed.
+
+   A key moves from a memtable to the base, never the other way: lookups check memtables first,
+   under the tables readlock, then the base, so a key is always found in one of them. Moved
+   subtrees stay childs of the memtable too until it leaves the list under the tables writelock,
+   so its readers see every key of it meanwhile. Memtables use the allocator of the base, so
+   moved nodes are still accounted there.
+*/
+
+struct _trie_lsm_table {
+    trie_t trie;
+    struct _trie_lsm_table * next; // Frozen after this one
+};
+
+struct _trie_lsm_writer {
+    struct _trie_lsm_table * table; // Memtable being written
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+struct _trie_lsm_merge { // Merge of a memtable
+    trie_lsm_stats_t stats;
+    struct _trie ** parents; // Memtable nodes a subtree moved from
+    DATA_t * firsts; // First symbol of the subtree
+    int moved, alloc;
+};
+
+struct _trie_lsm_source { // trie_lsm_foreach
+    trie_ptr_t trie;
+    trie_iterator_t iter;
+    int valid; // iter holds the next key of trie
+};
+
+#ifndef NO_PTHREAD
+static __thread int trie_lsm_hint = -1; // Writer of the thread
+static int trie_lsm_threads = 0;
+#endif
+
+void trie_lsm_config_init(trie_lsm_config_t * config) {
+#ifndef NO_PTHREAD
+    config->writers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (config->writers < 1)
+        config->writers = 1;
+#else
+    config->writers = 1;
+#endif
+    config->memtable_keys = 64*1024;
+    config->max_frozen = 2*config->writers;
+}
+
+static
+struct _trie_lsm_table * trie_lsm_table_new(trie_lsm_t * l) {
+    struct _trie_lsm_table * table = malloc(sizeof(*table));
+
+    if (table == NULL)
+        return NULL;
+    trie_init(&(table->trie));
+    table->trie.data.allocator = l->base->data.allocator; // Its nodes may move to the base
+    trie_mem_ref(table->trie.data.allocator); // Released by trie_clear
+    table->next = NULL;
+    return table;
+}
+
+static
+void trie_lsm_table_free(struct _trie_lsm_table * table) {
+    trie_clear(&(table->trie));
+    free(table);
+}
+
+// Nodes moved to the base are written by the next checkpoint, as new ones
+static
+void trie_lsm_touch_subtree(struct _trie * t) {
+    int i;
+
+    trie_touch(t);
+    for (i = 0; i < trie_get_child_num(t); i++)
+        trie_lsm_touch_subtree(trie_get_child(t, i));
+}
+
+// The first len symbols of t (writelocked) stay there, the others, its childs and its keys go to
+// a new only child. Keys of the trie do not change
+static
+void trie_lsm_split(struct _trie * t, int len, struct _trie_lsm_merge * m) {
+    struct _childs temp_childs;
+    struct _trie * child;
+
+    assert(len < trie_data_len(t));
+    memcpy(&temp_childs, &(t->childs), sizeof(temp_childs));
+    trie_init_childs(&(t->childs));
+    trie_add_first_child(&(t->childs));
+    trie_init_new_child(t, 0);
+    child = trie_get_child(t, 0);
+    trie_attach_existent_data(child, trie_data(t) + len + 1, trie_data_len(t) - (len + 1));
+    trie_attach_first_data(t, 0, trie_data(t)[len]);
+    trie_data_end(child) = trie_data_end(t);
+    memcpy(&(child->childs), &temp_childs, sizeof(temp_childs));
+    child->count = trie_get_count(t);
+    trie_data_len(t) = len;
+    trie_clear_data_end(t);
+    trie_touch(t);
+    m->stats.splits++;
+}
+
+// Merges the keys under s into b. Both are writelocked and end at the same key, both are unlocked
+// before returning. Returns the number of keys added to b
+static
+int trie_lsm_merge_node(struct _trie * b, struct _trie * s, struct _trie_lsm_merge * m) {
+    struct _trie * c, * next;
+    int i, pos, mismatch, added = 0;
+
+    trie_touch(b);
+    if (trie_data_end(s) && !trie_data_end(b)) {
+        trie_set_data_end(b);
+        added++;
+    }
+    i = 0;
+    while (i < trie_get_child_num(s)) {
+        c = trie_get_child(s, i);
+        if (!trie_search_in_childs(&pos, &(b->childs), trie_get_first(s, i))) { // Moves the subtree
+            trie_writelock(&(c->lock));
+            trie_own_data(c, trie_data(s), trie_data_len(s)); // Data of s goes away with the memtable
+            if (trie_get_childs(b) == NULL) // Nodes whose childs were never added
+                trie_alloc_childs(&(b->childs));
+            trie_insert_child(&(b->childs), pos);
+            trie_set_child(b, pos, c);
+            trie_attach_first_data(b, pos, trie_get_first(s, i));
+            trie_lsm_touch_subtree(c);
+            added += trie_get_count(c);
+            if (m->moved == m->alloc) { // Remembers it, see trie_lsm_detach
+                m->alloc = 2*m->alloc + 16;
+                m->parents = realloc(m->parents, m->alloc*sizeof(*(m->parents)));
+                m->firsts = realloc(m->firsts, m->alloc*sizeof(*(m->firsts)));
+                assert(m->parents && m->firsts);
+            }
+            m->parents[m->moved] = s;
+            m->firsts[m->moved++] = trie_get_first(s, i);
+            m->stats.grafts++;
+            trie_unlock(&(c->lock));
+            i++;
+            continue;
+        }
+        next = trie_get_child(b, pos);
+        trie_unlock(&(s->lock)); // Hand over hand, only the merger changes them meanwhile
+        trie_writelock(&(next->lock)); // Base nodes first, always
+        trie_writelock(&(c->lock));
+        mismatch = find_first_mismatch(trie_data(next), trie_data_len(next), trie_data(c), trie_data_len(c));
+        if (mismatch < trie_data_len(next))
+            trie_lsm_split(next, mismatch, m);
+        if (mismatch < trie_data_len(c))
+            trie_lsm_split(c, mismatch, m);
+        trie_unlock(&(b->lock));
+        added += trie_lsm_merge_node(next, c, m);
+        trie_writelock(&(b->lock));
+        trie_writelock(&(s->lock));
+        i++;
+    }
+    trie_count_add(b, added);
+    trie_unlock(&(s->lock));
+    trie_unlock(&(b->lock));
+    return added;
+}
+
+// Moves every key of the frozen memtable s into the base
+static
+void trie_lsm_merge_table(trie_lsm_t * l, trie_ptr_t s, struct _trie_lsm_merge * m) {
+    trie_ptr_t b = l->base;
+    trie_allocator_t * allocator;
+    int mismatch;
+
+    if (trie_is_empty(s))
+        return;
+    allocator = trie_mem_enter(b);
+    trie_writelock(&(b->lock));
+    trie_writelock(&(s->lock));
+    if (trie_is_empty(b)) { // Same root data, no keys yet
+        trie_attach_new_data(b, trie_data(s), trie_data_len(s));
+        trie_clear_data_end(b);
+        b->count = 0;
+        trie_init_childs(&(b->childs));
+        trie_alloc_childs(&(b->childs));
+    }
+    mismatch = find_first_mismatch(trie_data(b), trie_data_len(b), trie_data(s), trie_data_len(s));
+    if (mismatch < trie_data_len(b))
+        trie_lsm_split(b, mismatch, m);
+    if (mismatch < trie_data_len(s))
+        trie_lsm_split(s, mismatch, m);
+    m->stats.merged_keys += trie_lsm_merge_node(b, s, m);
+    m->stats.merges++;
+    trie_mem_leave(allocator);
+}
+
+// Removes the moved subtrees from the memtable nobody sees anymore, so it can be freed
+static
+void trie_lsm_detach(struct _trie_lsm_merge * m) {
+    int i, pos, found;
+
+    for (i = 0; i < m->moved; i++) {
+        found = trie_search_in_childs(&pos, &(m->parents[i]->childs), m->firsts[i]);
+        assert(found);
+        (void)found;
+        trie_remove_child(&(m->parents[i]->childs), pos);
+    }
+    free(m->parents);
+    free(m->firsts);
+}
+
+static inline
+void trie_lsm_lock(trie_lsm_t * l) {
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(l->lock));
+#else
+    (void)l;
+#endif
+}
+
+static inline
+void trie_lsm_unlock(trie_lsm_t * l) {
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(l->lock));
+#else
+    (void)l;
+#endif
+}
+
+#ifndef NO_PTHREAD
+
+static
+void * trie_lsm_thread(void * arg) {
+    trie_lsm_t * l = arg;
+    struct _trie_lsm_table * table;
+    struct _trie_lsm_merge m;
+
+    pthread_mutex_lock(&(l->lock));
+    while (1) {
+        while ((l->frozen == NULL) && !(l->closing))
+            pthread_cond_wait(&(l->wake), &(l->lock));
+        if (l->frozen == NULL)
+            break; // Closing, and nothing left
+        table = l->frozen; // Only this thread removes it
+        pthread_mutex_unlock(&(l->lock));
+
+        memset(&m, 0, sizeof(m));
+        trie_lsm_merge_table(l, &(table->trie), &m);
+
+        pthread_rwlock_wrlock(&(l->tables)); // Lookups find its keys in the base from now on
+        pthread_mutex_lock(&(l->lock));
+        l->frozen = table->next;
+        if (l->frozen == NULL)
+            l->frozen_last = NULL;
+        l->frozen_num--;
+        l->stats.merges += m.stats.merges;
+        l->stats.merged_keys += m.stats.merged_keys;
+        l->stats.grafts += m.stats.grafts;
+        l->stats.splits += m.stats.splits;
+        pthread_cond_broadcast(&(l->merged));
+        pthread_mutex_unlock(&(l->lock));
+        pthread_rwlock_unlock(&(l->tables));
+
+        trie_lsm_detach(&m);
+        trie_lsm_table_free(table);
+        pthread_mutex_lock(&(l->lock));
+    }
+    pthread_mutex_unlock(&(l->lock));
+    return NULL;
+}
+
+#endif // NO_PTHREAD
+
+// Starts a new memtable for w, which is locked. Returns SUCCESS or FAIL
+static
+int trie_lsm_freeze(trie_lsm_t * l, struct _trie_lsm_writer * w) {
+#ifndef NO_PTHREAD
+    struct _trie_lsm_table * table;
+
+    table = trie_lsm_table_new(l);
+    if (table == NULL)
+        return FAIL;
+    pthread_mutex_lock(&(l->lock));
+    while (l->frozen_num >= l->config.max_frozen) // Lets the merger catch up
+        pthread_cond_wait(&(l->merged), &(l->lock));
+    pthread_mutex_unlock(&(l->lock));
+
+    pthread_rwlock_wrlock(&(l->tables));
+    pthread_mutex_lock(&(l->lock));
+    if (l->frozen_last != NULL)
+        l->frozen_last->next = w->table;
+    else
+        l->frozen = w->table;
+    l->frozen_last = w->table;
+    l->frozen_num++;
+    l->stats.freezes++;
+    w->table = table;
+    pthread_cond_signal(&(l->wake));
+    pthread_mutex_unlock(&(l->lock));
+    pthread_rwlock_unlock(&(l->tables));
+#else // No merger, merges it now and reuses it
+    struct _trie_lsm_merge m;
+
+    memset(&m, 0, sizeof(m));
+    m.stats = l->stats;
+    trie_lsm_merge_table(l, &(w->table->trie), &m);
+    trie_lsm_detach(&m);
+    trie_clear_keys(&(w->table->trie)); // Keeps the allocator of the base
+    l->stats = m.stats;
+    l->stats.freezes++;
+#endif
+    return SUCCESS;
+}
+
+int trie_lsm_open(trie_lsm_t * l, trie_ptr_t base, const trie_lsm_config_t * config) {
+    int i;
+
+    if ((l == NULL) || (base == NULL))
+        return FAIL; // Invalid ptr
+    memset(l, 0, sizeof(*l));
+    l->base = base;
+    if (config != NULL)
+        l->config = *config;
+    else
+        trie_lsm_config_init(&(l->config));
+#ifdef NO_PTHREAD
+    l->config.writers = 1; // Only this thread
+#endif
+    if ((l->config.writers < 1) || (l->config.memtable_keys < 1) || (l->config.max_frozen < 1))
+        return FAIL;
+    l->writers = malloc(l->config.writers*sizeof(*(l->writers)));
+    if (l->writers == NULL)
+        return FAIL;
+    for (i = 0; i < l->config.writers; i++) {
+        l->writers[i].table = trie_lsm_table_new(l);
+        if (l->writers[i].table == NULL) {
+            while (i-- > 0)
+                trie_lsm_table_free(l->writers[i].table);
+            free(l->writers);
+            l->writers = NULL;
+            return FAIL;
+        }
+#ifndef NO_PTHREAD
+        pthread_mutex_init(&(l->writers[i].lock), NULL);
+#endif
+    }
+#ifndef NO_PTHREAD
+    pthread_rwlock_init(&(l->tables), NULL);
+    pthread_mutex_init(&(l->lock), NULL);
+    pthread_cond_init(&(l->wake), NULL);
+    pthread_cond_init(&(l->merged), NULL);
+    i = pthread_create(&(l->merger), NULL, trie_lsm_thread, l);
+    assert(i == 0);
+#endif
+    return SUCCESS;
+}
+
+int trie_lsm_flush(trie_lsm_t * l) {
+    int i, res = SUCCESS;
+
+    if ((l == NULL) || (l->writers == NULL))
+        return FAIL; // Invalid ptr
+    for (i = 0; i < l->config.writers; i++) {
+#ifndef NO_PTHREAD
+        pthread_mutex_lock(&(l->writers[i].lock));
+#endif
+        if ((trie_count(&(l->writers[i].table->trie)) > 0) && (trie_lsm_freeze(l, l->writers + i) != SUCCESS))
+            res = FAIL;
+#ifndef NO_PTHREAD
+        pthread_mutex_unlock(&(l->writers[i].lock));
+#endif
+    }
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(l->lock));
+    while (l->frozen != NULL)
+        pthread_cond_wait(&(l->merged), &(l->lock));
+    pthread_mutex_unlock(&(l->lock));
+#endif
+    return res;
+}
+
+int trie_lsm_close(trie_lsm_t * l) {
+    int i, res;
+
+    res = trie_lsm_flush(l);
+    if (res != SUCCESS)
+        return FAIL;
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(l->lock));
+    l->closing = 1;
+    pthread_cond_signal(&(l->wake));
+    pthread_mutex_unlock(&(l->lock));
+    pthread_join(l->merger, NULL);
+    pthread_rwlock_destroy(&(l->tables));
+    pthread_mutex_destroy(&(l->lock));
+    pthread_cond_destroy(&(l->wake));
+    pthread_cond_destroy(&(l->merged));
+#endif
+    for (i = 0; i < l->config.writers; i++) {
+        trie_lsm_table_free(l->writers[i].table);
+#ifndef NO_PTHREAD
+        pthread_mutex_destroy(&(l->writers[i].lock));
+#endif
+    }
+    free(l->writers);
+    l->writers = NULL;
+    return SUCCESS;
+}
+
+int trie_lsm_add(trie_lsm_t * l, const DATA_t * arr, int len) {
+    struct _trie_lsm_writer * w;
+    int res;
+
+    if ((l == NULL) || (l->writers == NULL) || (arr == NULL))
+        return FAIL; // Invalid ptr
+#ifndef NO_PTHREAD
+    if (trie_lsm_hint < 0)
+        trie_lsm_hint = __atomic_fetch_add(&trie_lsm_threads, 1, __ATOMIC_RELAXED);
+    w = l->writers + trie_lsm_hint%l->config.writers;
+    pthread_mutex_lock(&(w->lock));
+#else
+    w = l->writers;
+#endif
+    res = trie_add(&(w->table->trie), arr, len);
+    if ((res == SUCCESS) && (trie_count(&(w->table->trie)) >= l->config.memtable_keys))
+        res = trie_lsm_freeze(l, w);
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(w->lock));
+#endif
+    return res;
+}
+
+int trie_lsm_find(trie_lsm_t * l, const DATA_t * arr, int len) {
+    struct _trie_lsm_table * table;
+    int i, found = 0;
+
+    if ((l == NULL) || (l->writers == NULL) || (arr == NULL))
+        return 0; // Invalid ptr
+#ifndef NO_PTHREAD
+    pthread_rwlock_rdlock(&(l->tables));
+#endif
+    for (i = 0; (i < l->config.writers) && !found; i++)
+        found = trie_find(&(l->writers[i].table->trie), arr, len);
+    for (table = l->frozen; (table != NULL) && !found; table = table->next)
+        found = trie_find(&(table->trie), arr, len);
+#ifndef NO_PTHREAD
+    pthread_rwlock_unlock(&(l->tables));
+#endif
+    return found || trie_find(l->base, arr, len); // Merged keys are there before leaving memtables
+}
+
+static inline
+int trie_lsm_compare(const trie_iterator_t * a, const trie_iterator_t * b) {
+    int len, res;
+
+    len = (trie_iterator_data_len(a) < trie_iterator_data_len(b))?trie_iterator_data_len(a):trie_iterator_data_len(b);
+    res = trie_data_compare(trie_iterator_data(a), trie_iterator_data(b), len);
+    return (res != 0)?res:(trie_iterator_data_len(a) - trie_iterator_data_len(b));
+}
+
+int trie_lsm_foreach(trie_lsm_t * l, trie_scan_callback_t callback, void * ctx) {
+    struct _trie_lsm_source * sources;
+    struct _trie_lsm_table * table;
+    int i, num, min, visited = 0;
+
+    if ((l == NULL) || (l->writers == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+#ifndef NO_PTHREAD
+    pthread_rwlock_rdlock(&(l->tables));
+#endif
+    sources = malloc((l->config.writers + l->frozen_num + 1)*sizeof(*sources));
+    assert(sources);
+    num = 0;
+    sources[num++].trie = l->base;
+    for (i = 0; i < l->config.writers; i++)
+        sources[num++].trie = &(l->writers[i].table->trie);
+    for (table = l->frozen; table != NULL; table = table->next)
+        sources[num++].trie = &(table->trie);
+    for (i = 0; i < num; i++) {
+        trie_iterator_init(&(sources[i].iter));
+        sources[i].valid = trie_iterator_next(sources[i].trie, &(sources[i].iter));
+    }
+
+    while (1) { // k-way merge, k is small
+        min = -1;
+        for (i = 0; i < num; i++)
+            if (sources[i].valid && ((min < 0) || (trie_lsm_compare(&(sources[i].iter), &(sources[min].iter)) < 0)))
+                min = i;
+        if (min < 0)
+            break; // Every source ended
+        visited++;
+        if (callback(trie_iterator_data(&(sources[min].iter)), trie_iterator_data_len(&(sources[min].iter)), ctx))
+            break;
+        for (i = 0; i < num; i++) // The same key may be in more sources
+            if ((i != min) && sources[i].valid && (trie_lsm_compare(&(sources[i].iter), &(sources[min].iter)) == 0))
+                sources[i].valid = trie_iterator_next(sources[i].trie, &(sources[i].iter));
+        sources[min].valid = trie_iterator_next(sources[min].trie, &(sources[min].iter));
+    }
+
+    for (i = 0; i < num; i++)
+        trie_iterator_clear(&(sources[i].iter));
+    free(sources);
+#ifndef NO_PTHREAD
+    pthread_rwlock_unlock(&(l->tables));
+#endif
+    return visited;
+}
+
+void trie_lsm_stats(trie_lsm_t * l, trie_lsm_stats_t * stats) {
+    if (l->writers == NULL) { // Closed, no lock anymore
+        *stats = l->stats;
+        return;
+    }
+    trie_lsm_lock(l);
+    *stats = l->stats;
+    trie_lsm_unlock(l);
+}
@@ -16,14 +16,29 @@
     along with this program.  If not, see http://www.gnu.org/licenses/ .
 */
 
+#ifndef NO_PTHREAD // Multithread version
 #include <pthread.h>
 #include <errno.h>
 #include <assert.h>
+#include <sched.h> // sched_yield
+
+/*
+   Rwlocks prefer readers, and writers keep their path readlocked: with a steady flow of
+   operations the nodes near the root would never be free for a writer. So a thread holding no
+   node lock, which is starting an operation, waits for the writers of the node before taking
+   its readlock. Threads already holding locks never wait there: they may hold this node too, or
+   a node the writer is waiting for, and would deadlock (as with writer preferring rwlocks).
+*/
+static __thread int trie_locks_held = 0; // Node locks of this thread
 
 // Errors may be EINVAL, EDEADLK, EAGAIN
 static inline
 void trie_readlock(struct _rwlock * rw) {
     int res;
+    if (trie_locks_held == 0) // New operation, writers first
+        while (__atomic_load_n(&(rw->writers), __ATOMIC_ACQUIRE) != 0)
+            sched_yield();
+    trie_locks_held++;
 #ifndef USE_NOT_UPGRADABLE_MUTEX
     res = pthread_rwlock_rdlock(&(rw->write_peeding));
     assert(res == 0);
@@ -37,12 +52,15 @@ void trie_readlock(struct _rwlock * rw) {
 static inline
 void trie_writelock(struct _rwlock * rw) {
     int res;
+    __atomic_add_fetch(&(rw->writers), 1, __ATOMIC_ACQ_REL); // Stops new readers
+    trie_locks_held++;
 #ifndef USE_NOT_UPGRADABLE_MUTEX
     res = pthread_rwlock_wrlock(&(rw->write_peeding)); // waits each read lock is released
     assert(res == 0);
 #endif
     res = pthread_rwlock_wrlock(&(rw->rwlock));
     assert(res == 0);
+    __atomic_sub_fetch(&(rw->writers), 1, __ATOMIC_RELEASE);
     (void)res; // Uses res, suppress warning (optimization should remove res)
 }
 
@@ -91,6 +109,7 @@ int trie_upgrade_lock(struct _rwlock * rw) {
 static inline
 void trie_unlock(struct _rwlock * rw) {
     int res;
+    trie_locks_held--;
     res = pthread_rwlock_unlock(&(rw->rwlock));
     assert(res == 0);
 #ifndef USE_NOT_UPGRADABLE_MUTEX
@@ -100,8 +119,24 @@ void trie_unlock(struct _rwlock * rw) {
     (void)res; // Uses res, suppress warning (optimization should remove res)
 }
 
+// Counters are updated while holding only a readlock, so they need atomic operations
+#define trie_atomic_add(ptr, val) __atomic_add_fetch(ptr, val, __ATOMIC_RELAXED)
+#define trie_atomic_load(ptr)     __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define trie_atomic_store(ptr, val) __atomic_store_n(ptr, val, __ATOMIC_RELAXED)
+// Generation stamps pair with the checkpoint taking a new generation, so they are ordered (see trie_touch)
+#define trie_atomic_add_sc(ptr, val) __atomic_add_fetch(ptr, val, __ATOMIC_SEQ_CST)
+#define trie_atomic_load_sc(ptr)     __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+
+static inline // *ptr becomes val, unless it is already greater
+void trie_atomic_max(int * ptr, int val) {
+    int cur = __atomic_load_n(ptr, __ATOMIC_SEQ_CST);
+    while ((cur < val) && !__atomic_compare_exchange_n(ptr, &cur, val, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        ; // cur is reloaded by the failed exchange
+}
+
 static inline
 void trie_init_mutex(struct _rwlock * rw) {
+    rw->writers = 0;
 #ifndef USE_NOT_UPGRADABLE_MUTEX
     pthread_mutex_init(&(rw->upgrade), NULL);
     pthread_rwlock_init(&(rw->write_peeding), NULL);
@@ -117,3 +152,21 @@ void trie_destroy_mutex(struct _rwlock * rw) {
     pthread_mutex_destroy(&(rw->upgrade));
 #endif
 }
+
+#else // defined NO_PTHREAD, single thread version
+// There is no lock inside nodes, so every lock operation is removed at compile time.
+// Arguments are never evaluated, so t->lock may not exist at all
+#    define trie_readlock(rw)       ((void)0)
+#    define trie_writelock(rw)      ((void)0)
+#    define trie_readlock_upgrd(rw) ((void)0)
+#    define trie_upgrade_lock(rw)   0 // Always success, there is no one else
+#    define trie_unlock(rw)         ((void)0)
+#    define trie_init_mutex(rw)     ((void)0)
+#    define trie_destroy_mutex(rw)  ((void)0)
+#    define trie_atomic_add(ptr, val) (*(ptr) += (val))
+#    define trie_atomic_load(ptr)     (*(ptr))
+#    define trie_atomic_store(ptr, val) (*(ptr) = (val))
+#    define trie_atomic_add_sc(ptr, val) (*(ptr) += (val))
+#    define trie_atomic_load_sc(ptr)     (*(ptr))
+#    define trie_atomic_max(ptr, val)    ((void)((*(ptr) < (val)) && (*(ptr) = (val))))
+#endif // NO_PTHREAD
@@ -0,0 +1,455 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdlib.h> // malloc
+#include <string.h> // memmove
+#include <assert.h>
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#include <unistd.h> // sysconf
+#endif
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_utils.c, trie_childs.c, trie_mutex.c, trie.c (trie_foreach_helper)
+
+/*
+   The trie is split in units: subtrees, or single keys ending in a node which was split.
+   Units are kept in key order, the largest one is split in its childs while there are
+   less than TRIE_UNITS_PER_WORKER units for each worker. Subtree sizes are the key counts.
+   Split nodes stay readlocked until every worker has finished.
+
+   Each worker starts from a contiguous range of units, then steals from the end of the
+   ranges of the others. Collected keys are saved in a buffer for each unit, then
+   concatenated in unit order.
+
+   The caller is worker 0, the others come from a pool of threads started by the runs that
+   need them and kept for the next ones, at most TRIE_POOL_MAX. Each run is a job in the
+   pool queue, concurrent runs share the threads in arrival order. A worker is taken when a
+   pool thread is idle: once worker 0 finds no units left the ones not taken yet are
+   skipped, every unit is already being visited. Runs from inside a worker use no pool.
+   trie_parallel_shutdown stops the threads.
+*/
+
+#define TRIE_UNITS_PER_WORKER 8 // More units balance better, but cost more splits
+
+struct _trie_unit {
+    struct _trie * node; // Subtree root, NULL for a single key
+    int prefix; // Offset of the key prefix in the prefixes buffer
+    int prefix_len; // For a single key, this is the key
+    int count; // Estimated number of keys
+    int leaf; // Cannot be split
+    trie_keys_t keys; // Keys collected
+};
+
+struct _trie_queue { // Units not visited yet of a worker, [begin, end)
+    int begin, end;
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+struct _trie_parallel {
+    struct _trie_unit * units;
+    int unit_num, unit_alloc;
+    trie_arr_t prefixes; // Prefixes of every unit, one after the other
+    struct _trie ** locked; // Split nodes, readlocked
+    int locked_num;
+    struct _trie_queue * queues;
+    int workers;
+    trie_parallel_callback_t callback; // NULL when collecting keys
+    void * ctx;
+    int stop; // Not 0 when a callback asked to stop
+    int found; // Keys visited
+};
+
+struct _trie_worker {
+    struct _trie_parallel * p;
+    struct _trie_unit * unit; // Unit being visited
+    int id;
+};
+
+static inline
+struct _trie_unit * trie_parallel_new_unit(struct _trie_parallel * p, int pos) {
+    if (p->unit_num == p->unit_alloc) { // Doubles
+        p->unit_alloc = (p->unit_alloc == 0)?16:(2*p->unit_alloc);
+        p->units = realloc(p->units, (p->unit_alloc)*sizeof*(p->units));
+        assert(p->units);
+    }
+    memmove(p->units + pos + 1, p->units + pos, (p->unit_num - pos)*sizeof*(p->units));
+    p->unit_num++;
+    memset(p->units + pos, 0, sizeof*(p->units));
+    trie_keys_init(&(p->units[pos].keys));
+    return p->units + pos;
+}
+
+// Substitutes the unit at pos with the key ending in its node, and its childs
+static
+void trie_parallel_split(struct _trie_parallel * p, int pos) {
+    struct _trie * node;
+    trie_arr_t prefix;
+    struct _trie_unit * unit;
+    int i, offset;
+
+    node = p->units[pos].node;
+    trie_readlock(&(node->lock)); // Until the end
+    if (trie_empty_childs(node)) { // Nothing to split
+        trie_unlock(&(node->lock));
+        p->units[pos].leaf = 1;
+        return;
+    }
+
+    // Builds the prefix of the childs
+    trie_arr_init(&prefix);
+    trie_arr_substitute_end(&prefix, 0, trie_arr_data(&(p->prefixes)) + p->units[pos].prefix, p->units[pos].prefix_len);
+    trie_arr_substitute_end(&prefix, trie_arr_len(&prefix), trie_data(node), trie_data_len(node));
+    offset = trie_arr_len(&prefix);
+
+    p->locked[p->locked_num++] = node;
+    p->unit_num--; // Removes the unit, keeps its position
+    memmove(p->units + pos, p->units + pos + 1, (p->unit_num - pos)*sizeof*(p->units));
+
+    if (trie_data_end(node)) { // Shorter key comes first
+        unit = trie_parallel_new_unit(p, pos++);
+        unit->prefix = trie_arr_len(&(p->prefixes));
+        unit->prefix_len = offset;
+        unit->count = 1;
+        unit->leaf = 1;
+        trie_arr_substitute_end(&(p->prefixes), unit->prefix, trie_arr_data(&prefix), offset);
+    }
+    for (i = 0; i < trie_get_child_num(node); i++) {
+        trie_arr_substitute_end(&prefix, offset, &(trie_get_first(node, i)), 1); // adds the first character
+        unit = trie_parallel_new_unit(p, pos++);
+        unit->node = trie_get_child(node, i);
+        unit->prefix = trie_arr_len(&(p->prefixes));
+        unit->prefix_len = offset + 1;
+        unit->count = trie_get_count(unit->node);
+        trie_arr_substitute_end(&(p->prefixes), unit->prefix, trie_arr_data(&prefix), offset + 1);
+    }
+    trie_arr_clear(&prefix);
+}
+
+static
+void trie_parallel_partition(struct _trie_parallel * p, trie_ptr_t t) {
+    int i, largest, target, limit;
+
+    trie_parallel_new_unit(p, 0)->node = t; // The whole trie
+    p->units[0].count = trie_get_count(t);
+
+    target = p->workers*TRIE_UNITS_PER_WORKER;
+    limit = p->units[0].count/target; // Units smaller than this are not split
+    p->locked = malloc(target*sizeof*(p->locked)); // Each split adds at least one unit
+    assert(p->locked);
+    while ((p->unit_num < target) && (p->locked_num < target)) {
+        largest = -1;
+        for (i = 0; i < p->unit_num; i++)
+            if (!(p->units[i].leaf) && (p->units[i].count > limit) &&
+                ((largest < 0) || (p->units[i].count > p->units[largest].count)))
+                largest = i;
+        if (largest < 0) // Units are small enough
+            break;
+        trie_parallel_split(p, largest);
+    }
+}
+
+static
+int trie_parallel_key(const DATA_t * key, int len, void * ctx) {
+    struct _trie_worker * w = ctx;
+
+    if (w->p->callback == NULL) { // Collecting keys
+        trie_keys_add(&(w->unit->keys), key, len);
+        return 0;
+    }
+    if (w->p->callback(key, len, w->id, w->p->ctx))
+        trie_atomic_add(&(w->p->stop), 1);
+    return trie_atomic_load(&(w->p->stop)); // Some worker might have stopped
+}
+
+// Takes the first unit from its own queue, or the last from the one of another worker
+static inline
+int trie_parallel_next_unit(struct _trie_parallel * p, int id) {
+    int i, q, pos;
+
+    pos = -1;
+    for (i = 0; (i < p->workers) && (pos < 0); i++) {
+        q = (id + i) % p->workers;
+#ifndef NO_PTHREAD
+        pthread_mutex_lock(&(p->queues[q].lock));
+#endif
+        if (p->queues[q].begin < p->queues[q].end)
+            pos = (i == 0)?(p->queues[q].begin++):(--(p->queues[q].end));
+#ifndef NO_PTHREAD
+        pthread_mutex_unlock(&(p->queues[q].lock));
+#endif
+    }
+    return pos;
+}
+
+static
+void * trie_parallel_worker(void * arg) {
+    struct _trie_worker * w = arg;
+    struct _trie_parallel * p = w->p;
+    const DATA_t * prefix;
+    int pos, found;
+
+    while (!trie_atomic_load(&(p->stop)) && ((pos = trie_parallel_next_unit(p, w->id)) >= 0)) {
+        w->unit = p->units + pos;
+        prefix = trie_arr_data(&(p->prefixes)) + w->unit->prefix;
+        if (w->unit->node == NULL) { // Single key
+            trie_parallel_key(prefix, w->unit->prefix_len, w);
+            found = 1;
+        } else {
+            found = trie_foreach_helper(w->unit->node, prefix, w->unit->prefix_len, trie_parallel_key, NULL, w);
+        }
+        trie_atomic_add(&(p->found), found);
+    }
+    return NULL;
+}
+
+#ifndef NO_PTHREAD
+#define TRIE_POOL_MAX 64 // Pool threads, the workers of larger runs are stolen by the others
+
+struct _trie_job { // A run, while it has workers not taken yet it is in the pool queue
+    struct _trie_worker * w;
+    int workers, next; // Workers of the run, and the next one to take
+    int running; // Pool threads inside the run
+    pthread_cond_t done; // Signaled when the last pool thread leaves the run
+    struct _trie_job * next_job;
+};
+
+struct _trie_pool {
+    int threads; // Started and not stopped
+    int idle; // Threads waiting for a job
+    int stop; // Set by trie_parallel_shutdown
+    struct _trie_job * first, * last; // Queue of the runs, in arrival order
+    pthread_mutex_t lock;
+    pthread_cond_t work; // Signaled when a run begins, or on shutdown
+    pthread_cond_t stopped; // Signaled when a thread stops
+};
+
+static struct _trie_pool trie_pool = {0, 0, 0, NULL, NULL, PTHREAD_MUTEX_INITIALIZER,
+                                      PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER};
+static __thread int trie_pool_inside = 0; // The thread is a worker of a run
+
+// trie_pool.lock is locked
+static
+void trie_pool_dequeue(struct _trie_job * job) {
+    struct _trie_job ** j;
+
+    for (j = &(trie_pool.first); *j != NULL; j = &((*j)->next_job)) {
+        if (*j == job) {
+            *j = job->next_job;
+            break;
+        }
+    }
+    if (trie_pool.last == job) { // Finds the new tail
+        trie_pool.last = trie_pool.first;
+        while ((trie_pool.last != NULL) && (trie_pool.last->next_job != NULL))
+            trie_pool.last = trie_pool.last->next_job;
+    }
+    job->next_job = NULL;
+}
+
+static
+void * trie_pool_thread(void * arg) {
+    struct _trie_job * job;
+    struct _trie_worker * w;
+    (void)arg;
+
+    trie_pool_inside = 1;
+    pthread_mutex_lock(&(trie_pool.lock));
+    while (1) {
+        trie_pool.idle++;
+        while ((trie_pool.first == NULL) && !trie_pool.stop)
+            pthread_cond_wait(&(trie_pool.work), &(trie_pool.lock));
+        trie_pool.idle--;
+        if (trie_pool.first == NULL) // Shutdown, no run waits for workers
+            break;
+        job = trie_pool.first;
+        w = job->w + job->next++;
+        if (job->next >= job->workers) // Every worker taken
+            trie_pool_dequeue(job);
+        job->running++;
+        pthread_mutex_unlock(&(trie_pool.lock));
+        trie_parallel_worker(w);
+        pthread_mutex_lock(&(trie_pool.lock));
+        if (--(job->running) == 0)
+            pthread_cond_signal(&(job->done));
+    }
+    trie_pool.threads--;
+    pthread_cond_broadcast(&(trie_pool.stopped));
+    pthread_mutex_unlock(&(trie_pool.lock));
+    return NULL;
+}
+
+// Runs the workers, w[0] on this thread, the others on idle pool threads. Starts the
+// threads still missing, up to TRIE_POOL_MAX
+static
+void trie_pool_run(struct _trie_worker * w, int workers) {
+    struct _trie_job job;
+    pthread_t tid;
+    int missing;
+
+    job.w = w;
+    job.workers = workers;
+    job.next = 1;
+    job.running = 0;
+    job.next_job = NULL;
+    pthread_cond_init(&(job.done), NULL);
+
+    pthread_mutex_lock(&(trie_pool.lock));
+    missing = workers - 1 - trie_pool.idle;
+    while ((missing-- > 0) && (trie_pool.threads < TRIE_POOL_MAX)) {
+        if (pthread_create(&tid, NULL, trie_pool_thread, NULL) != 0)
+            break; // Fewer threads, the others steal their units
+        pthread_detach(tid);
+        trie_pool.threads++;
+    }
+    if (workers > 1) {
+        if (trie_pool.last != NULL)
+            trie_pool.last->next_job = &job;
+        else
+            trie_pool.first = &job;
+        trie_pool.last = &job;
+        pthread_cond_broadcast(&(trie_pool.work));
+    }
+    pthread_mutex_unlock(&(trie_pool.lock));
+
+    trie_pool_inside = 1;
+    trie_parallel_worker(w);
+    trie_pool_inside = 0;
+
+    pthread_mutex_lock(&(trie_pool.lock));
+    if (job.next < job.workers) { // Not taken yet, no units left for them
+        job.next = job.workers;
+        trie_pool_dequeue(&job);
+    }
+    while (job.running > 0)
+        pthread_cond_wait(&(job.done), &(trie_pool.lock));
+    pthread_mutex_unlock(&(trie_pool.lock));
+    pthread_cond_destroy(&(job.done));
+}
+#endif
+
+void trie_parallel_shutdown(void) {
+#ifndef NO_PTHREAD
+    assert(!trie_pool_inside); // A pool thread would wait for itself
+    pthread_mutex_lock(&(trie_pool.lock));
+    trie_pool.stop = 1;
+    pthread_cond_broadcast(&(trie_pool.work));
+    while (trie_pool.threads > 0)
+        pthread_cond_wait(&(trie_pool.stopped), &(trie_pool.lock));
+    trie_pool.stop = 0; // Later runs start new threads
+    pthread_mutex_unlock(&(trie_pool.lock));
+#endif
+}
+
+static
+void trie_parallel_run(trie_ptr_t t, int workers, trie_parallel_callback_t callback, void * ctx,
+                       struct _trie_parallel * p) {
+    struct _trie_worker * w;
+    int i;
+#ifndef NO_PTHREAD
+    int nested = trie_pool_inside; // Pool threads could all be waiting for this one
+
+    if (workers <= 0) // One for each cpu
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((workers <= 0) || nested)
+        workers = 1;
+#else
+    workers = 1; // Not thread safe, visits the units in order
+#endif
+
+    memset(p, 0, sizeof(*p));
+    p->workers = workers;
+    p->callback = callback;
+    p->ctx = ctx;
+    trie_arr_init(&(p->prefixes));
+    trie_parallel_partition(p, t);
+
+    p->queues = malloc(workers*sizeof*(p->queues));
+    w = malloc(workers*sizeof*w);
+    assert(p->queues && w);
+    for (i = 0; i < workers; i++) { // Contiguous ranges of units
+        p->queues[i].begin = (long)(p->unit_num)*i/workers;
+        p->queues[i].end = (long)(p->unit_num)*(i + 1)/workers;
+        w[i].p = p;
+        w[i].unit = NULL;
+        w[i].id = i;
+    }
+
+#ifndef NO_PTHREAD
+    for (i = 0; i < workers; i++)
+        pthread_mutex_init(&(p->queues[i].lock), NULL);
+    if (nested)
+        trie_parallel_worker(w);
+    else
+        trie_pool_run(w, workers);
+    for (i = 0; i < workers; i++)
+        pthread_mutex_destroy(&(p->queues[i].lock));
+#else
+    trie_parallel_worker(w);
+#endif
+
+    for (i = p->locked_num - 1; i >= 0; i--) // Releases split nodes
+        trie_unlock(&(p->locked[i]->lock));
+    free(w);
+    free(p->queues);
+    free(p->locked);
+}
+
+static
+void trie_parallel_clear(struct _trie_parallel * p) {
+    int i;
+    for (i = 0; i < p->unit_num; i++)
+        trie_keys_clear(&(p->units[i].keys));
+    free(p->units);
+    trie_arr_clear(&(p->prefixes));
+}
+
+int trie_foreach_parallel(trie_ptr_t t, int workers, trie_parallel_callback_t callback, void * ctx) {
+    struct _trie_parallel p;
+
+    if ((t == NULL) || (callback == NULL))
+        return 0; // Invalid ptr
+
+    trie_parallel_run(t, workers, callback, ctx, &p);
+    trie_parallel_clear(&p);
+    return p.found;
+}
+
+int trie_collect_parallel(trie_ptr_t t, int workers, trie_keys_t * keys) {
+    struct _trie_parallel p;
+    int i, j, offset;
+
+    if ((t == NULL) || (keys == NULL))
+        return 0; // Invalid ptr
+
+    trie_parallel_run(t, workers, NULL, NULL, &p);
+    keys->num = 0; // Overwrites old keys, keeps the memory
+    trie_arr_len(&(keys->data)) = 0;
+    for (i = 0; i < p.unit_num; i++) { // Concatenates in key order
+        offset = 0;
+        for (j = 0; j < p.units[i].keys.num; j++) {
+            trie_keys_add(keys, trie_arr_data(&(p.units[i].keys.data)) + offset, p.units[i].keys.lens[j]);
+            offset += p.units[i].keys.lens[j];
+        }
+    }
+    trie_parallel_clear(&p);
+    return keys->num;
+}
@@ -0,0 +1,230 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdlib.h> // malloc
+#include <stdint.h> // uint32_t
+#include <assert.h>
+#include "trie.h"
+
+// This source uses functions from:
+//    trie_alloc.c (trie_mem_*), trie_mutex.c
+
+/*
+   References between nodes: child arrays hold a trie_node_ref_t for each child, node data
+   (the label) is a trie_label_ref_t. Without TRIE_COMPRESSED_REFS they are plain pointers,
+   nodes and labels come from trie_mem_alloc.
+
+   With TRIE_COMPRESSED_REFS both are 32 bit, so child arrays take half the space and a cache
+   line holds twice the childs. Nodes live in chunks of 2^TRIE_NODE_CHUNK_BITS nodes, the index
+   of a node is its chunk and its position there; each node knows its own index (ref field).
+   Labels live in a single pool reserved at first use, a label is its offset from the start of
+   the pool, so a child may still point inside the label of its parent (see
+   trie_attach_existent_data). Each label block begins with its size class; free blocks of a
+   class form a list, as in the chunks of trie_alloc.c. Index and offset 0 are never used, they
+   mean NULL.
+
+   Pools are shared by every trie, so hooks of trie_init_with_allocator see only child arrays;
+   nodes and labels are still counted in the live bytes of the allocator.
+*/
+
+#ifndef TRIE_COMPRESSED_REFS
+
+#define trie_node_alloc()      ((struct _trie *)trie_mem_alloc(sizeof(struct _trie)))
+#define trie_node_free(node)   trie_mem_free(node)
+#define trie_label_alloc(len)  ((DATA_t *)trie_mem_alloc((len)*sizeof(DATA_t)))
+#define trie_label_free(label) trie_mem_free((DATA_t *)(label))
+
+#define trie_node_ptr(ref)     (ref)
+#define trie_node_ref(node)    (node)
+#define trie_label_ptr(ref)    (ref)
+#define trie_label_ref(ptr)    (ptr)
+
+#else // TRIE_COMPRESSED_REFS
+
+#include <sys/mman.h> // mmap
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#endif
+
+#define TRIE_NODE_CHUNK_BITS 16 // Nodes for each chunk, 2^16
+#define TRIE_NODE_CHUNKS (1 << (32 - TRIE_NODE_CHUNK_BITS))
+#define TRIE_LABEL_POOL ((size_t)1 << 32) // Bytes reserved, pages are used only when touched
+#define TRIE_LABEL_HEADER ((sizeof(DATA_t) > sizeof(uint32_t))?sizeof(DATA_t):sizeof(uint32_t))
+#define TRIE_LABEL_CLASSES 56 // 8, then 16 and 24 bytes doubled up to 2GB
+
+struct _trie_refs {
+    uint32_t node_free; // Free nodes, the ref field of each one is the next
+    uint32_t node_top; // Nodes never used start here
+    uint32_t label_free[TRIE_LABEL_CLASSES]; // Free blocks, each one begins with the next
+    size_t label_top; // Never used part of the pool
+#ifndef NO_PTHREAD
+    pthread_mutex_t lock;
+#endif
+};
+
+static struct _trie * trie_node_chunks[TRIE_NODE_CHUNKS]; // Chunks are never freed
+static char * trie_label_base = NULL; // Start of the label pool
+#ifndef NO_PTHREAD
+static struct _trie_refs trie_refs = {0, 1, {0}, TRIE_LABEL_HEADER, PTHREAD_MUTEX_INITIALIZER};
+#else
+static struct _trie_refs trie_refs = {0, 1, {0}, TRIE_LABEL_HEADER};
+#endif
+
+#define trie_node_ptr(ref)  (trie_node_chunks[(ref) >> TRIE_NODE_CHUNK_BITS] + \
+                             ((ref) & ((1 << TRIE_NODE_CHUNK_BITS) - 1)))
+#define trie_label_ptr(ref) ((const DATA_t *)(trie_label_base + (ref)))
+
+static inline
+trie_node_ref_t trie_node_ref(const struct _trie * node) {
+    return (node == NULL)?0:node->ref;
+}
+
+static inline
+trie_label_ref_t trie_label_ref(const DATA_t * label) {
+    return (label == NULL)?0:(trie_label_ref_t)((const char *)label - trie_label_base);
+}
+
+static inline
+void trie_refs_lock(void) {
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(trie_refs.lock));
+#endif
+}
+
+static inline
+void trie_refs_unlock(void) {
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(trie_refs.lock));
+#endif
+}
+
+// Nodes and labels do not use the hooks, but they are memory of the trie
+static inline
+void trie_refs_account(long long bytes) {
+    if (trie_mem_allocator != NULL)
+        trie_atomic_add(&(trie_mem_allocator->live), bytes);
+}
+
+static
+struct _trie * trie_node_alloc(void) {
+    struct _trie * node;
+    uint32_t ref;
+
+    trie_refs_lock();
+    if (trie_refs.node_free != 0) { // Reuses a node
+        ref = trie_refs.node_free;
+        trie_refs.node_free = trie_node_ptr(ref)->ref;
+    } else {
+        ref = trie_refs.node_top;
+        if (ref == 0) { // Every index is taken, top wrapped around
+            trie_refs_unlock();
+            return NULL;
+        }
+        if (trie_node_chunks[ref >> TRIE_NODE_CHUNK_BITS] == NULL) { // First node of a chunk
+            trie_node_chunks[ref >> TRIE_NODE_CHUNK_BITS] =
+                trie_mem_base_alloc(sizeof(struct _trie) << TRIE_NODE_CHUNK_BITS);
+            if (trie_node_chunks[ref >> TRIE_NODE_CHUNK_BITS] == NULL) {
+                trie_refs_unlock();
+                return NULL;
+            }
+        }
+        trie_refs.node_top++;
+    }
+    trie_refs_unlock();
+    node = trie_node_ptr(ref);
+    node->ref = ref;
+    trie_refs_account(sizeof(struct _trie));
+    return node;
+}
+
+static inline
+void trie_node_free(struct _trie * node) {
+    uint32_t ref = node->ref;
+
+    trie_refs_account(-(long long)sizeof(struct _trie));
+    trie_refs_lock();
+    node->ref = trie_refs.node_free;
+    trie_refs.node_free = ref;
+    trie_refs_unlock();
+}
+
+static inline
+size_t trie_label_class_size(int cls) {
+    if (cls == 0)
+        return 8;
+    return (((cls - 1)%2 == 0)?(size_t)16:(size_t)24) << ((cls - 1)/2);
+}
+
+static
+DATA_t * trie_label_alloc(int len) {
+    size_t size;
+    uint32_t * block;
+    int cls;
+
+    size = TRIE_LABEL_HEADER + len*sizeof(DATA_t);
+    for (cls = 0; cls < TRIE_LABEL_CLASSES; cls++)
+        if (size <= trie_label_class_size(cls))
+            break;
+    if (cls == TRIE_LABEL_CLASSES)
+        return NULL; // Too large
+    size = trie_label_class_size(cls);
+
+    trie_refs_lock();
+    if (trie_label_base == NULL) { // First label, reserves the pool
+        trie_label_base = mmap(NULL, TRIE_LABEL_POOL, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (trie_label_base == MAP_FAILED) {
+            trie_label_base = NULL;
+            trie_refs_unlock();
+            return NULL;
+        }
+    }
+    if (trie_refs.label_free[cls] != 0) { // Reuses a block
+        block = (uint32_t *)(trie_label_base + trie_refs.label_free[cls]);
+        trie_refs.label_free[cls] = *block;
+    } else {
+        if (trie_refs.label_top + size > TRIE_LABEL_POOL) { // Pool full
+            trie_refs_unlock();
+            return NULL;
+        }
+        block = (uint32_t *)(trie_label_base + trie_refs.label_top);
+        trie_refs.label_top += size;
+    }
+    trie_refs_unlock();
+    *block = cls;
+    trie_refs_account(size);
+    return (DATA_t *)((char *)block + TRIE_LABEL_HEADER);
+}
+
+static inline
+void trie_label_free(const DATA_t * label) {
+    uint32_t * block;
+    int cls;
+
+    if (label == NULL)
+        return;
+    block = (uint32_t *)((char *)label - TRIE_LABEL_HEADER);
+    cls = *block;
+    trie_refs_account(-(long long)trie_label_class_size(cls));
+    trie_refs_lock();
+    *block = trie_refs.label_free[cls];
+    trie_refs.label_free[cls] = (char *)block - trie_label_base;
+    trie_refs_unlock();
+}
+
+#endif // TRIE_COMPRESSED_REFS
@@ -35,13 +35,22 @@ int find_first_mismatch(const DATA_t * arr1, int len1,
     return i;
 }
 
+// Compares two arrays of the same lenght, numerically, as memcmp does for bytes
+static inline
+int trie_data_compare(const DATA_t * arr1, const DATA_t * arr2, int len) {
+    int mismatch = find_first_mismatch(arr1, len, arr2, len);
+    if (mismatch == len)
+        return 0;
+    return (arr1[mismatch] < arr2[mismatch])?-1:1;
+}
+
 static inline
 void trie_attach_new_data(struct _trie * t, const DATA_t * arr, int len) {
     DATA_t * alloc_arr;
-    alloc_arr = malloc(len*sizeof(*(t->data.data))); // data after allocation is static, so alloc exactly the needed
+    alloc_arr = trie_label_alloc(len); // data after allocation is static, so alloc exactly the needed
     assert(alloc_arr);
-    memcpy(alloc_arr, arr, len*sizeof(*(t->data.data)));
-    t->data.data = alloc_arr;
+    memcpy(alloc_arr, arr, len*sizeof(*alloc_arr));
+    t->data.data = trie_label_ref(alloc_arr);
     t->data.len = len;
     t->data.end = 1; // Data ends here
     t->data.dealloc = 1; // Data is a new alloc, so must free it
@@ -50,7 +59,7 @@ void trie_attach_new_data(struct _trie * t, const DATA_t * arr, int len) {
 static inline
 void trie_attach_existent_data(struct _trie * t, const DATA_t * arr, int len) {
     t->data.len = len;
-    t->data.data = (DATA_t *)arr; // Simply attaches the pointer
+    t->data.data = trie_label_ref(arr); // Simply attaches the pointer
     t->data.dealloc = 0; // Data is not allocated
 }
 
@@ -63,28 +72,51 @@ void trie_attach_first_data(struct _trie * t, int pos, DATA_t new_data) {
 #define trie_set_data_end(t)   t->data.end = 1
 #define trie_clear_data_end(t) t->data.end = 0
 #define trie_data_end(t)       t->data.end
-#define trie_data(t)           t->data.data
+#define trie_data(t)           trie_label_ptr(t->data.data)
+#define trie_set_data(t, ptr)  t->data.data = trie_label_ref(ptr)
 #define trie_data_len(t)       t->data.len
 #define trie_get_childs(t)     t->childs.childs
 #define trie_get_firsts(t)     t->childs.firsts
 #define trie_get_child_num(t)  t->childs.child_num
+#define trie_count_add(t, val) trie_atomic_add(&((t)->count), val)
+#define trie_get_count(t)      trie_atomic_load(&((t)->count))
+#define trie_get_gen(t)        trie_atomic_load_sc(&((t)->gen))
+// Writers mark each node of their path, so a checkpoint knows which subtrees changed since the last one
+static int trie_generation = 1;
 #define trie_empty_childs(t)   (trie_get_child_num(t) == 0)
 #define trie_get_first(t, pos) trie_get_firsts(t)[pos]
-#define trie_get_child(t, pos) trie_get_childs(t)[pos]
+#define trie_get_child(t, pos) trie_node_ptr(trie_get_childs(t)[pos])
+#define trie_set_child(t, pos, node) trie_get_childs(t)[pos] = trie_node_ref(node)
 #define trie_is_root(t, node)  (t == node) // First is a trie, second is a node
 
+// Stamps t with the current generation. A checkpoint taking a new one between the load and the
+// store may have read the old stamp, and skipped t: the stamp is raised again to the new
+// generation, so the next checkpoint has the change. Stamps only grow, whatever the writers order
+static inline
+void trie_touch(struct _trie * t) {
+    int gen;
+
+    do {
+        gen = trie_atomic_load_sc(&trie_generation);
+        trie_atomic_max(&(t->gen), gen);
+    } while (trie_atomic_load_sc(&trie_generation) != gen);
+}
+
 static inline
 void trie_init_new_child(struct _trie * t, int pos) { // Inits a new empty child, without data
-    trie_get_child(t, pos) = malloc(sizeof**(trie_get_childs(t))); // Mallocs space for the child
-    assert(trie_get_child(t, pos));
+    trie_set_child(t, pos, trie_node_alloc()); // Allocs space for the child
+    assert(trie_get_childs(t)[pos]);
     trie_init_childs(&(trie_get_child(t, pos)->childs)); // Inits childs of the child
     trie_init_mutex(&(trie_get_child(t, pos)->lock)); // Inits mutex
 
     // Inits data, it might be not necessary if attaches data.
     trie_get_child(t, pos)->data.len = 0;
-    trie_get_child(t, pos)->data.data = NULL;
+    trie_set_data(trie_get_child(t, pos), NULL);
     trie_get_child(t, pos)->data.end = 0;
     trie_get_child(t, pos)->data.dealloc = 0;
+    trie_get_child(t, pos)->count = 0; // No keys
+    trie_get_child(t, pos)->gen = 0;
+    trie_touch(trie_get_child(t, pos)); // New nodes are changed
 }
 
 #define trie_correct_child_num(t) (trie_get_child_num(t) <= t->childs.child_alloc)
@@ -96,7 +128,7 @@ void trie_init_new_child(struct _trie * t, int pos) { // Inits a new empty child
 static inline
 void trie_destroy_data(struct _trie * const t) {
     if (t->data.dealloc)
-        free((DATA_t*)t->data.data);
+        trie_label_free(trie_data(t));
 }
 
 // WARNING: Never call this unless childs are fully freed
@@ -109,6 +141,87 @@ void trie_destroy_node_without_child(struct _trie * const t) {
     trie_destroy_mutex(&(t->lock));
 }
 
+static inline
+void trie_own_childs_data(struct _trie * const t, const DATA_t * old_data, int old_len);
+
+// If data of child points inside old_data (data of its parent), copies it. child must be writelocked
+static inline
+void trie_own_data(struct _trie * const child, const DATA_t * old_data, int old_len) {
+    const DATA_t * child_data;
+    DATA_t * alloc_arr;
+
+    child_data = trie_data(child);
+    if (!(child->data.dealloc) && (child_data == old_data + old_len + 1)) { // Points inside old data
+        trie_own_childs_data(child, child_data, trie_data_len(child)); // Same buffer for their childs
+        alloc_arr = trie_label_alloc(trie_data_len(child) + 1); // + 1 avoids malloc(0)
+        assert(alloc_arr);
+        memcpy(alloc_arr, child_data, trie_data_len(child)*sizeof(*alloc_arr));
+        trie_set_data(child, alloc_arr);
+        child->data.dealloc = 1;
+    }
+}
+
+// Childs created splitting a node point inside its data (see trie_attach_existent_data), so
+// before freeing data of t, each child pointing there gets its own copy. The same holds for their childs
+static inline
+void trie_own_childs_data(struct _trie * const t, const DATA_t * old_data, int old_len) {
+    int i;
+    struct _trie * child;
+
+    for (i = 0; i < trie_get_child_num(t); i++) {
+        child = trie_get_child(t, i);
+        trie_writelock(&(child->lock));
+        trie_own_data(child, old_data, old_len);
+        trie_unlock(&(child->lock));
+    }
+}
+
+// Merges the only child inside t, which must be writelocked. Keeps t, so its parent does not change
+static inline
+void trie_merge_only_child(struct _trie * const t) {
+    struct _trie * next;
+    DATA_t * newdata;
+    int newlen;
+
+    assert(trie_get_child_num(t) == 1);
+    next = trie_get_child(t, 0);
+    trie_writelock(&(next->lock));
+    newlen = trie_data_len(t) + trie_data_len(next) + 1; // +1 is for the first character
+
+    if (!(next->data.dealloc) && (trie_data(t) + trie_data_len(t) + 1 == trie_data(next))) {
+        // Do nothing!, data is already where it should be
+        assert(trie_data(t)[trie_data_len(t)] == trie_get_first(t, 0));
+    } else { // Copies both in a new buffer
+        newdata = trie_label_alloc(newlen);
+        assert(newdata);
+        memcpy(newdata, trie_data(t), trie_data_len(t)*sizeof(*newdata));
+        newdata[trie_data_len(t)] = trie_get_first(t, 0);
+        memcpy(newdata + trie_data_len(t) + 1, trie_data(next), trie_data_len(next)*sizeof(*newdata));
+        if (next->data.dealloc) // Data of next is going to be freed
+            trie_own_childs_data(next, trie_data(next), trie_data_len(next));
+        trie_destroy_data(t);
+        trie_destroy_data(next);
+        trie_set_data(t, newdata);
+        t->data.dealloc = 1;
+    }
+    trie_data_len(t) = newlen;
+    t->data.end = next->data.end;
+    trie_atomic_store(&(t->count), trie_get_count(next)); // Parent readers may be counting
+
+    // Childs of next became childs of t
+    if (trie_get_childs(next) != NULL) {
+        trie_mem_free(trie_get_childs(t));
+        trie_mem_free(trie_get_firsts(t));
+        memcpy(&(t->childs), &(next->childs), sizeof(t->childs));
+    } else { // Keeps the arrays, a not empty root must have them (see trie_is_empty)
+        trie_get_child_num(t) = 0;
+    }
+
+    trie_unlock(&(next->lock));
+    trie_destroy_mutex(&(next->lock));
+    trie_node_free(next);
+}
+
 void trie_arr_init(trie_arr_t * arr) {
     arr->data = NULL;
     arr->len = arr->alloc = 0;
@@ -120,6 +233,19 @@ void trie_arr_clear(trie_arr_t * arr) {
     arr->len = arr->alloc = 0;
 }
 
+void trie_keys_init(trie_keys_t * keys) {
+    trie_arr_init(&(keys->data));
+    keys->lens = NULL;
+    keys->num = keys->alloc = 0;
+}
+
+void trie_keys_clear(trie_keys_t * keys) {
+    trie_arr_clear(&(keys->data));
+    free(keys->lens);
+    keys->lens = NULL;
+    keys->num = keys->alloc = 0;
+}
+
 void trie_iterator_init(trie_iterator_t * iterator) {
     trie_arr_init(iterator); // They are typedef for the same type
 }
@@ -140,6 +266,73 @@ void trie_iterator_substitute_end(trie_iterator_t * iterator, int offset, const
     memcpy(iterator->data + offset, new_data, (new_data_len)*sizeof*(iterator->data));
 }
 
+// Same as above, but grows geometrically. Use it for buffers written many times
+static inline
+void trie_arr_substitute_end(trie_arr_t * arr, int offset, const DATA_t * new_data, int new_data_len) {
+    if (offset + new_data_len > arr->alloc) {
+        arr->alloc = 2*(offset + new_data_len);
+        arr->data = realloc(arr->data, (arr->alloc)*sizeof*(arr->data));
+        assert(arr->data);
+    }
+
+    arr->len = offset + new_data_len;
+    memcpy(arr->data + offset, new_data, (new_data_len)*sizeof*(arr->data));
+}
+
+// Appends a key after the others
+static inline
+void trie_keys_add(trie_keys_t * keys, const DATA_t * key, int len) {
+    if (keys->num == keys->alloc) { // Doubles
+        keys->alloc = (keys->alloc == 0)?16:(2*keys->alloc);
+        keys->lens = realloc(keys->lens, (keys->alloc)*sizeof*(keys->lens));
+        assert(keys->lens);
+    }
+    trie_arr_substitute_end(&(keys->data), trie_arr_len(&(keys->data)), key, len);
+    keys->lens[keys->num++] = len;
+}
+
+// Explicit stack of the nodes on the current path, used by depth first traversals
+struct _trie_stack_item {
+    struct _trie * node;
+    int child; // Next child to visit
+    int offset; // Where node data begins in the key
+};
+
+struct _trie_stack {
+    struct _trie_stack_item * items;
+    int num; // Items in the stack
+    int alloc; // Allocated items
+};
+
+static inline
+void trie_stack_init(struct _trie_stack * stack) {
+    stack->items = NULL;
+    stack->num = stack->alloc = 0;
+}
+
+static inline
+void trie_stack_clear(struct _trie_stack * stack) {
+    free(stack->items);
+    trie_stack_init(stack);
+}
+
+static inline
+void trie_stack_push(struct _trie_stack * stack, struct _trie * node, int offset) {
+    if (stack->num == stack->alloc) { // Doubles
+        stack->alloc = (stack->alloc == 0)?16:(2*stack->alloc);
+        stack->items = realloc(stack->items, (stack->alloc)*sizeof*(stack->items));
+        assert(stack->items);
+    }
+    stack->items[stack->num].node = node;
+    stack->items[stack->num].child = 0;
+    stack->items[stack->num].offset = offset;
+    stack->num++;
+}
+
+#define trie_stack_top(stack)   (&((stack)->items[(stack)->num - 1]))
+#define trie_stack_pop(stack)   ((stack)->num--)
+#define trie_stack_empty(stack) ((stack)->num == 0)
+
 #define trie_iterator_first_iterator(iterator) iterator->alloc == 0
 #define trie_iterator_use_iterator(iterator)                                                            \
         iterator->alloc = 1;                                                                            \
@@ -0,0 +1,636 @@
+/*
+    Multithread Trie library, fast implementation of trie data structure
+    Copyright (C) 2016  Alessio Serraino
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see http://www.gnu.org/licenses/ .
+*/
+
+#include <stdio.h> // FILE, rename
+#include <stdlib.h> // malloc
+#include <string.h> // memcpy
+#include <stdint.h> // uint32_t
+#include <assert.h>
+#include <fcntl.h> // open
+#include <unistd.h> // write, fdatasync
+#include <time.h> // clock_gettime
+#ifndef NO_PTHREAD
+#include <pthread.h>
+#endif
+#include "trie.h"
+
+// This source uses functions from:
+//    trie.c (trie_add, trie_remove, trie_remove_prefix), trie_ckpt.c (trie_ckpt_*)
+
+/*
+   Write ahead log. Files, for a given path:
+   path.ckpt.*    checkpoints, see trie_ckpt.c
+   path.log       operations after the checkpoint
+   path.log.old   operations of the log being checkpointed, removed when the checkpoint is done
+   Records: [ 1 byte op ] [ int32 len ] [ uint32 checksum ] [ len symbols ]. Recovery stops at
+   the first truncated record, or with a wrong checksum (torn write).
+
+   Each operation leaves its key present or absent, so replaying operations already in the
+   checkpoint does not change the result: checkpoints are taken while writers go on.
+   Operations on the same key must be applied and logged in the same order, so each
+   operation holds the stripe of its key from applying to appending. A checkpoint takes
+   every stripe to rotate the log, so no logged operation is still missing in the trie.
+   An operation the trie refuses (memory limit) is not logged.
+
+   Group commit: records are appended to a buffer, one writer at a time writes the whole
+   buffer and syncs it, the others wait for it (TRIE_WAL_SYNC) or go on.
+
+   If writing or syncing fails the log is truncated back to its last good size, so no torn
+   record is left, and the records go back in front of the buffer. Operations are refused
+   until trie_wal_sync (or a checkpoint) writes them again. The log stays failed if even the
+   truncation fails, or if a sync fails with records written before and no longer buffered.
+*/
+
+#define TRIE_WAL_ADD    'A'
+#define TRIE_WAL_REMOVE 'R'
+#define TRIE_WAL_PREFIX 'P' // trie_remove_prefix
+#define TRIE_WAL_HEADER 9 // Bytes before the symbols of a record
+#define TRIE_WAL_BUFFER (64*1024) // Bytes buffered before writing, TRIE_WAL_ASYNC
+#define TRIE_WAL_FAILED 1 // failed: a flush failed, its records are still in the buffer
+#define TRIE_WAL_BROKEN 2 // failed: the log cannot be written again from a good size
+
+static inline
+uint32_t trie_wal_checksum(int op, int len, const DATA_t * arr) { // FNV-1a
+    uint32_t h = 2166136261u;
+    const unsigned char * bytes;
+    size_t i;
+
+    h = (h ^ (unsigned char)op)*16777619u;
+    bytes = (const unsigned char *)&len;
+    for (i = 0; i < sizeof(len); i++)
+        h = (h ^ bytes[i])*16777619u;
+    bytes = (const unsigned char *)arr;
+    for (i = 0; i < len*sizeof(DATA_t); i++)
+        h = (h ^ bytes[i])*16777619u;
+    return h;
+}
+
+static inline
+long long trie_wal_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+// path + suffix, in a new buffer
+static
+char * trie_wal_name(const char * path, const char * suffix) {
+    char * name = malloc(strlen(path) + strlen(suffix) + 1);
+    assert(name);
+    strcpy(name, path);
+    strcat(name, suffix);
+    return name;
+}
+
+static inline
+void trie_wal_lock(trie_wal_t * w) {
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(w->lock));
+#else
+    (void)w;
+#endif
+}
+
+static inline
+void trie_wal_unlock(trie_wal_t * w) {
+#ifndef NO_PTHREAD
+    pthread_mutex_unlock(&(w->lock));
+#else
+    (void)w;
+#endif
+}
+
+static inline
+int trie_wal_stripe(const DATA_t * arr, int len) {
+    return trie_wal_checksum(0, len, arr) % TRIE_WAL_STRIPES;
+}
+
+static inline
+void trie_wal_lock_stripes(trie_wal_t * w, int stripe) { // -1 for all of them
+#ifndef NO_PTHREAD
+    int i;
+    if (stripe >= 0) {
+        pthread_mutex_lock(w->stripes + stripe);
+        return;
+    }
+    for (i = 0; i < TRIE_WAL_STRIPES; i++) // Always in the same order
+        pthread_mutex_lock(w->stripes + i);
+#else
+    (void)w;
+    (void)stripe;
+#endif
+}
+
+static inline
+void trie_wal_unlock_stripes(trie_wal_t * w, int stripe) {
+#ifndef NO_PTHREAD
+    int i;
+    if (stripe >= 0) {
+        pthread_mutex_unlock(w->stripes + stripe);
+        return;
+    }
+    for (i = TRIE_WAL_STRIPES - 1; i >= 0; i--)
+        pthread_mutex_unlock(w->stripes + i);
+#else
+    (void)w;
+    (void)stripe;
+#endif
+}
+
+static
+int trie_wal_write_all(int fd, const unsigned char * buf, size_t len) {
+    ssize_t res;
+    while (len > 0) {
+        res = write(fd, buf, len);
+        if (res < 0)
+            return FAIL;
+        buf += res;
+        len -= res;
+    }
+    return SUCCESS;
+}
+
+// Writes the buffer (and syncs it). Called and returns with w locked, unlocks it meanwhile
+static
+int trie_wal_flush(trie_wal_t * w, int sync) {
+    unsigned char * buf;
+    size_t len, alloc;
+    long long lsn;
+    int res, written;
+
+#ifndef NO_PTHREAD
+    while (w->flushing) // One writer at a time, the buffer is still filled
+        pthread_cond_wait(&(w->flushed), &(w->lock));
+#endif
+    if (w->failed == TRIE_WAL_BROKEN)
+        return FAIL; // Records written after it might not be replayed
+    if ((w->synced_lsn == w->lsn) || (!sync && (w->written_lsn == w->lsn)))
+        return SUCCESS; // Already done by another one
+    w->flushing = 1;
+    buf = w->buf; // Takes the buffer, others fill the spare one
+    len = w->buf_len;
+    alloc = w->buf_alloc;
+    lsn = w->lsn;
+    w->buf = w->spare;
+    w->buf_alloc = w->spare_alloc;
+    w->buf_len = 0;
+    w->spare = NULL;
+    trie_wal_unlock(w);
+
+    res = trie_wal_write_all(w->fd, buf, len);
+    written = (res == SUCCESS);
+    if (written && sync)
+        res = (fdatasync(w->fd) == 0)?SUCCESS:FAIL;
+
+    trie_wal_lock(w);
+    if (res != SUCCESS) { // Records after log_size may be torn, or not synced
+        if ((written && (w->written_lsn > w->synced_lsn)) || (ftruncate(w->fd, w->log_size) != 0))
+            w->failed = TRIE_WAL_BROKEN;
+        else
+            w->failed = TRIE_WAL_FAILED;
+        if (len + w->buf_len > alloc) { // The ones appended meanwhile go after them
+            alloc = len + w->buf_len;
+            buf = realloc(buf, alloc);
+            assert(buf);
+        }
+        if (w->buf_len > 0)
+            memcpy(buf + len, w->buf, w->buf_len);
+        w->spare = w->buf;
+        w->spare_alloc = w->buf_alloc;
+        w->buf = buf;
+        w->buf_alloc = alloc;
+        w->buf_len += len;
+    } else {
+        w->spare = buf; // Next flush fills it
+        w->spare_alloc = alloc;
+        w->written_lsn = lsn;
+        if (sync) {
+            w->synced_lsn = lsn;
+            w->stats.syncs++;
+        }
+        w->stats.log_bytes += len;
+        w->log_size += len;
+        w->failed = 0;
+    }
+    w->last_sync_us = trie_wal_now_us();
+    w->flushing = 0;
+#ifndef NO_PTHREAD
+    pthread_cond_broadcast(&(w->flushed));
+#endif
+    return res;
+}
+
+// Appends a record to the buffer, w must be locked. Returns its number
+static
+long long trie_wal_append(trie_wal_t * w, int op, const DATA_t * arr, int len) {
+    uint32_t checksum;
+    size_t size;
+
+    size = TRIE_WAL_HEADER + len*sizeof(DATA_t);
+    if (w->buf_len + size > w->buf_alloc) { // Doubles
+        w->buf_alloc = (2*w->buf_alloc > w->buf_len + size)?(2*w->buf_alloc):(w->buf_len + size);
+        w->buf = realloc(w->buf, w->buf_alloc);
+        assert(w->buf);
+    }
+    checksum = trie_wal_checksum(op, len, arr);
+    w->buf[w->buf_len] = op;
+    memcpy(w->buf + w->buf_len + 1, &len, sizeof(int32_t));
+    memcpy(w->buf + w->buf_len + 5, &checksum, sizeof(checksum));
+    if (len > 0)
+        memcpy(w->buf + w->buf_len + TRIE_WAL_HEADER, arr, len*sizeof(DATA_t));
+    w->buf_len += size;
+    w->stats.records++;
+    w->stats.payload_bytes += len*sizeof(DATA_t);
+    return ++(w->lsn);
+}
+
+// Returns FAIL if the trie refuses it
+static
+int trie_wal_apply(trie_ptr_t t, int op, const DATA_t * arr, int len) {
+    switch (op) {
+    case TRIE_WAL_ADD:
+        return (trie_add(t, arr, len) == SUCCESS)?1:FAIL;
+    case TRIE_WAL_REMOVE:
+        trie_remove(t, arr, len);
+        return 1;
+    case TRIE_WAL_PREFIX:
+        return trie_remove_prefix(t, arr, len);
+    }
+    return FAIL;
+}
+
+static
+void trie_wal_checkpoint_needed(trie_wal_t * w);
+
+// Applies and logs an operation. Returns FAIL if refused, or if the log cannot be written
+static
+int trie_wal_op(trie_wal_t * w, int op, const DATA_t * arr, int len) {
+    long long lsn;
+    int stripe, res, failed;
+
+    stripe = (op == TRIE_WAL_PREFIX)?-1:trie_wal_stripe(arr, len); // Every key starting with prefix
+    trie_wal_lock_stripes(w, stripe);
+    trie_wal_lock(w);
+    failed = w->failed; // Refused until the records kept are written
+    trie_wal_unlock(w);
+    res = failed?FAIL:trie_wal_apply(w->trie, op, arr, len); // Same order as the log, for this key
+    if (res == FAIL) { // Nothing changed, nothing to log
+        trie_wal_unlock_stripes(w, stripe);
+        return FAIL;
+    }
+    trie_wal_lock(w);
+    lsn = trie_wal_append(w, op, arr, len);
+    if ((w->config.durability == TRIE_WAL_ASYNC) && (w->buf_len >= TRIE_WAL_BUFFER) &&
+        (trie_wal_flush(w, 0) != SUCCESS))
+        res = FAIL;
+#ifdef NO_PTHREAD // No background thread, checks the time here
+    if ((w->config.durability == TRIE_WAL_BATCH) &&
+        (trie_wal_now_us() - w->last_sync_us >= 1000LL*w->config.sync_ms) &&
+        (trie_wal_flush(w, 1) != SUCCESS))
+        res = FAIL;
+#endif
+    trie_wal_unlock(w);
+    trie_wal_unlock_stripes(w, stripe);
+
+    trie_wal_lock(w);
+    if (w->config.durability == TRIE_WAL_SYNC) // Group commit, the flush writes every record buffered
+        while ((res != FAIL) && (w->synced_lsn < lsn))
+            if (trie_wal_flush(w, 1) != SUCCESS)
+                res = FAIL;
+    trie_wal_checkpoint_needed(w);
+    trie_wal_unlock(w);
+    return res;
+}
+
+#define TRIE_WAL_REFUSED -2 // A record the trie cannot hold, see trie_wal_replay
+
+// Replays the records of a file. Returns the length of the valid part, -1 if it does not exist,
+// or TRIE_WAL_REFUSED: the file is left as it is, the next records are not torn
+static
+long trie_wal_replay(trie_wal_t * w, const char * name) {
+    FILE * fp;
+    unsigned char * data;
+    long size, pos;
+    int32_t len;
+    uint32_t checksum;
+    DATA_t * arr;
+
+    fp = fopen(name, "rb");
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    data = malloc(size + 1);
+    assert(data);
+    size = fread(data, 1, size, fp);
+    fclose(fp);
+
+    arr = NULL;
+    for (pos = 0; pos + TRIE_WAL_HEADER <= size; pos += TRIE_WAL_HEADER + len*sizeof(DATA_t)) {
+        memcpy(&len, data + pos + 1, sizeof(len));
+        memcpy(&checksum, data + pos + 5, sizeof(checksum));
+        if ((len < 0) || ((size - pos - TRIE_WAL_HEADER)/(long)sizeof(DATA_t) < len))
+            break; // Truncated
+        arr = realloc(arr, (len + 1)*sizeof(*arr)); // Symbols may be not aligned in data
+        assert(arr);
+        memcpy(arr, data + pos + TRIE_WAL_HEADER, len*sizeof(DATA_t));
+        if (trie_wal_checksum(data[pos], len, arr) != checksum)
+            break; // Torn write
+        if (trie_wal_apply(w->trie, data[pos], arr, len) == FAIL) {
+            pos = TRIE_WAL_REFUSED;
+            break;
+        }
+        w->stats.replayed++;
+    }
+    free(arr);
+    free(data);
+    return pos;
+}
+
+// Writes an incremental checkpoint
+static
+int trie_wal_write_checkpoint(trie_wal_t * w) {
+    trie_ckpt_stats_t stats;
+    int res;
+
+    res = trie_ckpt_write(&(w->ckpt));
+    trie_ckpt_stats(&(w->ckpt), &stats);
+    trie_wal_lock(w);
+    w->stats.checkpoint_bytes = stats.bytes + stats.merge_bytes;
+    trie_wal_unlock(w);
+    return res;
+}
+
+int trie_wal_checkpoint(trie_wal_t * w) {
+    char * log, * old;
+    int res;
+
+    if (w == NULL)
+        return FAIL; // Invalid ptr
+    trie_wal_lock(w);
+#ifndef NO_PTHREAD
+    while (w->checkpointing) // One at a time, the old log is the same file
+        pthread_cond_wait(&(w->flushed), &(w->lock));
+#endif
+    w->checkpointing = 1;
+    trie_wal_unlock(w);
+    log = trie_wal_name(w->path, ".log");
+    old = trie_wal_name(w->path, ".log.old");
+
+    // Rotates the log, every operation logged is also applied
+    trie_wal_lock_stripes(w, -1);
+    trie_wal_lock(w);
+    res = trie_wal_flush(w, 1);
+    // If the last checkpoint failed the old log is still needed, keeps this one too (replaying it again is harmless)
+    if ((res == SUCCESS) && (access(old, F_OK) != 0)) {
+        if (rename(log, old) == 0) {
+            close(w->fd);
+            w->fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+            w->log_size = 0;
+            res = (w->fd < 0)?FAIL:SUCCESS;
+        } else {
+            res = FAIL;
+        }
+    }
+    trie_wal_unlock(w);
+    trie_wal_unlock_stripes(w, -1);
+
+    if (res == SUCCESS)
+        res = trie_wal_write_checkpoint(w);
+    if (res == SUCCESS) // Until here recovery needs the old log
+        unlink(old);
+    trie_wal_lock(w);
+    if (res == SUCCESS)
+        w->stats.checkpoints++;
+    w->checkpointing = 0;
+#ifndef NO_PTHREAD
+    pthread_cond_broadcast(&(w->flushed));
+#endif
+    trie_wal_unlock(w);
+    free(log);
+    free(old);
+    return res;
+}
+
+// Asks a checkpoint if the log is too long. w must be locked
+static
+void trie_wal_checkpoint_needed(trie_wal_t * w) {
+    if ((w->config.checkpoint_bytes <= 0) || (w->log_size < w->config.checkpoint_bytes) || w->checkpoint_asked)
+        return;
+    w->checkpoint_asked = 1;
+#ifndef NO_PTHREAD
+    pthread_cond_signal(&(w->wake)); // The background thread takes it
+#else
+    trie_wal_unlock(w);
+    trie_wal_checkpoint(w);
+    trie_wal_lock(w);
+    w->checkpoint_asked = 0;
+#endif
+}
+
+#ifndef NO_PTHREAD
+// Syncs every sync_ms (TRIE_WAL_BATCH) and takes the checkpoints
+static
+void * trie_wal_thread(void * arg) {
+    trie_wal_t * w = arg;
+    struct timespec ts;
+    long long deadline;
+
+    pthread_mutex_lock(&(w->lock));
+    while (!w->closing) {
+        if (w->checkpoint_asked) {
+            pthread_mutex_unlock(&(w->lock));
+            trie_wal_checkpoint(w);
+            pthread_mutex_lock(&(w->lock));
+            w->checkpoint_asked = 0;
+            continue;
+        }
+        if ((w->config.durability == TRIE_WAL_BATCH) && (w->synced_lsn < w->lsn) && !w->failed) {
+            trie_wal_flush(w, 1);
+            continue; // Something might have happened meanwhile
+        }
+        if (w->config.durability == TRIE_WAL_BATCH) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            deadline = ts.tv_nsec + 1000000LL*w->config.sync_ms;
+            ts.tv_sec += deadline/1000000000;
+            ts.tv_nsec = deadline%1000000000;
+            pthread_cond_timedwait(&(w->wake), &(w->lock), &ts);
+        } else {
+            pthread_cond_wait(&(w->wake), &(w->lock));
+        }
+    }
+    pthread_mutex_unlock(&(w->lock));
+    return NULL;
+}
+#endif
+
+void trie_wal_config_init(trie_wal_config_t * config) {
+    config->durability = TRIE_WAL_BATCH;
+    config->sync_ms = 10;
+    config->checkpoint_bytes = 64*1024*1024;
+    config->max_chain = 8;
+}
+
+int trie_wal_open(trie_wal_t * w, trie_ptr_t t, const char * path, const trie_wal_config_t * config) {
+    char * ckpt, * log, * old;
+    long valid;
+    int res, i, opened;
+    long long begin;
+
+    if ((w == NULL) || (t == NULL) || (path == NULL) || (path[0] == '\0'))
+        return FAIL; // Invalid ptr
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->trie = t;
+    w->path = trie_wal_name(path, "");
+    if (config != NULL)
+        w->config = *config;
+    else
+        trie_wal_config_init(&(w->config));
+#ifndef NO_PTHREAD
+    pthread_mutex_init(&(w->lock), NULL);
+    pthread_cond_init(&(w->flushed), NULL);
+    pthread_cond_init(&(w->wake), NULL);
+    for (i = 0; i < TRIE_WAL_STRIPES; i++)
+        pthread_mutex_init(w->stripes + i, NULL);
+#endif
+    ckpt = trie_wal_name(path, ".ckpt");
+    log = trie_wal_name(path, ".log");
+    old = trie_wal_name(path, ".log.old");
+
+    // Recovery: last checkpoint, then the logs
+    begin = trie_wal_now_us();
+    res = trie_ckpt_open(&(w->ckpt), t, ckpt, w->config.max_chain);
+    opened = (res == SUCCESS);
+    free(ckpt);
+    valid = (res == SUCCESS)?trie_wal_replay(w, old):-1;
+    i = (valid >= 0); // A checkpoint did not end
+    if (valid != TRIE_WAL_REFUSED)
+        valid = (res == SUCCESS)?trie_wal_replay(w, log):-1;
+    if (valid == TRIE_WAL_REFUSED) // Memory limit, the logs stay for a larger one
+        res = FAIL;
+    w->stats.recovery_us = trie_wal_now_us() - begin;
+
+    if ((res == SUCCESS) && i) { // The next rotation would overwrite the old log, checkpoints now
+        res = trie_wal_write_checkpoint(w);
+        if (res == SUCCESS) { // Both logs are in the checkpoint
+            valid = 0;
+            unlink(old);
+        }
+    }
+    if (res == SUCCESS) {
+        w->fd = open(log, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if ((w->fd < 0) || ((valid >= 0) && (ftruncate(w->fd, valid) != 0))) // Drops a torn tail
+            res = FAIL;
+        w->log_size = (valid > 0)?valid:0;
+    }
+    free(log);
+    free(old);
+    w->last_sync_us = trie_wal_now_us();
+
+#ifndef NO_PTHREAD
+    if (res == SUCCESS) {
+        i = pthread_create(&(w->thread), NULL, trie_wal_thread, w);
+        assert(i == 0);
+        return SUCCESS;
+    }
+    pthread_mutex_destroy(&(w->lock));
+    pthread_cond_destroy(&(w->flushed));
+    pthread_cond_destroy(&(w->wake));
+    for (i = 0; i < TRIE_WAL_STRIPES; i++)
+        pthread_mutex_destroy(w->stripes + i);
+#endif
+    if (res != SUCCESS) {
+        if (w->fd >= 0)
+            close(w->fd);
+        if (opened)
+            trie_ckpt_close(&(w->ckpt));
+        free(w->path);
+        w->path = NULL;
+    }
+    return res;
+}
+
+int trie_wal_close(trie_wal_t * w) {
+    int res;
+#ifndef NO_PTHREAD
+    int i;
+#endif
+
+    if ((w == NULL) || (w->path == NULL))
+        return FAIL; // Invalid ptr
+#ifndef NO_PTHREAD
+    pthread_mutex_lock(&(w->lock));
+    w->closing = 1;
+    pthread_cond_signal(&(w->wake));
+    pthread_mutex_unlock(&(w->lock));
+    pthread_join(w->thread, NULL);
+#endif
+    trie_wal_lock(w);
+    res = trie_wal_flush(w, 1);
+    trie_wal_unlock(w);
+    close(w->fd);
+    trie_ckpt_close(&(w->ckpt));
+#ifndef NO_PTHREAD
+    pthread_mutex_destroy(&(w->lock));
+    pthread_cond_destroy(&(w->flushed));
+    pthread_cond_destroy(&(w->wake));
+    for (i = 0; i < TRIE_WAL_STRIPES; i++)
+        pthread_mutex_destroy(w->stripes + i);
+#endif
+    free(w->buf);
+    free(w->spare);
+    free(w->path);
+    w->path = NULL;
+    return res;
+}
+
+int trie_wal_add(trie_wal_t * w, const DATA_t * arr, int len) {
+    if ((w == NULL) || (arr == NULL))
+        return FAIL; // Invalid ptr
+    return (trie_wal_op(w, TRIE_WAL_ADD, arr, len) == FAIL)?FAIL:SUCCESS;
+}
+
+int trie_wal_remove(trie_wal_t * w, const DATA_t * arr, int len) {
+    if ((w == NULL) || (arr == NULL))
+        return FAIL; // Invalid ptr
+    return (trie_wal_op(w, TRIE_WAL_REMOVE, arr, len) == FAIL)?FAIL:SUCCESS;
+}
+
+int trie_wal_remove_prefix(trie_wal_t * w, const DATA_t * prefix, int len) {
+    if ((w == NULL) || ((prefix == NULL) && (len > 0)))
+        return FAIL; // Invalid ptr
+    return trie_wal_op(w, TRIE_WAL_PREFIX, prefix, len);
+}
+
+int trie_wal_sync(trie_wal_t * w) {
+    int res;
+    if (w == NULL)
+        return FAIL; // Invalid ptr
+    trie_wal_lock(w);
+    res = trie_wal_flush(w, 1);
+    trie_wal_unlock(w);
+    return res;
+}
+
+void trie_wal_stats(trie_wal_t * w, trie_wal_stats_t * stats) {
+    trie_wal_lock(w);
+    *stats = w->stats;
+    trie_wal_unlock(w);
+}